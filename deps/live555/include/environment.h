@@ -10,6 +10,7 @@
 #pragma once
 
 #include "BasicUsageEnvironment.hh"
+#include "NetCommon.h"
 
 class Environment : public BasicUsageEnvironment {
 public:
@@ -18,9 +19,20 @@ public:
 	virtual ~Environment();
 
 	void mainloop();
+	// can be called from any thread, wakes up the event loop
 	void stop();
+	// can be called from any thread, breaks the select() of the event loop so the
+	// triggered events are handled now instead of on the next scheduler tick
+	void wakeup();
 
 protected:
+	static void stopHandler(void* clientData);
+	static void incomingWakeupHandler(void* clientData, int mask);
+	static int openWakeupSocket();
+
 	char& m_stop;
 	char m_stopRef;
+	EventTriggerId m_stopTrigger;
+	// a loopback datagram socket which sends to itself
+	int m_wakeupSocket;
 };
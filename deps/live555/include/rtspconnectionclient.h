@@ -132,6 +132,7 @@ public:
 	void start(unsigned int delay = 0);
 	std::string getUrl() { return m_url; }
 	int getRtpTransport() { return m_rtptransport; }
+	MediaSubsession* getMediaSubSession() { return m_rtspClient->getMediaSubSession(); }
 	const char* getFmtpSpropParametersSets() {
 		return m_rtspClient->getMediaSubSession()->fmtp_spropparametersets();
 	}
@@ -9,17 +9,53 @@
 
 #include <iostream>
 #include "Environment.h"
+#include "GroupsockHelper.hh"
 
 Environment::Environment() : Environment(m_stopRef) {}
 
 Environment::Environment(char& stop)
   : BasicUsageEnvironment(*BasicTaskScheduler::createNew()),
-    m_stop(stop) {
+    m_stop(stop),
+    m_wakeupSocket(-1) {
 	m_stop = 0;
+	m_stopTrigger = this->taskScheduler().createEventTrigger(stopHandler);
+
+	m_wakeupSocket = openWakeupSocket();
+	if (m_wakeupSocket >= 0) {
+		this->taskScheduler().setBackgroundHandling(m_wakeupSocket, SOCKET_READABLE,
+							    incomingWakeupHandler, this);
+	}
+}
+
+int Environment::openWakeupSocket() {
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0) {
+		return -1;
+	}
+	// bound to the loopback and connected to itself, nothing but `wakeup` can wake up
+	// the loop, and non-blocking so the handler can drain it
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t length = sizeof(address);
+	if (bind(sock, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+	    getsockname(sock, (struct sockaddr*)&address, &length) != 0 ||
+	    connect(sock, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+	    !makeSocketNonBlocking(sock)) {
+		closeSocket(sock);
+		return -1;
+	}
+	return sock;
 }
 
 Environment::~Environment() {
 	TaskScheduler* scheduler = &this->taskScheduler();
+	if (m_wakeupSocket >= 0) {
+		scheduler->disableBackgroundHandling(m_wakeupSocket);
+		closeSocket(m_wakeupSocket);
+	}
+	scheduler->deleteEventTrigger(m_stopTrigger);
 	delete scheduler;
 }
 
@@ -28,5 +64,28 @@ void Environment::mainloop() {
 }
 
 void Environment::stop() {
-	m_stop = 1;
+	// triggerEvent is the only scheduler call that is safe from another thread, the
+	// watch variable is only written by its handler on the loop thread
+	this->taskScheduler().triggerEvent(m_stopTrigger, this);
+	wakeup();
+}
+
+void Environment::stopHandler(void* clientData) {
+	static_cast<Environment*>(clientData)->m_stop = 1;
+}
+
+void Environment::wakeup() {
+	if (m_wakeupSocket < 0) { // the trigger is still handled on the next tick
+		return;
+	}
+	// fails harmlessly when the wakeups which are still pending fill the buffer
+	char byte = 0;
+	send(m_wakeupSocket, &byte, 1, 0);
+}
+
+void Environment::incomingWakeupHandler(void* clientData, int) {
+	Environment* env = static_cast<Environment*>(clientData);
+	// drain the pending wakeups, the socket is non-blocking
+	char buffer[64];
+	while (recv(env->m_wakeupSocket, buffer, sizeof(buffer), 0) > 0) {}
 }
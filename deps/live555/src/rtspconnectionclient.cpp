@@ -12,6 +12,7 @@
 #include "RtspConnectionClient.h"
 
 #include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 
@@ -167,9 +168,14 @@ void RTSPConnection::RTSPClientConnection::sendNextCommand() {
 		this->sendDescribeCommand(continueAfterDESCRIBE);
 	} else {
 		m_subSession = m_subSessionIter->next();
-		if (m_subSession != NULL) {
+		// the obs-rtsp server sends FEC(RFC 5109) in a track of its own, to unicast UDP
+		// clients only. live555 doesn't know the payload format, it reads it as plain RTP
+		bool fec = m_subSession != NULL && strcmp(m_subSession->codecName(), "ULPFEC") == 0;
+		if (fec && m_rtptransport != RTPUDPUNICAST) {
+			this->sendNextCommand();
+		} else if (m_subSession != NULL) {
 			// still subsession to SETUP
-			if (!m_subSession->initiate()) {
+			if (!m_subSession->initiate(fec ? 0 : -1)) {
 				envir() << "Failed to initiate " << m_subSession->mediumName()
 					<< "/" << m_subSession->codecName()
 					<< " subsession: " << envir().getResultMsg() << "\n";
@@ -2,6 +2,7 @@
 
 #include "src/rtsp_source.h"
 #include "src/rtsp_output.h"
+#include "src/utils/start_sequence.h"
 
 OBS_DECLARE_MODULE()
 OBS_MODULE_USE_DEFAULT_LOCALE("obs-rtsp", "en-US")
@@ -10,6 +11,8 @@ MODULE_EXPORT const char* obs_module_description(void) {
 }
 
 bool obs_module_load() {
+	blog(LOG_INFO, "rtsp start sequence scanner: %s", utils::video::StartSequenceKernel());
+
 	// register source
 	register_rtsp_source();
 
@@ -19,3 +22,8 @@ bool obs_module_load() {
 
 	return true;
 }
+
+void obs_module_unload() {
+	// wait for the RTSP clients which are still tearing down
+	source::ClientReaper::Instance().Shutdown();
+}
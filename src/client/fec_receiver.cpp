@@ -0,0 +1,151 @@
+#include "fec_receiver.h"
+
+#include "GroupsockHelper.hh"
+#include "src/utils/ulpfec.h"
+#include "src/utils/utils.h"
+
+#include <obs-module.h>
+
+#include <netinet/in.h>
+
+namespace source {
+// a power of two, far more than the 48 packets a FEC packet covers
+static const size_t kMediaPackets = 512;
+// the FEC packets which wait for a second lost packet to show up
+static const size_t kMaxPendingFec = 64;
+
+bool FecReceiver::IsFecCodec(const char* codec) {
+	// live555 has the codec names in upper case
+	return codec != nullptr && utils::string::ToLower(codec) == "ulpfec";
+}
+
+FecReceiver::FecReceiver(UsageEnvironment& env, RTPSource* source, RTPSource* fec_source)
+  : env_(env),
+    source_(source),
+    fec_source_(fec_source),
+    socket_(-1),
+    destination_(),
+    media_(kMediaPackets),
+    ssrc_(0),
+    last_seq_(0),
+    has_media_(false),
+    fec_packets_(0),
+    recovered_packets_(0) {
+	// the recovered packets go to the port the source reads from
+	socklen_t length = sizeof(destination_);
+	if (getsockname(source_->RTPgs()->socketNum(), (struct sockaddr*)&destination_,
+			&length) != 0) {
+		blog(LOG_WARNING, "rtsp client can't find its RTP port, FEC is ignored");
+		return;
+	}
+	if (destination_.ss_family == AF_INET)
+		((struct sockaddr_in*)&destination_)->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	else
+		((struct sockaddr_in6*)&destination_)->sin6_addr = in6addr_loopback;
+	socket_ = setupDatagramSocket(env_, 0, destination_.ss_family);
+	if (socket_ < 0) {
+		blog(LOG_WARNING, "rtsp client can't open the FEC socket, FEC is ignored");
+		return;
+	}
+	source_->setAuxilliaryReadHandler(OnMediaPacket, this);
+	fec_source_->setAuxilliaryReadHandler(OnFecPacket, this);
+	blog(LOG_INFO, "rtsp client recovers lost video packets with the FEC track");
+}
+
+FecReceiver::~FecReceiver() {
+	if (socket_ < 0)
+		return;
+	source_->setAuxilliaryReadHandler(nullptr, nullptr);
+	fec_source_->setAuxilliaryReadHandler(nullptr, nullptr);
+	closeSocket(socket_);
+	blog(LOG_INFO, "rtsp client received %llu FEC packets, recovered %llu video packets",
+	     (unsigned long long)fec_packets_, (unsigned long long)recovered_packets_);
+}
+
+void FecReceiver::OnMediaPacket(void* data, unsigned char* packet, unsigned& size) {
+	static_cast<FecReceiver*>(data)->OnMediaPacket(packet, size);
+}
+
+void FecReceiver::OnFecPacket(void* data, unsigned char* packet, unsigned& size) {
+	static_cast<FecReceiver*>(data)->OnFecPacket(packet, size);
+}
+
+void FecReceiver::OnFecPacket(const unsigned char* packet, unsigned size) {
+	if (size < utils::ulpfec::kRtpHeaderSize || (packet[0] & 0xC0) != 0x80 ||
+	    (packet[1] & 0x7F) != fec_source_->rtpPayloadFormat())
+		return;
+	++fec_packets_;
+	if (fec_.size() == kMaxPendingFec)
+		fec_.pop_front();
+	fec_.emplace_back(packet + utils::ulpfec::kRtpHeaderSize, packet + size);
+	Recover();
+}
+
+void FecReceiver::OnMediaPacket(const unsigned char* packet, unsigned size) {
+	if (size < utils::ulpfec::kRtpHeaderSize || (packet[0] & 0xC0) != 0x80 ||
+	    (packet[1] & 0x7F) != source_->rtpPayloadFormat())
+		return;
+
+	uint16_t seq = utils::ulpfec::Seq(packet);
+	// a recovered packet comes back through the socket
+	if (Find(seq) != nullptr)
+		return;
+	MediaPacket& entry = media_[seq & (kMediaPackets - 1)];
+	entry.valid = true;
+	entry.seq = seq;
+	entry.data.assign(packet, packet + size);
+	ssrc_ = (uint32_t)packet[8] << 24 | (uint32_t)packet[9] << 16 | (uint32_t)packet[10] << 8 |
+		packet[11];
+	if (!has_media_ || (int16_t)(seq - last_seq_) > 0)
+		last_seq_ = seq;
+	has_media_ = true;
+	// a packet which came late may be the last but one missing of a FEC packet
+	if (!fec_.empty())
+		Recover();
+}
+
+FecReceiver::MediaPacket* FecReceiver::Find(uint16_t seq) {
+	MediaPacket& entry = media_[seq & (kMediaPackets - 1)];
+	return entry.valid && entry.seq == seq ? &entry : nullptr;
+}
+
+void FecReceiver::Recover() {
+	std::vector<uint16_t> seqs;
+	std::vector<utils::ulpfec::Packet> packets;
+	std::vector<uint8_t> recovered;
+	for (auto it = fec_.begin(); it != fec_.end();) {
+		bool done = true;
+		// the packets of a FEC packet far behind the newest one are gone from the ring
+		if (utils::ulpfec::ProtectedSeqs(it->data(), it->size(), seqs) &&
+		    (int16_t)(last_seq_ - seqs.back()) < (int16_t)(kMediaPackets / 2)) {
+			packets.clear();
+			size_t missing_count = 0;
+			uint16_t missing = 0;
+			for (uint16_t seq : seqs) {
+				MediaPacket* media = Find(seq);
+				if (media != nullptr) {
+					packets.push_back({media->data.data(), media->data.size()});
+				} else {
+					++missing_count;
+					missing = seq;
+				}
+			}
+			if (missing_count == 1 &&
+			    utils::ulpfec::Recover(it->data(), it->size(), packets, missing, ssrc_,
+						   recovered)) {
+				MediaPacket& entry = media_[missing & (kMediaPackets - 1)];
+				entry.valid = true;
+				entry.seq = missing;
+				entry.data = recovered;
+				sendto(socket_, (const char*)recovered.data(), recovered.size(), 0,
+				       (struct sockaddr*)&destination_,
+				       destination_.ss_family == AF_INET ? sizeof(struct sockaddr_in)
+									 : sizeof(struct sockaddr_in6));
+				++recovered_packets_;
+			}
+			done = missing_count <= 1;
+		}
+		it = done ? fec_.erase(it) : it + 1;
+	}
+}
+} // namespace source
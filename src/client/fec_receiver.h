@@ -0,0 +1,59 @@
+#pragma once
+
+#include "liveMedia.hh"
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <deque>
+#include <vector>
+
+namespace source {
+/// <summary>
+/// Recovers the lost video RTP packets from the FEC packets(RFC 5109) the server sends
+/// in the RTP session of the FEC track. It sees every packet the RTP sources of the video
+/// & of the FEC read. A recovered packet is sent to the RTP port of the video source
+/// over the loopback, its reordering buffer puts the packet back in place if it comes
+/// before the source gives up on the gap.
+/// </summary>
+class FecReceiver {
+public:
+	// the codec name of the FEC track, "m=application" with the "ulpfec" payload format
+	static bool IsFecCodec(const char* codec);
+
+	// on the thread of the event loop, the sources have to outlive the receiver
+	FecReceiver(UsageEnvironment& env, RTPSource* source, RTPSource* fec_source);
+	FecReceiver(const FecReceiver&) = delete;
+	~FecReceiver();
+
+private:
+	struct MediaPacket {
+		bool valid = false;
+		uint16_t seq = 0;
+		std::vector<uint8_t> data;
+	};
+
+	UsageEnvironment& env_;
+	RTPSource* source_;
+	RTPSource* fec_source_;
+	int socket_;
+	struct sockaddr_storage destination_;
+	// the last media packets, indexed by their sequence number
+	std::vector<MediaPacket> media_;
+	uint32_t ssrc_;
+	uint16_t last_seq_;
+	bool has_media_;
+	// the FEC payloads which still miss more than one packet
+	std::deque<std::vector<uint8_t>> fec_;
+
+	uint64_t fec_packets_;
+	uint64_t recovered_packets_;
+
+	static void OnMediaPacket(void* data, unsigned char* packet, unsigned& size);
+	static void OnFecPacket(void* data, unsigned char* packet, unsigned& size);
+	void OnMediaPacket(const unsigned char* packet, unsigned size);
+	void OnFecPacket(const unsigned char* packet, unsigned size);
+	MediaPacket* Find(uint16_t seq);
+	// recovers the packets which are the only one missing of a FEC packet
+	void Recover();
+};
+} // namespace source
@@ -1,4 +1,5 @@
 #include "rtsp_client.h"
+#include "fec_receiver.h"
 
 #include <iostream>
 
@@ -13,19 +14,41 @@ namespace source {
 RtspClient::RtspClient(const std::string& uri, const std::map<std::string, std::string>& opts,
 		       RTSPClientObserver* observer)
   : observer_(observer),
+    dispatching_(0),
     env_(nullptr),
     client_(nullptr),
+    video_rtp_source_(nullptr),
+    fec_receiver_(nullptr),
     uri_(uri),
     opts_(opts) {
 	Start();
 }
 
 RtspClient::~RtspClient() {
-	Stop();
+	DetachObserver();
+	if (env_ != nullptr) { // no-op if `Stop` was called already
+		env_->stop();
+	}
+	if (capture_thread_.joinable())
+		capture_thread_.join();
+
+	// the connection is closed by the capture thread, unless it never ran
+	delete fec_receiver_;
+	fec_receiver_ = nullptr;
+	video_rtp_source_ = nullptr;
+	if (client_ != nullptr) {
+		delete client_;
+		client_ = nullptr;
+	}
+	if (env_ != nullptr) {
+		delete env_;
+		env_ = nullptr;
+	}
+	blog(LOG_INFO, "RTSP client released");
 }
 
 bool RtspClient::IsRunning() {
-	return (client_ != nullptr);
+	return observer_.load() != nullptr && capture_thread_.joinable();
 }
 
 uint32_t RtspClient::GetWidth() const {
@@ -39,6 +62,14 @@ uint32_t RtspClient::GetHeight() const {
 void RtspClient::CaptureThread() {
   os_set_thread_name("rtsp_capture_thread");
 	env_->mainloop();
+
+	// live555 objects must be closed in the thread which runs their event loop,
+	// this also sends the TEARDOWN without blocking the caller of `Stop`
+	delete fec_receiver_;
+	fec_receiver_ = nullptr;
+	video_rtp_source_ = nullptr;
+	delete client_;
+	client_ = nullptr;
 }
 
 void RtspClient::Start() {
@@ -54,22 +85,34 @@ void RtspClient::Start() {
 }
 
 void RtspClient::Stop() {
-	if (env_ != nullptr) {
-		env_->stop();
+	if (observer_.load() == nullptr) {
+		return;
 	}
-	capture_thread_.join();
 
-	if (client_ != nullptr) {
-		delete client_;
-		client_ = nullptr;
-	}
+	DetachObserver();
 	if (env_ != nullptr) {
-		delete env_;
-		env_ = nullptr;
+		env_->stop();
 	}
 	blog(LOG_INFO, "RTSP client stopped");
 }
 
+void RtspClient::DetachObserver() {
+	observer_.store(nullptr);
+	// at most one callback can be in-flight, it's the only wait on the caller thread
+	while (dispatching_.load() != 0) {
+		std::this_thread::yield();
+	}
+}
+
+RTSPClientObserver* RtspClient::AcquireObserver() {
+	dispatching_.fetch_add(1);
+	return observer_.load();
+}
+
+void RtspClient::ReleaseObserver() {
+	dispatching_.fetch_sub(1);
+}
+
 bool RtspClient::onNewSession(const char* id, const char* media, const char* codec,
 			      const char* sdp) {
 	blog(LOG_INFO, "New session created: id: %s, media: %s, codec: %s, sdp: %s", id, media,
@@ -86,9 +129,8 @@ bool RtspClient::onNewSession(const char* id, const char* media, const char* cod
 			if (strlen(sps_base64)) {
 				unsigned result_size = 0;
 				unsigned char* sps = base64Decode(sps_base64, result_size, true);
-
-				std::vector<uint8_t> sps_nalu_data(sps, sps + result_size);
-				auto sps_nalu = utils::h264::ParseSps(sps_nalu_data);
+				auto sps_nalu = utils::h264::ParseSps(sps, result_size);
+				delete[] sps;
 				if (sps_nalu.has_value()) {
 					width_ = sps_nalu->width;
 					height_ = sps_nalu->height;
@@ -102,9 +144,8 @@ bool RtspClient::onNewSession(const char* id, const char* media, const char* cod
 			if (strlen(sps_base64)) {
 				unsigned result_size = 0;
 				unsigned char* sps = base64Decode(sps_base64, result_size, true);
-
-				std::vector<uint8_t> sps_nalu_data(sps, sps + result_size);
-				auto sps_nalu = utils::h265::ParseSps(sps_nalu_data);
+				auto sps_nalu = utils::h265::ParseSps(sps, result_size);
+				delete[] sps;
 				if (sps_nalu.has_value()) {
 					width_ = sps_nalu->width;
 					height_ = sps_nalu->height;
@@ -114,7 +155,14 @@ bool RtspClient::onNewSession(const char* id, const char* media, const char* cod
 			}
 		}
 
-		return observer_->OnVideoSessionStarted(codec, width_, height_);
+		// the FEC track which follows protects this source
+		video_rtp_source_ = client_->getMediaSubSession()->rtpSource();
+
+		auto observer = AcquireObserver();
+		bool ret = observer != nullptr &&
+			   observer->OnVideoSessionStarted(codec, width_, height_);
+		ReleaseObserver();
+		return ret;
 	}
 	if (audio) {
 		// parse sdp to extract freq and channel
@@ -136,7 +184,21 @@ bool RtspClient::onNewSession(const char* id, const char* media, const char* cod
 			}
 		}
 
-		return observer_->OnAudioSessionStarted(codec, rate, channels);
+		auto observer = AcquireObserver();
+		bool ret = observer != nullptr &&
+			   observer->OnAudioSessionStarted(codec, rate, channels);
+		ReleaseObserver();
+		return ret;
+	}
+
+	if (FecReceiver::IsFecCodec(codec)) {
+		// the connection sets up the FEC track over unicast UDP only
+		RTPSource* fec_source = client_->getMediaSubSession()->rtpSource();
+		if (video_rtp_source_ == nullptr || fec_source == nullptr || fec_receiver_ != nullptr)
+			return false;
+		fec_receiver_ = new FecReceiver(*env_, video_rtp_source_, fec_source);
+		// the sink keeps the source reading its socket, `ProcessBuffer` drops the payloads
+		return true;
 	}
 
 	// any other session is not support
@@ -152,24 +214,39 @@ bool RtspClient::onData(const char* id, unsigned char* buffer, ssize_t size,
 
 void RtspClient::onError(RTSPConnection& connection, const char* message) {
 	blog(LOG_ERROR, "RTSP client error : %s", message);
-	observer_->OnError(message);
+	auto observer = AcquireObserver();
+	if (observer != nullptr)
+		observer->OnError(message);
+	ReleaseObserver();
 }
 
 void RtspClient::onConnectionTimeout(RTSPConnection& connection) {
 	blog(LOG_INFO, "RTSP client connect timeout");
-	observer_->OnSessionStopped("timeout");
+	auto observer = AcquireObserver();
+	if (observer != nullptr)
+		observer->OnSessionStopped("timeout");
+	ReleaseObserver();
 }
 
 void RtspClient::onDataTimeout(RTSPConnection& connection) {
 	blog(LOG_INFO, "RTSP client data timeout");
-	observer_->OnSessionStopped("timeout");
+	auto observer = AcquireObserver();
+	if (observer != nullptr)
+		observer->OnSessionStopped("timeout");
+	ReleaseObserver();
 }
 
 void RtspClient::ProcessBuffer(const char* id, unsigned char* buffer, ssize_t size,
 			       timeval presentationTime) {
 	std::string& media = media_ids_[id];
 	bool video = media == "video";
-	observer_->OnData(buffer, size, presentationTime, video);
+	// the FEC track
+	if (!video && media != "audio")
+		return;
+	auto observer = AcquireObserver();
+	if (observer != nullptr)
+		observer->OnData(buffer, size, presentationTime, video);
+	ReleaseObserver();
 
 	//std::vector<utils::h264::NaluIndex> indexes = utils::h264::FindNaluIndices(buffer, size);
 
@@ -213,4 +290,63 @@ void RtspClient::ProcessBuffer(const char* id, unsigned char* buffer, ssize_t si
 	//}
 }
 
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+ClientReaper& ClientReaper::Instance() {
+	static ClientReaper reaper;
+	return reaper;
+}
+
+ClientReaper::~ClientReaper() {
+	Shutdown();
+}
+
+void ClientReaper::Retire(RtspClient* client) {
+	if (client == nullptr) {
+		return;
+	}
+	client->Stop();
+
+	std::lock_guard<std::mutex> guard(mutex_);
+	if (exit_) { // the module is unloading, nobody is waiting on the UI anymore
+		delete client;
+		return;
+	}
+	if (!reaper_thread_.joinable()) {
+		reaper_thread_ = std::thread(&ClientReaper::ReaperThread, this);
+	}
+	clients_.push_back(client);
+	cv_.notify_one();
+}
+
+void ClientReaper::Shutdown() {
+	{
+		std::lock_guard<std::mutex> guard(mutex_);
+		exit_ = true;
+		cv_.notify_one();
+	}
+	if (reaper_thread_.joinable())
+		reaper_thread_.join();
+}
+
+void ClientReaper::ReaperThread() {
+	os_set_thread_name("rtsp_reaper_thread");
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+		cv_.wait(lock, [this] { return exit_ || !clients_.empty(); });
+		if (clients_.empty()) // exit_ is set and nothing left to release
+			break;
+
+		std::vector<RtspClient*> clients;
+		clients.swap(clients_);
+
+		lock.unlock();
+		for (auto client : clients) { delete client; }
+		lock.lock();
+	}
+}
+
 } // namespace source
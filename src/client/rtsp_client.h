@@ -2,6 +2,8 @@
 
 #include <obs-module.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <thread>
 #include <vector>
 #include <string>
@@ -12,6 +14,8 @@
 #include "rtspconnectionclient.h"
 
 namespace source {
+class FecReceiver;
+
 class RTSPClientObserver {
 public:
 	virtual ~RTSPClientObserver() = default;
@@ -28,11 +32,12 @@ public:
 	RtspClient(const std::string& uri, const std::map<std::string, std::string>& opts,
 		   RTSPClientObserver* observer);
 
+	// joins the capture thread, use `ClientReaper::Retire` to release it off the OBS threads
 	virtual ~RtspClient();
 
 	// start RTSP connection
 	void Start();
-	// stop RTSP connection
+	// stop RTSP connection without blocking, no observer callback is made after it returns
 	void Stop();
 	// check if the RTSP is running
 	bool IsRunning();
@@ -52,9 +57,15 @@ public:
 	virtual void onDataTimeout(RTSPConnection& connection) override;
 
 private:
-	RTSPClientObserver* observer_;
+	std::atomic<RTSPClientObserver*> observer_;
+	// number of observer callbacks running on the capture thread
+	std::atomic<int> dispatching_;
 	Environment* env_;
 	RTSPConnection* client_;
+	// the RTP source of the video & the receiver of its FEC track, on the capture thread
+	RTPSource* video_rtp_source_;
+	// recovers the lost video packets when the server sends FEC
+	FecReceiver* fec_receiver_;
 	std::string uri_;
 	std::map<std::string, std::string> opts_;
 	std::thread capture_thread_;
@@ -66,6 +77,34 @@ private:
 
 	void ProcessBuffer(const char* id, unsigned char* buffer, ssize_t size,
 			   struct timeval presentationTime);
+	// detach the observer and wait for the in-flight callback(if any)
+	void DetachObserver();
+	RTSPClientObserver* AcquireObserver();
+	void ReleaseObserver();
+};
+
+// Tears down stopped RTSP clients in the background, so the OBS UI thread
+// never waits for the capture thread or the TEARDOWN request.
+class ClientReaper {
+public:
+	static ClientReaper& Instance();
+
+	// stop the client and delete it on the reaper thread
+	void Retire(RtspClient* client);
+	// join all the retired clients, called when the module is unloaded
+	void Shutdown();
+
+private:
+	ClientReaper() = default;
+	~ClientReaper();
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::vector<RtspClient*> clients_;
+	std::thread reaper_thread_;
+	bool exit_ = false;
+
+	void ReaperThread();
 };
 
 } // namespace source
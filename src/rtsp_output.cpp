@@ -1,15 +1,31 @@
 #include "rtsp_output.h"
 
+#include <util/platform.h>
 #include <util/threading.h>
 
-#define MAX_CODECS 1
-const char* audio_codecs[MAX_CODECS] = {"aac"};
-const char* video_codecs[MAX_CODECS] = {"h264"};
+#include <chrono>
+
+// null terminated for `get_supported_*_codecs`
+const char* audio_codecs[] = {"aac", nullptr};
+const char* video_codecs[] = {"h264", "hevc", nullptr};
 
 RtspOutput::RtspOutput(obs_data_t* settings, obs_output_t* output)
   : output_(output),
     settings_(settings),
-    server_(nullptr) {
+    server_(nullptr),
+    on_demand_(false),
+    linger_ns_(0),
+    demand_changed_(false),
+    demand_exit_(false),
+    encoder_paused_(false),
+    demand_failed_(false),
+    resume_ns_(0),
+    resumes_(0),
+    rampup_ms_(0),
+    idle_ms_(0),
+    paused_ns_(0) {
+	proc_handler_t* handler = obs_output_get_proc_handler(output_);
+	proc_handler_add(handler, "void get_stats(out string json)", GetStatsProc, this);
 	Start();
 }
 
@@ -29,7 +45,36 @@ bool RtspOutput::Start() {
 		return false;
 
 	if (server_ == nullptr) {
-    server_ = new output::RtspServer();
+		bool multicast = obs_data_get_bool(settings_, "multicast");
+		unsigned threads = (unsigned)obs_data_get_int(settings_, "server_threads");
+		unsigned pacing = (unsigned)obs_data_get_int(settings_, "pacing");
+		// the outputs on the same port share the server, each one with its own path
+		const char* mount = obs_data_get_string(settings_, "mount");
+		server_ = new output::RtspServer(8554, multicast, threads, pacing,
+						 mount != nullptr ? mount : "");
+		if (obs_data_get_bool(settings_, "adaptive_bitrate")) {
+			// the receiver reports steer the encoder within the limits
+			const char* primary = obs_data_get_string(settings_, "primary_client");
+			server_->SetBitrateAdaptation(
+			  (unsigned)obs_data_get_int(settings_, "min_bitrate"),
+			  (unsigned)obs_data_get_int(settings_, "max_bitrate"),
+			  primary != nullptr ? primary : "");
+		}
+		unsigned retransmit_ms = (unsigned)obs_data_get_int(settings_, "retransmit_ms");
+		server_->SetRetransmission(retransmit_ms, obs_data_get_bool(settings_, "rtx"));
+		server_->SetFec((unsigned)obs_data_get_int(settings_, "fec_percent"));
+		server_->SetPlayCallback([this]() {
+			std::lock_guard<std::mutex> guard(demand_mutex_);
+			demand_changed_ = true;
+			demand_cv_.notify_one();
+		});
+	}
+	on_demand_ = obs_data_get_bool(settings_, "on_demand");
+	linger_ns_ = (uint64_t)obs_data_get_int(settings_, "linger") * 1000000000ULL;
+	if (on_demand_ && obs_data_get_bool(settings_, "multicast")) {
+		// nobody tells the server that a multicast receiver is listening
+		blog(LOG_WARNING, "rtsp output can't encode on demand for a multicast stream");
+		on_demand_ = false;
 	}
   if (running_.load()) {
     return false;
@@ -45,37 +90,153 @@ bool RtspOutput::Start() {
 
 bool RtspOutput::Stop(bool signal) {
 	std::lock_guard<std::mutex> guard(start_mutex_);
+	// the start thread may still be setting up the server & the demand thread
+	if (start_thread_.joinable()) {
+		start_thread_.join();
+	}
   if (server_ == nullptr)
     return false;
 
+	StopDemandThread();
+
 	obs_output_signal_stop(output_, OBS_OUTPUT_SUCCESS);
-	running_.store(false);
+	{
+		// the packet in flight on the encoder thread is done once the flag is cleared
+		// under the lock, `Data` returns right away after that
+		std::lock_guard<std::mutex> data_guard(data_mutex_);
+		running_.store(false);
+	}
 	
 	return server_->Stop();
 }
 
 void RtspOutput::Data(struct encoder_packet* packet) {
+	// `Stop` frees the fanouts & frame builders of the server, not while a packet uses them
+	std::lock_guard<std::mutex> guard(data_mutex_);
   if (!running_.load())
     return;
 
-	if (packet->type == OBS_ENCODER_VIDEO) {
-		if (server_ != nullptr) {
-			server_->Data(packet);
+	if (packet->type == OBS_ENCODER_VIDEO && packet->keyframe) {
+		// the ramp-up of the encoders after the first client pressed play, the viewers
+		// can't start before the keyframe
+		uint64_t resumed = resume_ns_.load(std::memory_order_relaxed);
+		if (resumed != 0 && resume_ns_.compare_exchange_strong(resumed, 0)) {
+			uint64_t rampup_ms = (os_gettime_ns() - resumed) / 1000000;
+			rampup_ms_.store(rampup_ms, std::memory_order_relaxed);
+			blog(LOG_INFO, "rtsp output got the first keyframe %llu ms after resuming",
+			     (unsigned long long)rampup_ms);
 		}
 	}
+
+	if (server_ != nullptr) {
+		server_->Data(packet);
+	}
+}
+
+int RtspOutput::GetDroppedFrames() {
+	std::lock_guard<std::mutex> guard(start_mutex_);
+	if (server_ == nullptr)
+		return 0;
+	return server_->GetDroppedFrames();
 }
 
 size_t RtspOutput::GetTotalBytes() {
-	return 0;
+	std::lock_guard<std::mutex> guard(start_mutex_);
+	if (server_ == nullptr)
+		return 0;
+	return server_->GetTotalBytes();
 }
 
 int RtspOutput::GetConnectTime() {
-	return 0;
+	std::lock_guard<std::mutex> guard(start_mutex_);
+	if (server_ == nullptr)
+		return 0;
+	return server_->GetConnectTime();
+}
+
+std::string RtspOutput::GetStatsJson() {
+	obs_data_t* stats = obs_data_create();
+	obs_data_array_t* clients = obs_data_array_create();
+	{
+		std::lock_guard<std::mutex> guard(start_mutex_);
+		if (server_ != nullptr) {
+			obs_data_set_string(stats, "mount", server_->Mount().c_str());
+			obs_data_set_int(stats, "total_bytes", (long long)server_->GetTotalBytes());
+			obs_data_set_int(stats, "total_packets", (long long)server_->GetTotalPackets());
+			obs_data_set_int(stats, "dropped_frames", server_->GetDroppedFrames());
+			obs_data_set_int(stats, "connect_time_ms", server_->GetConnectTime());
+			obs_data_set_int(stats, "playing_streams", server_->GetPlayingStreams());
+			obs_data_set_int(stats, "nacked_packets", (long long)server_->GetNackedPackets());
+			obs_data_set_int(stats, "retransmitted_packets",
+					 (long long)server_->GetRetransmittedPackets());
+			obs_data_set_double(stats, "retransmit_delay_ms", server_->GetRetransmitDelayMs());
+			obs_data_set_int(stats, "fec_packets", (long long)server_->GetFecPackets());
+			obs_data_set_int(stats, "bitrate_kbps", server_->GetTargetBitrate());
+			obs_data_set_int(stats, "bitrate_decreases",
+					 (long long)server_->GetBitrateDecreases());
+			obs_data_set_int(stats, "bitrate_increases",
+					 (long long)server_->GetBitrateIncreases());
+
+			bool paused = encoder_paused_.load();
+			uint64_t idle_ms = idle_ms_.load();
+			if (paused)
+				idle_ms += (os_gettime_ns() - paused_ns_.load()) / 1000000;
+			obs_data_set_bool(stats, "on_demand", on_demand_ && !demand_failed_.load());
+			obs_data_set_bool(stats, "encoder_paused", paused);
+			obs_data_set_int(stats, "encoder_resumes", (long long)resumes_.load());
+			obs_data_set_int(stats, "encoder_idle_ms", (long long)idle_ms);
+			obs_data_set_int(stats, "rampup_ms", (long long)rampup_ms_.load());
+			{
+				// up to the last start or stop of the encoders
+				std::lock_guard<std::mutex> demand_guard(demand_mutex_);
+				obs_data_set_double(stats, "encoding_cpu_percent", encoding_cpu_.Percent());
+				obs_data_set_double(stats, "idle_cpu_percent", idle_cpu_.Percent());
+			}
+
+			uint64_t now = os_gettime_ns();
+			for (auto& client : server_->GetClientStats()) {
+				obs_data_t* item = obs_data_create();
+				obs_data_set_string(item, "address", client.address.c_str());
+				obs_data_set_int(item, "session", client.session_id);
+				obs_data_set_string(item, "track", client.audio ? "audio" : "video");
+				obs_data_set_string(item, "transport", client.tcp ? "tcp" : "udp");
+				obs_data_set_int(item, "connected_ms",
+						 (long long)((now - client.connect_ns) / 1000000));
+				obs_data_set_int(item, "bytes", (long long)client.bytes);
+				obs_data_set_int(item, "packets", (long long)client.packets);
+				obs_data_set_int(item, "dropped_frames", (long long)client.dropped_frames);
+				obs_data_set_double(item, "loss", client.loss);
+				obs_data_set_int(item, "lost_packets", (long long)client.lost_packets);
+				obs_data_set_double(item, "jitter_ms", client.jitter_ms);
+				obs_data_set_double(item, "max_jitter_ms", client.max_jitter_ms);
+				obs_data_set_double(item, "rtt_ms", client.rtt_ms);
+				obs_data_set_int(item, "keyframe_packets",
+						 (long long)client.keyframe_packets);
+				obs_data_set_int(item, "lost_keyframe_packets",
+						 (long long)client.lost_keyframe_packets);
+				obs_data_array_push_back(clients, item);
+				obs_data_release(item);
+			}
+		}
+	}
+	obs_data_set_array(stats, "clients", clients);
+	obs_data_array_release(clients);
+
+	std::string json = obs_data_get_json(stats);
+	obs_data_release(stats);
+	return json;
+}
+
+void RtspOutput::GetStatsProc(void* data, calldata_t* cd) {
+	std::string json = static_cast<RtspOutput*>(data)->GetStatsJson();
+	calldata_set_string(cd, "json", json.c_str());
 }
 
 void RtspOutput::StartThread() {
 	os_set_thread_name("rtsp_output_thread");
 
+  server_->SetVideoEncoder(obs_output_get_video_encoder(output_));
+  server_->SetAudioEncoder(obs_output_get_audio_encoder(output_, 0));
   if (!server_->Start()) {
     delete server_;
     server_ = nullptr;
@@ -84,13 +245,116 @@ void RtspOutput::StartThread() {
 
   obs_output_begin_data_capture(output_, 0);
   running_.store(true);
+
+	if (on_demand_) {
+		demand_exit_ = false;
+		demand_failed_.store(false);
+		demand_thread_ = std::thread(&RtspOutput::DemandThread, this);
+	}
+}
+
+void RtspOutput::DemandThread() {
+	os_set_thread_name("rtsp_demand_thread");
+
+	// the encoders run for the linger time after the start too, the first GOP is cached
+	// for the first client
+	uint64_t idle_since = os_gettime_ns();
+	// the process CPU since the last change, put down to encoding or idling. Under
+	// `demand_mutex_`
+	os_cpu_usage_info_t* cpu_info = os_cpu_usage_info_start();
+	uint64_t cpu_since = idle_since;
+	auto account_cpu = [&](uint64_t now) {
+		double seconds = (now - cpu_since) / 1e9;
+		double percent = os_cpu_usage_info_query(cpu_info);
+		cpu_since = now;
+		CpuUsage& usage = encoder_paused_.load() ? idle_cpu_ : encoding_cpu_;
+		usage.percent_seconds += percent * seconds;
+		usage.seconds += seconds;
+	};
+
+	// the pause & the resume happen under the lock, `Stop` can't come in between: it
+	// sets `demand_exit_` under the lock and joins the thread before the output stops
+	std::unique_lock<std::mutex> lock(demand_mutex_);
+	while (!demand_exit_) {
+		demand_changed_ = false;
+		bool playing = server_->GetPlayingStreams() > 0;
+		uint64_t now = os_gettime_ns();
+		if (playing) {
+			idle_since = 0;
+			if (encoder_paused_.load()) {
+				account_cpu(now);
+				resume_ns_.store(now);
+				obs_output_pause(output_, false);
+				encoder_paused_.store(false);
+				uint64_t idle_ms = (now - paused_ns_.load()) / 1000000;
+				idle_ms_.fetch_add(idle_ms);
+				resumes_.fetch_add(1);
+				blog(LOG_INFO, "rtsp output resumed the encoders after %.1f s idle",
+				     idle_ms / 1000.0);
+			}
+		} else if (!encoder_paused_.load()) {
+			if (idle_since == 0)
+				idle_since = now;
+			if (now - idle_since >= linger_ns_) {
+				// the data capture & the output stay active, the encoders skip the frames
+				account_cpu(now);
+				if (!obs_output_pause(output_, true)) {
+					// shared encoders or no pause support, better encoding all the time
+					// than a stream the frontend doesn't know is stopped
+					blog(LOG_ERROR, "rtsp output can't pause the encoders, they may be "
+							"shared with another output. Encoding on demand is "
+							"off until the output restarts");
+					demand_failed_.store(true);
+					break;
+				}
+				// a pause keeps the GOP of the encoders going, the new viewers wait for
+				// its next keyframe instead of the stale one
+				server_->DropCachedGops();
+				paused_ns_.store(now);
+				encoder_paused_.store(true);
+				blog(LOG_INFO, "rtsp output paused the encoders, no clients for %.1f s",
+				     (now - idle_since) / 1000000000.0);
+			}
+		}
+
+		if (demand_exit_ || demand_changed_)
+			continue;
+		if (!playing && !encoder_paused_.load()) {
+			uint64_t linger_left = idle_since + linger_ns_ - now;
+			demand_cv_.wait_for(lock, std::chrono::nanoseconds(linger_left),
+					    [this] { return demand_exit_ || demand_changed_; });
+		} else {
+			demand_cv_.wait(lock, [this] { return demand_exit_ || demand_changed_; });
+		}
+	}
+	account_cpu(os_gettime_ns());
+	lock.unlock();
+	os_cpu_usage_info_destroy(cpu_info);
+}
+
+void RtspOutput::StopDemandThread() {
+	{
+		std::lock_guard<std::mutex> guard(demand_mutex_);
+		demand_exit_ = true;
+		demand_cv_.notify_one();
+	}
+	if (demand_thread_.joinable()) {
+		demand_thread_.join();
+	}
+	// the output stops running, the next `Start` begins unpaused
+	if (encoder_paused_.load()) {
+		obs_output_pause(output_, false);
+		encoder_paused_.store(false);
+		idle_ms_.fetch_add((os_gettime_ns() - paused_ns_.load()) / 1000000);
+	}
+	resume_ns_.store(0);
 }
 
 void register_rtsp_output() {
 	struct obs_output_info info = {};
 
 	info.id = "rtsp_output";
-	info.flags = OBS_OUTPUT_VIDEO | OBS_OUTPUT_ENCODED | OBS_OUTPUT_SERVICE;
+	info.flags = OBS_OUTPUT_AV | OBS_OUTPUT_ENCODED | OBS_OUTPUT_SERVICE | OBS_OUTPUT_CAN_PAUSE;
 	info.get_name = [](void*) -> const char* {
 		return "RTSP Output";
 	};
@@ -109,18 +373,62 @@ void register_rtsp_output() {
 	info.encoded_packet = [](void* priv_data, struct encoder_packet* packet) {
 		static_cast<RtspOutput*>(priv_data)->Data(packet);
 	};
-	info.get_defaults = [](obs_data_t*) {
+	info.get_defaults = [](obs_data_t* settings) {
+		obs_data_set_default_bool(settings, "multicast", false);
+		obs_data_set_default_int(settings, "server_threads", 0);
+		obs_data_set_default_int(settings, "pacing", 0);
+		obs_data_set_default_string(settings, "mount", "obs_live");
+		obs_data_set_default_bool(settings, "on_demand", false);
+		obs_data_set_default_int(settings, "linger", 10);
+		obs_data_set_default_int(settings, "retransmit_ms", 0);
+		obs_data_set_default_bool(settings, "rtx", false);
+		obs_data_set_default_int(settings, "fec_percent", 0);
+		obs_data_set_default_bool(settings, "adaptive_bitrate", false);
+		obs_data_set_default_int(settings, "min_bitrate", 500);
+		obs_data_set_default_int(settings, "max_bitrate", 0);
+		obs_data_set_default_string(settings, "primary_client", "");
 	};
 	info.get_properties = [](void*) -> obs_properties_t* {
-		return obs_properties_create();
+		obs_properties_t* props = obs_properties_create();
+		obs_properties_add_text(props, "mount", "Stream path, unique per port",
+					OBS_TEXT_DEFAULT);
+		obs_properties_add_bool(props, "multicast", "Stream to a multicast group");
+		obs_properties_add_int(props, "server_threads",
+				       "Server threads for the unicast clients(0 = auto)", 0, 16, 1);
+		obs_properties_add_int_slider(props, "pacing",
+					      "Spread each frame over % of the frame interval(0 = off)",
+					      0, 100, 5);
+		obs_properties_add_bool(props, "on_demand",
+					"Encode only while clients are playing(unshared encoders)");
+		obs_properties_add_int(props, "linger",
+				       "Keep encoding after the last client left, seconds", 0, 600, 1);
+		obs_properties_add_int(props, "retransmit_ms",
+				       "Resend the NACKed packets of the last ms(0 = off)", 0, 2000, 50);
+		obs_properties_add_bool(props, "rtx", "Resend them as a RTX stream(RFC 4588)");
+		obs_properties_add_int_slider(props, "fec_percent",
+					      "FEC packets per 100 video packets(0 = off)", 0, 100, 5);
+		obs_properties_add_bool(props, "adaptive_bitrate",
+					"Adapt the video bitrate to the receiver reports");
+		obs_properties_add_int(props, "min_bitrate", "Lowest video bitrate, kbps", 100,
+				       100000, 50);
+		obs_properties_add_int(props, "max_bitrate",
+				       "Highest video bitrate, kbps(0 = the encoder's)", 0, 100000,
+				       50);
+		obs_properties_add_text(props, "primary_client",
+					"Client address steering the bitrate(empty = worst of all)",
+					OBS_TEXT_DEFAULT);
+		return props;
 	};
 	info.get_total_bytes = [](void* priv_data) -> uint64_t {
 		return (uint64_t) static_cast<RtspOutput*>(priv_data)->GetTotalBytes();
 	};
+	info.get_dropped_frames = [](void* priv_data) -> int {
+		return static_cast<RtspOutput*>(priv_data)->GetDroppedFrames();
+	};
 	info.get_connect_time_ms = [](void* priv_data) -> int {
 		return static_cast<RtspOutput*>(priv_data)->GetConnectTime();
 	};
-	info.encoded_video_codecs = "h264";
+	info.encoded_video_codecs = "h264;hevc";
 	info.encoded_audio_codecs = "aac";
 	info.protocols = "RTSP";
 
@@ -129,7 +437,9 @@ void register_rtsp_output() {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-RtspService::RtspService(obs_data_t* settings, obs_service_t* service) {
+RtspService::RtspService(obs_data_t* settings, obs_service_t* service)
+  : port_(0),
+    intra_refresh_(false) {
 	Update(settings);
 }
 
@@ -137,6 +447,7 @@ void RtspService::Update(obs_data_t* settings) {
 	username_ = obs_data_get_string(settings, "username");
 	credential_ = obs_data_get_string(settings, "credential");
 	port_ = (uint16_t)obs_data_get_int(settings, "port");
+	intra_refresh_ = obs_data_get_bool(settings, "intra_refresh");
 }
 
 obs_properties_t* RtspService::Properties() {
@@ -146,6 +457,8 @@ obs_properties_t* RtspService::Properties() {
 				OBS_TEXT_DEFAULT);
 	obs_properties_add_text(ppts, "credential", "password to connect the RTSP server",
 				OBS_TEXT_PASSWORD);
+	obs_properties_add_bool(ppts, "intra_refresh",
+				"Low latency: periodic intra refresh instead of keyframes(x264)");
 
 	return ppts;
 }
@@ -157,6 +470,22 @@ void RtspService::ApplyEncoderSettings(obs_data_t* video_settings, obs_data_t*)
 		obs_data_set_string(video_settings, "rate_control", "CBR");
 		obs_data_set_bool(video_settings, "repeat_headers", true);
 	}
+	if (video_settings && intra_refresh_) {
+		// the refresh runs over the keyframe interval, x264 marks its start with a
+		// recovery point SEI, which the server takes for a keyframe. The other OBS
+		// encoders don't expose intra refresh and keep their IDRs
+		std::string opts = obs_data_get_string(video_settings, "x264opts");
+		if (opts.find("intra-refresh") == std::string::npos) {
+			if (!opts.empty())
+				opts += " ";
+			opts += "intra-refresh=1";
+			obs_data_set_string(video_settings, "x264opts", opts.c_str());
+		}
+		// no lookahead & no frame threads, a frame leaves the encoder right away
+		std::string tune = obs_data_get_string(video_settings, "tune");
+		if (tune.empty())
+			obs_data_set_string(video_settings, "tune", "zerolatency");
+	}
 }
 
 const char* RtspService::GetConnectInfo(enum obs_service_connect_info type) {
@@ -199,9 +528,10 @@ void register_rtsp_service() {
 	info.get_output_type = [](void*) -> const char* {
 		return "rtsp_output";
 	};
-	info.apply_encoder_settings = [](void*, obs_data_t* video_settings,
+	info.apply_encoder_settings = [](void* priv_data, obs_data_t* video_settings,
 					 obs_data_t* audio_settings) {
-		RtspService::ApplyEncoderSettings(video_settings, audio_settings);
+		static_cast<RtspService*>(priv_data)->ApplyEncoderSettings(video_settings,
+									    audio_settings);
 	};
 	info.get_supported_video_codecs = [](void*) -> const char** {
 		return video_codecs;
@@ -5,6 +5,7 @@
 
 #include <string>
 #include <atomic>
+#include <condition_variable>
 #include <thread>
 #include <mutex>
 
@@ -18,9 +19,13 @@ public:
 	bool Stop(bool signal = true);
 	void Data(struct encoder_packet* packet);
 	size_t GetTotalBytes();
+	int GetDroppedFrames();
 	int GetConnectTime();
 	// obs output related functions end
 
+	// the totals & every client of the server as JSON, for the "get_stats" proc
+	std::string GetStatsJson();
+
 private:
 	obs_output_t* output_;
 	obs_data_t* settings_;
@@ -28,10 +33,44 @@ private:
 	output::RtspServer* server_;
 
   std::atomic<bool> running_;
+	// held by `Data` for every packet, `Stop` waits on it for the packet in flight
+	std::mutex data_mutex_;
   std::mutex start_mutex_;
   std::thread start_thread_;
 
+	// the process CPU in percent of all the cores, over the time the encoders ran or idled
+	struct CpuUsage {
+		double percent_seconds = 0.0;
+		double seconds = 0.0;
+		double Percent() const { return seconds > 0.0 ? percent_seconds / seconds : 0.0; }
+	};
+
+	// on demand, the encoders are paused while no client plays the stream
+	bool on_demand_;
+	uint64_t linger_ns_;
+	std::thread demand_thread_;
+	std::mutex demand_mutex_;
+	std::condition_variable demand_cv_;
+	bool demand_changed_;
+	bool demand_exit_;
+	std::atomic<bool> encoder_paused_;
+	// libobs refused the pause, the encoders run all the time
+	std::atomic<bool> demand_failed_;
+	// when the encoders were restarted, 0 once the first keyframe came in
+	std::atomic<uint64_t> resume_ns_;
+	std::atomic<uint64_t> resumes_;
+	std::atomic<uint64_t> rampup_ms_;
+	// the time the encoders were paused for, up to the last resume
+	std::atomic<uint64_t> idle_ms_;
+	std::atomic<uint64_t> paused_ns_;
+	// under `demand_mutex_`
+	CpuUsage encoding_cpu_;
+	CpuUsage idle_cpu_;
+
   void StartThread();
+	void DemandThread();
+	void StopDemandThread();
+	static void GetStatsProc(void* data, calldata_t* cd);
 };
 
 void register_rtsp_output();
@@ -45,7 +84,7 @@ public:
 	void Update(obs_data_t* settings);
 
 	static obs_properties_t* Properties();
-	static void ApplyEncoderSettings(obs_data_t* video_settings, obs_data_t* audio_settings);
+	void ApplyEncoderSettings(obs_data_t* video_settings, obs_data_t* audio_settings);
 	bool CanTryToConnect();
 	const char* GetConnectInfo(enum obs_service_connect_info type);
 	// obs service related functions end
@@ -54,6 +93,8 @@ private:
 	std::string username_;
 	std::string credential_;
 	uint16_t port_;
+	// periodic intra refresh instead of IDRs, the server joins at the recovery points
+	bool intra_refresh_;
 };
 
 void register_rtsp_service();
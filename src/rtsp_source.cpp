@@ -105,6 +105,8 @@ static inline video_range_type convert_color_range(AVColorRange r) {
 Decoder::Decoder(bool video, bool require_hw, const std::string& codec_name)
   : video_(video),
     codec_name_(codec_name),
+    rate_(0),
+    channels_(0),
     codec_ctx_(nullptr),
     codec_(nullptr),
     in_frame_(nullptr),
@@ -163,6 +165,8 @@ bool Decoder::Init(int rate, int channels) {
 
 	// audio configures
 	if (!video_) {
+		rate_ = rate;
+		channels_ = channels;
 		codec_ctx_->channels = channels;
 		codec_ctx_->sample_rate = rate;
 	}
@@ -411,13 +415,45 @@ void Decoder::InitHardwareDecoder(const AVCodec* codec) {
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+void DecoderEpoch::EnterReadSection() {
+	reader_epoch_.store(epoch_.load());
+}
+
+void DecoderEpoch::LeaveReadSection() {
+	reader_epoch_.store(0);
+}
+
+void DecoderEpoch::Synchronize() {
+	// a read section entered with the new epoch can only see the new decoder
+	uint64_t target = epoch_.fetch_add(1) + 1;
+	while (true) {
+		uint64_t reader = reader_epoch_.load();
+		if (reader == 0 || reader >= target)
+			break;
+		std::this_thread::yield();
+	}
+}
+
+void DecoderSlot::Reset(Decoder* decoder) {
+	Decoder* old = decoder_.exchange(decoder);
+	if (old == nullptr)
+		return;
+
+	epoch_.Synchronize();
+	delete old;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 RtspSource::RtspSource(obs_data_t* settings, obs_source_t* source)
   : settings_(settings),
     source_(source),
     rtsp_url_(""),
     client_(nullptr),
-    video_decoder_(nullptr),
-    audio_decoder_(nullptr),
+    video_decoder_(decoder_epoch_),
+    audio_decoder_(decoder_epoch_),
     fmt_ctx_(nullptr),
     hw_decode_(false),
     video_disabled_(false),
@@ -434,7 +470,7 @@ RtspSource::RtspSource(obs_data_t* settings, obs_source_t* source)
 
 RtspSource::~RtspSource() {
 	if (client_ != nullptr) {
-		delete client_;
+		source::ClientReaper::Instance().Retire(client_);
 		client_ = nullptr;
 	}
 
@@ -453,8 +489,6 @@ void RtspSource::Update(obs_data_t* settings) {
 
 	if (url != rtsp_url_) // url changed
 		need_restart = true;
-	if (hw_decode != hw_decode_) // hw decode changed
-		need_restart = true;
 	if (disable_audio != audio_disabled_) // audio disabled changed
 		need_restart = true;
 	if (disable_video != video_disabled_) // video disabled changed
@@ -462,8 +496,12 @@ void RtspSource::Update(obs_data_t* settings) {
   if (force_tcp_ != force_tcp) // force tcp changed
     need_restart = true;
 
-	if (need_restart)
+	if (need_restart) {
 		PrepareToPlay();
+	} else if (hw_decode != hw_decode_) { // hw decode changed, no need to reconnect
+		hw_decode_ = hw_decode;
+		ReloadDecoders();
+	}
 }
 
 void RtspSource::GetDefaults(obs_data_t* settings) {
@@ -509,8 +547,9 @@ enum obs_media_state RtspSource::GetState() {
 void RtspSource::Stop() {
 	media_state_ = OBS_MEDIA_STATE_STOPPED;
 
-	if (client_) { // delete the rtsp client(will stop receive RTSP stream)
-		delete client_;
+	if (client_) { // retire the rtsp client(will stop receive RTSP stream)
+		// the teardown runs on the reaper thread, no callback is made after this
+		source::ClientReaper::Instance().Retire(client_);
 		client_ = nullptr;
 	}
 
@@ -591,13 +630,19 @@ bool RtspSource::OnVideoSessionStarted(const char* codec, int width, int height)
 	// init decoders
 	auto codec_name = utils::string::ToLower(codec);
 	bool hw_decode = obs_data_get_bool(settings_, "hw_decode");
-	if (video_decoder_ == nullptr) {
-		video_decoder_ = new Decoder(true, hw_decode, codec_name);
+	auto decoder = new Decoder(true, hw_decode, codec_name);
+	if (!decoder->Init()) {
+		delete decoder;
+		return false;
+	}
+	{
+		std::lock_guard<std::mutex> guard(decoder_mutex_);
+		video_decoder_.Reset(decoder);
 	}
 
 	media_state_ = OBS_MEDIA_STATE_PLAYING;
 
-	return video_decoder_->Init();
+	return true;
 }
 
 bool RtspSource::OnAudioSessionStarted(const char* codec, int rate, int channels) {
@@ -615,13 +660,19 @@ bool RtspSource::OnAudioSessionStarted(const char* codec, int rate, int channels
 	// init decoders
 	auto codec_name = utils::string::ToLower(codec);
 	bool hw_decode = obs_data_get_bool(settings_, "hw_decode");
-	if (audio_decoder_ == nullptr) {
-		audio_decoder_ = new Decoder(false, hw_decode, codec_name);
+	auto decoder = new Decoder(false, hw_decode, codec_name);
+	if (!decoder->Init(rate, channels)) {
+		delete decoder;
+		return false;
+	}
+	{
+		std::lock_guard<std::mutex> guard(decoder_mutex_);
+		audio_decoder_.Reset(decoder);
 	}
 
 	media_state_ = OBS_MEDIA_STATE_PLAYING;
 
-	return audio_decoder_->Init(rate, channels);
+	return true;
 }
 
 void RtspSource::OnSessionStopped(const char* msg) {
@@ -635,18 +686,22 @@ void RtspSource::OnError(const char* msg) {
 }
 
 void RtspSource::OnData(unsigned char* buffer, ssize_t size, timeval time, bool video) {
+	decoder_epoch_.EnterReadSection();
 	if (video) {
-		if (video_decoder_->Decode(buffer, size, time, &obs_frame_, nullptr)) {
+		auto decoder = video_decoder_.Load();
+		if (decoder != nullptr && decoder->Decode(buffer, size, time, &obs_frame_, nullptr)) {
 			// send to obs
 			obs_source_output_video(source_, &obs_frame_);
 		}
 	} else {
 		struct obs_source_audio audio = {0};
-		if (audio_decoder_->Decode(buffer, size, time, nullptr, &audio)) {
+		auto decoder = audio_decoder_.Load();
+		if (decoder != nullptr && decoder->Decode(buffer, size, time, nullptr, &audio)) {
 			// send to obs
 			obs_source_output_audio(source_, &audio);
 		}
 	}
+	decoder_epoch_.LeaveReadSection();
 }
 
 void RtspSource::DestoryFFmpeg() {
@@ -655,14 +710,32 @@ void RtspSource::DestoryFFmpeg() {
 		fmt_ctx_ = nullptr;
 	}
 
-	if (video_decoder_ != nullptr) {
-		delete video_decoder_;
-		video_decoder_ = nullptr;
-	}
-	if (audio_decoder_ != nullptr) {
-		delete audio_decoder_;
-		audio_decoder_ = nullptr;
+	std::lock_guard<std::mutex> guard(decoder_mutex_);
+	video_decoder_.Reset(nullptr);
+	audio_decoder_.Reset(nullptr);
+}
+
+void RtspSource::ReloadDecoders() {
+	std::lock_guard<std::mutex> guard(decoder_mutex_);
+
+	// the slots are only written under `decoder_mutex_`, so the current decoders stay alive
+	for (DecoderSlot* slot : {&video_decoder_, &audio_decoder_}) {
+		Decoder* current = slot->Load();
+		if (current == nullptr)
+			continue;
+
+		auto decoder = new Decoder(current->IsVideo(), hw_decode_, current->CodecName());
+		bool ret = current->IsVideo() ? decoder->Init()
+					      : decoder->Init(current->Rate(), current->Channels());
+		if (!ret) {
+			blog(LOG_ERROR, "Reload %s decoder failed, keep the current one",
+			     current->IsVideo() ? "video" : "audio");
+			delete decoder;
+			continue;
+		}
+		slot->Reset(decoder);
 	}
+	blog(LOG_INFO, "RTSP source decoders reloaded, hw decode: %d", hw_decode_);
 }
 
 bool RtspSource::InitFFmpeg() {
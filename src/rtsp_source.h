@@ -1,6 +1,8 @@
 #pragma once
 
 #include "src/client/rtsp_client.h"
+#include <atomic>
+#include <mutex>
 #include <string>
 
 extern "C" {
@@ -29,6 +31,10 @@ public:
 
 	bool Avaiable() const { return codec_ctx_ != nullptr; }
 	bool HardwareDecoderAvailable() const { return hw_decoder_available_; }
+	bool IsVideo() const { return video_; }
+	const std::string& CodecName() const { return codec_name_; }
+	int Rate() const { return rate_; }
+	int Channels() const { return channels_; }
 
 	bool Init(int rate = 36000, int channels = 2);
 	void Destory();
@@ -39,6 +45,8 @@ public:
 private:
 	bool video_; // audio or video
 	std::string codec_name_;
+	int rate_;     // audio only
+	int channels_; // audio only
 	AVCodecContext* codec_ctx_;
 	const AVCodec* codec_;
 	AVFrame* in_frame_;
@@ -63,6 +71,42 @@ private:
 	bool DecodePacket(unsigned char* buffer, ssize_t size);
 };
 
+// Epoch based reclamation for the decoders. The only reader is the capture thread, it marks
+// every packet it decodes as a read section; a writer waits for the read sections which
+// started before its swap, then the replaced decoder can be freed.
+class DecoderEpoch {
+public:
+	void EnterReadSection();
+	void LeaveReadSection();
+	// wait until the capture thread has passed a quiescent point
+	void Synchronize();
+
+private:
+	std::atomic<uint64_t> epoch_{1};
+	// the epoch observed by the capture thread in a read section, 0 when it's quiescent
+	std::atomic<uint64_t> reader_epoch_{0};
+};
+
+// A decoder pointer published to the capture thread, read with one atomic load.
+class DecoderSlot {
+public:
+	explicit DecoderSlot(DecoderEpoch& epoch) : epoch_(epoch) {}
+	~DecoderSlot() { Reset(nullptr); }
+	DecoderSlot(const DecoderSlot&) = delete;
+
+	// the capture thread must only use the decoder inside a read section. seq_cst, the
+	// store of `EnterReadSection` must not move after this load(StoreLoad), or `Reset`
+	// could miss the read section and free the decoder which was just loaded
+	Decoder* Load() const { return decoder_.load(std::memory_order_seq_cst); }
+	// swap in a new decoder(or nullptr) and delete the old one after a grace period,
+	// must not be called inside a read section
+	void Reset(Decoder* decoder);
+
+private:
+	DecoderEpoch& epoch_;
+	std::atomic<Decoder*> decoder_{nullptr};
+};
+
 class RtspSource : public source::RTSPClientObserver {
 public:
 	RtspSource(obs_data_t* settings, obs_source_t* source);
@@ -97,9 +141,11 @@ private:
 	std::string rtsp_url_;
 	source::RtspClient* client_;
 
-	// decoders
-	Decoder* video_decoder_;
-	Decoder* audio_decoder_;
+	// decoders, swapped by the OBS threads while the capture thread is decoding
+	DecoderEpoch decoder_epoch_;
+	DecoderSlot video_decoder_;
+	DecoderSlot audio_decoder_;
+	std::mutex decoder_mutex_; // serializes the writers of the slots
 	AVFormatContext* fmt_ctx_;
 	bool hw_decode_;
 
@@ -115,6 +161,8 @@ private:
 	bool InitFFmpeg();
 	void DestoryFFmpeg();
 	bool PrepareToPlay();
+	// recreate the running decoders with the current settings, the stream keeps flowing
+	void ReloadDecoders();
 };
 
 void register_rtsp_source();
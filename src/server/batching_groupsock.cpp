@@ -0,0 +1,416 @@
+#include "batching_groupsock.h"
+#include "fec_encoder.h"
+#include "pacer.h"
+#include "retransmission_cache.h"
+
+#include "GroupsockHelper.hh"
+
+#include <obs.h>
+#include <util/platform.h>
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __linux__
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#endif
+
+namespace output {
+// an IDR is sent in a few batches, the same limit as the segments of a GSO datagram
+static const size_t kMaxPackets = 64;
+// a paced IDR waits in the queue, past this it's sent right away
+static const size_t kMaxQueuedPackets = 2048;
+// fits the largest packet of the RTP sinks and the RTCP reports
+static const unsigned kSlotSize = 2048;
+// a GSO datagram can't exceed the UDP length
+static const unsigned kMaxGsoBytes = 65000;
+// a frame without a marker bit or a lone RTCP packet waits at most this long
+static const int64_t kFlushDelay = 1000; // 1 ms
+// a packet which got lost twice isn't worth a third try
+static const unsigned kMaxResends = 2;
+static const unsigned kRtpHeaderSize = 12;
+
+std::atomic<bool> BatchingGroupsock::gso_supported_{true};
+
+// the fixed header, the CSRCs & the header extension, more than `size` if it's malformed
+static unsigned RtpHeaderSize(const unsigned char* packet, unsigned size) {
+	unsigned header_size = kRtpHeaderSize + 4 * (packet[0] & 0x0F);
+	if ((packet[0] & 0x10) != 0 && header_size + 4 <= size)
+		header_size += 4 + 4 * ((unsigned)packet[header_size + 2] << 8 |
+					packet[header_size + 3]);
+	return header_size;
+}
+
+// the RTP packet carries an IDR/IRAP picture or the parameter sets before it: as a
+// single NAL unit, the first NAL unit of an aggregation packet or a fragment
+static bool IsKeyframePacket(const unsigned char* packet, unsigned size, bool hevc) {
+	if (size < kRtpHeaderSize)
+		return false;
+	unsigned offset = RtpHeaderSize(packet, size);
+	if (offset + 3 > size)
+		return false;
+	const unsigned char* payload = packet + offset;
+	if (hevc) {
+		unsigned type = (payload[0] >> 1) & 0x3F;
+		if (type == 48 && offset + 5 <= size) // AP, 2 bytes NAL header & 2 bytes size
+			type = (payload[4] >> 1) & 0x3F;
+		else if (type == 49) // FU
+			type = payload[2] & 0x3F;
+		return (type >= 16 && type <= 21) || (type >= 32 && type <= 34);
+	}
+	unsigned type = payload[0] & 0x1F;
+	if (type == 24 && offset + 4 <= size) // STAP-A, 2 bytes size
+		type = payload[3] & 0x1F;
+	else if (type == 28 || type == 29) // FU-A & FU-B
+		type = payload[1] & 0x1F;
+	return type == 5 || type == 7 || type == 8;
+}
+
+BatchingGroupsock::BatchingGroupsock(UsageEnvironment& env,
+				     struct sockaddr_storage const& group_address, Port port,
+				     u_int8_t ttl)
+  : Groupsock(env, group_address, port, ttl),
+    slots_(kMaxPackets * kSlotSize),
+    sent_(0),
+    send_task_(nullptr),
+    packet_count_(0),
+    syscall_count_(0),
+    feedback_peer_(nullptr),
+    cache_(nullptr),
+    stats_(nullptr),
+    rtx_payload_type_(0),
+    rtx_ssrc_(0),
+    rtx_seq_(0),
+    hevc_(false),
+    keyframe_packets_(0),
+    lost_keyframe_packets_(0),
+    fec_(nullptr),
+    fec_target_(nullptr),
+    fec_stats_(nullptr) {
+	packets_.reserve(kMaxPackets);
+}
+
+BatchingGroupsock::~BatchingGroupsock() {
+	Flush();
+	if (feedback_peer_ != nullptr)
+		feedback_peer_->feedback_peer_ = nullptr;
+	delete cache_;
+	delete fec_;
+	if (syscall_count_ > 0)
+		blog(LOG_DEBUG, "rtsp server sent %llu packets in %llu syscalls",
+		     (unsigned long long)packet_count_, (unsigned long long)syscall_count_);
+}
+
+void BatchingGroupsock::SetPacing(unsigned bitrate, uint64_t spread_ns) {
+	Flush();
+	pacer_.Configure(bitrate, spread_ns, kSlotSize, os_gettime_ns());
+}
+
+void BatchingGroupsock::EnableRetransmission(uint64_t history_ns, unsigned bitrate,
+					     unsigned char rtx_payload_type, bool hevc,
+					     ServerStats& stats) {
+	delete cache_;
+	cache_ = new RetransmissionCache(history_ns, bitrate);
+	stats_ = &stats;
+	rtx_payload_type_ = rtx_payload_type;
+	hevc_ = hevc;
+	// the RTX stream has its own SSRC & sequence numbers
+	rtx_ssrc_ = our_random32();
+	rtx_seq_ = (uint16_t)our_random32();
+	rtx_buffer_.resize(kSlotSize + 2);
+}
+
+void BatchingGroupsock::SetFecTarget(BatchingGroupsock* fec, unsigned overhead_percent,
+				     unsigned char payload_type, u_int32_t ssrc, uint16_t seq,
+				     ServerStats& stats) {
+	delete fec_;
+	fec_ = fec != nullptr ? new FecEncoder(overhead_percent, payload_type, ssrc, seq) : nullptr;
+	fec_target_ = fec;
+	fec_stats_ = &stats;
+}
+
+void BatchingGroupsock::SetFeedbackTarget(BatchingGroupsock* rtp) {
+	if (feedback_peer_ != nullptr)
+		feedback_peer_->feedback_peer_ = nullptr;
+	feedback_peer_ = rtp;
+	if (rtp != nullptr)
+		rtp->feedback_peer_ = this;
+}
+
+Boolean BatchingGroupsock::handleRead(unsigned char* buffer, unsigned buffer_max_size,
+				      unsigned& bytes_read,
+				      struct sockaddr_storage& from_address_and_port) {
+	Boolean result =
+	  Groupsock::handleRead(buffer, buffer_max_size, bytes_read, from_address_and_port);
+	// the RTCP instance still gets the whole packet for the receiver reports
+	if (result && bytes_read > 0 && feedback_peer_ != nullptr &&
+	    feedback_peer_->cache_ != nullptr)
+		feedback_peer_->OnFeedback(buffer, bytes_read);
+	return result;
+}
+
+void BatchingGroupsock::OnFeedback(const unsigned char* packet, unsigned size) {
+	RetransmissionCache::ParseNacks(packet, size, nacks_);
+	for (auto& nack : nacks_) { Retransmit(nack.ssrc, nack.seq); }
+}
+
+void BatchingGroupsock::Retransmit(u_int32_t ssrc, uint16_t seq) {
+	stats_->nacked_packets.fetch_add(1, std::memory_order_relaxed);
+	uint64_t now = os_gettime_ns();
+	RetransmissionCache::Entry* entry = cache_->Find(ssrc, seq, now);
+	if (entry == nullptr)
+		return;
+	// the receiver asks again for a packet whose resend got lost as well
+	if (!entry->nacked && entry->keyframe)
+		++lost_keyframe_packets_;
+	entry->nacked = true;
+	if (entry->resends >= kMaxResends)
+		return;
+	++entry->resends;
+
+	unsigned char* data = entry->data.data();
+	unsigned size = (unsigned)entry->data.size();
+	if (rtx_payload_type_ != 0) {
+		// the original header with the RTX payload type, sequence number & SSRC, then the
+		// original sequence number and the payload
+		unsigned header_size = RtpHeaderSize(data, size);
+		if (header_size > size || size + 2 > rtx_buffer_.size())
+			return;
+		unsigned char* rtx = rtx_buffer_.data();
+		memcpy(rtx, data, header_size);
+		rtx[1] = (unsigned char)((data[1] & 0x80) | rtx_payload_type_);
+		rtx[2] = (unsigned char)(rtx_seq_ >> 8);
+		rtx[3] = (unsigned char)rtx_seq_;
+		++rtx_seq_;
+		rtx[8] = (unsigned char)(rtx_ssrc_ >> 24);
+		rtx[9] = (unsigned char)(rtx_ssrc_ >> 16);
+		rtx[10] = (unsigned char)(rtx_ssrc_ >> 8);
+		rtx[11] = (unsigned char)rtx_ssrc_;
+		rtx[header_size] = (unsigned char)(seq >> 8);
+		rtx[header_size + 1] = (unsigned char)seq;
+		memcpy(rtx + header_size + 2, data + header_size, size - header_size);
+		data = rtx;
+		size += 2;
+	}
+	// straight to the socket, past the pacing, the receiver is waiting for it
+	Groupsock::write(entry->address, entry->ttl, data, size);
+	stats_->retransmitted_packets.fetch_add(1, std::memory_order_relaxed);
+	stats_->retransmit_delay_ns.fetch_add(now - entry->sent_ns, std::memory_order_relaxed);
+}
+
+Boolean BatchingGroupsock::write(struct sockaddr_storage const& address_and_port, u_int8_t ttl,
+				 unsigned char* buffer, unsigned buffer_size) {
+	// the RTCP packet types have the marker bit set
+	bool rtcp = buffer_size >= 2 && buffer[1] >= 200 && buffer[1] <= 204;
+	if (cache_ != nullptr && !rtcp) {
+		bool keyframe = IsKeyframePacket(buffer, buffer_size, hevc_);
+		keyframe_packets_ += keyframe;
+		cache_->Store(address_and_port, ttl, buffer, buffer_size, keyframe, os_gettime_ns());
+	}
+	Boolean result = Output(address_and_port, ttl, buffer, buffer_size);
+	if (fec_ == nullptr || rtcp || !fec_->Add(buffer, buffer_size))
+		return result;
+
+	// after the frame, a receiver recovers the lost packets as soon as the FEC arrives.
+	// the FEC groupsock has the client's FEC port as its destination
+	auto& packets = fec_->Encode();
+	for (auto& packet : packets) {
+		fec_target_->output(env(), const_cast<unsigned char*>(packet.data()),
+				    (unsigned)packet.size());
+	}
+	fec_stats_->fec_packets.fetch_add(packets.size(), std::memory_order_relaxed);
+#ifdef __linux__
+	// no marker bit ends the FEC packets of a frame
+	if (!fec_target_->pacer_.Enabled())
+		fec_target_->Flush();
+#endif
+	return result;
+}
+
+Boolean BatchingGroupsock::Output(struct sockaddr_storage const& address_and_port,
+				  u_int8_t ttl, unsigned char* buffer, unsigned buffer_size) {
+#ifdef __linux__
+	bool rtcp = buffer_size >= 2 && buffer[1] >= 200 && buffer[1] <= 204;
+	bool marker = buffer_size >= 2 && (buffer[1] & 0x80) != 0;
+	if (buffer_size > kSlotSize || (pacer_.Enabled() && rtcp)) {
+		// the reports aren't paced, the RTP packets keep their order
+		if (!rtcp)
+			Flush();
+		return Groupsock::write(address_and_port, ttl, buffer, buffer_size);
+	}
+
+	if (packets_.size() - sent_ >= kMaxQueuedPackets)
+		// the bitrate is way off, better a burst than unbounded memory
+		Flush();
+	Enqueue(address_and_port, buffer, buffer_size);
+
+	if (pacer_.Enabled()) {
+		Drain();
+	} else if (packets_.size() == kMaxPackets || marker) {
+		// the marker bit ends the access unit
+		Flush();
+	} else if (send_task_ == nullptr) {
+		send_task_ = env().taskScheduler().scheduleDelayedTask(kFlushDelay, SendTask, this);
+	}
+	// a failed send is dropped silently by the sink either way
+	return True;
+#else
+	return Groupsock::write(address_and_port, ttl, buffer, buffer_size);
+#endif
+}
+
+void BatchingGroupsock::Enqueue(struct sockaddr_storage const& address_and_port,
+				unsigned char* buffer, unsigned buffer_size) {
+	if (sent_ > 0 && packets_.size() * kSlotSize >= slots_.size()) {
+		// move the packets which are still queued to the front instead of growing
+		size_t count = packets_.size() - sent_;
+		memmove(slots_.data(), slots_.data() + sent_ * kSlotSize, count * kSlotSize);
+		packets_.erase(packets_.begin(), packets_.begin() + sent_);
+		sent_ = 0;
+	}
+	if (packets_.size() * kSlotSize >= slots_.size())
+		slots_.resize(slots_.size() * 2);
+
+	memcpy(slots_.data() + packets_.size() * kSlotSize, buffer, buffer_size);
+	packets_.push_back({address_and_port, buffer_size});
+	pacer_.Enqueue(buffer_size, os_gettime_ns());
+	++packet_count_;
+}
+
+void BatchingGroupsock::SendTask(void* data) {
+	auto groupsock = static_cast<BatchingGroupsock*>(data);
+	groupsock->send_task_ = nullptr;
+	if (groupsock->pacer_.Enabled())
+		groupsock->Drain();
+	else
+		groupsock->Flush();
+}
+
+void BatchingGroupsock::Flush() {
+	env().taskScheduler().unscheduleDelayedTask(send_task_);
+	while (sent_ < packets_.size()) {
+		sent_ = Send(sent_, packets_.size(), gso_supported_.load(std::memory_order_relaxed));
+	}
+	packets_.clear();
+	sent_ = 0;
+	pacer_.Clear();
+}
+
+void BatchingGroupsock::Drain() {
+	env().taskScheduler().unscheduleDelayedTask(send_task_);
+	uint64_t now = os_gettime_ns();
+	size_t last = sent_;
+	while (last < packets_.size() && pacer_.Take(packets_[last].size, now)) {
+		++last;
+	}
+	while (sent_ < last) {
+		sent_ = Send(sent_, last, gso_supported_.load(std::memory_order_relaxed));
+	}
+	if (sent_ == packets_.size()) {
+		packets_.clear();
+		sent_ = 0;
+		return;
+	}
+
+	// come back once the bucket has the tokens for the next packet
+	int64_t delay = (int64_t)((pacer_.NextSendNs(packets_[sent_].size, now) - now + 999) / 1000);
+	send_task_ = env().taskScheduler().scheduleDelayedTask(delay, SendTask, this);
+}
+
+#ifdef __linux__
+static socklen_t AddressLength(const struct sockaddr_storage& address) {
+	return address.ss_family == AF_INET ? sizeof(struct sockaddr_in)
+					    : sizeof(struct sockaddr_in6);
+}
+
+size_t BatchingGroupsock::Send(size_t first, size_t last, bool gso) {
+	struct mmsghdr messages[kMaxPackets];
+	struct iovec iovs[kMaxPackets];
+	// the segment size of the GSO datagrams
+	char controls[kMaxPackets][CMSG_SPACE(sizeof(uint16_t))];
+	size_t message_first[kMaxPackets];
+	size_t message_count = 0;
+
+	last = std::min(last, first + kMaxPackets);
+	memset(messages, 0, sizeof(messages));
+	for (size_t i = first; i < last; ++i) {
+		iovs[i - first].iov_base = slots_.data() + i * kSlotSize;
+		iovs[i - first].iov_len = packets_[i].size;
+	}
+
+	for (size_t i = first; i < last;) {
+		const Packet& packet = packets_[i];
+		socklen_t address_length = AddressLength(packet.address);
+		// the kernel cuts a GSO datagram into `packet.size` segments, only the last
+		// one can be shorter
+		size_t run = 1;
+		unsigned bytes = packet.size;
+		while (gso && i + run < last) {
+			const Packet& next = packets_[i + run];
+			if (next.size > packet.size || bytes + next.size > kMaxGsoBytes ||
+			    memcmp(&next.address, &packet.address, address_length) != 0)
+				break;
+			bytes += next.size;
+			++run;
+			if (next.size < packet.size)
+				break;
+		}
+
+		struct msghdr& header = messages[message_count].msg_hdr;
+		header.msg_name = (void*)&packet.address;
+		header.msg_namelen = address_length;
+		header.msg_iov = &iovs[i - first];
+		header.msg_iovlen = run;
+		if (run > 1) {
+			header.msg_control = controls[message_count];
+			header.msg_controllen = sizeof(controls[message_count]);
+			struct cmsghdr* control = CMSG_FIRSTHDR(&header);
+			control->cmsg_level = SOL_UDP;
+			control->cmsg_type = UDP_SEGMENT;
+			control->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			uint16_t segment_size = (uint16_t)packet.size;
+			memcpy(CMSG_DATA(control), &segment_size, sizeof(segment_size));
+		}
+		message_first[message_count++] = i;
+		i += run;
+	}
+
+	size_t sent = 0;
+	while (sent < message_count) {
+		int result = sendmmsg(socketNum(), messages + sent, (unsigned)(message_count - sent), 0);
+		++syscall_count_;
+		if (result >= 0) {
+			sent += result;
+			continue;
+		}
+		if (errno == EINTR)
+			continue;
+		if (messages[sent].msg_hdr.msg_controllen > 0 &&
+		    (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+			// an old kernel or no checksum offload on the interface, send them one by one
+			if (gso_supported_.exchange(false, std::memory_order_relaxed))
+				blog(LOG_INFO, "rtsp server can't use UDP GSO (%d), batching only", errno);
+			return message_first[sent];
+		}
+		// the socket buffer is full or the client is gone, the packets are lost just like
+		// with a failed sendto
+		break;
+	}
+	return last;
+}
+#else
+size_t BatchingGroupsock::Send(size_t first, size_t last, bool gso) {
+	// `Output` writes every packet right away, nothing is ever queued
+	(void)first;
+	(void)gso;
+	return last;
+}
+#endif
+} // namespace output
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "liveMedia.hh"
+#include "pacer.h"
+#include "retransmission_cache.h"
+#include "server_stats.h"
+
+#include <atomic>
+#include <vector>
+
+namespace output {
+class FecEncoder;
+
+/// <summary>
+/// Unicast RTP groupsock which collects the packets of an access unit and sends them
+/// with one sendmmsg, runs of equally sized packets go out as a single UDP GSO datagram.
+/// With pacing the packets leave through a token bucket instead of in one burst.
+/// Anywhere but Linux the packets are written one by one as usual.
+/// RTP over TCP never reaches the groupsock: the RTPInterface of live555 writes the
+/// "$" framing header & the packet of every interleaved packet with a send() each, and
+/// neither the interface nor its TCP write can be overridden, so there is no writev for
+/// it short of patching live555. `OBSFramedSource` holds the frames back instead while
+/// the client's socket is full.
+/// The RTP groupsock of a stream can keep its packets for the generic NACKs(RFC 4585)
+/// which the RTCP groupsock of the stream receives, and have the groupsock of the FEC
+/// session send XOR parity packets after every frame for the receivers which can't wait
+/// for a retransmission.
+/// </summary>
+class BatchingGroupsock : public Groupsock {
+public:
+	BatchingGroupsock(UsageEnvironment& env, struct sockaddr_storage const& group_address,
+			  Port port, u_int8_t ttl);
+	virtual ~BatchingGroupsock();
+
+	// spread the packets of a frame over `spread_ns`, never slower than `bitrate`(kbps),
+	// which also sizes the bucket. 0 `spread_ns` sends every frame as a burst
+	void SetPacing(unsigned bitrate, uint64_t spread_ns);
+
+	// keep the sent RTP packets for `history_ns` and resend the ones the receiver NACKs,
+	// as RTX packets(RFC 4588) of `rtx_payload_type` unless it's 0. the H264 or
+	// H265(`hevc`) payloads tell the packets of the keyframes apart
+	void EnableRetransmission(uint64_t history_ns, unsigned bitrate,
+				  unsigned char rtx_payload_type, bool hevc, ServerStats& stats);
+	// `fec`, the RTP groupsock of the client's FEC session, sends `overhead_percent` FEC
+	// packets(RFC 5109) for every 100 RTP packets, right after the packets they protect.
+	// they have the `payload_type`, `ssrc` & the sequence numbers from `seq` on of the FEC
+	// session. null `fec` stops the FEC, it has to outlive the groupsock otherwise
+	void SetFecTarget(BatchingGroupsock* fec, unsigned overhead_percent,
+			  unsigned char payload_type, u_int32_t ssrc, uint16_t seq,
+			  ServerStats& stats);
+	// the RTCP groupsock of the stream passes the NACKs it receives on to `rtp`
+	void SetFeedbackTarget(BatchingGroupsock* rtp);
+
+	// called by `Groupsock::output` for every destination
+	virtual Boolean write(struct sockaddr_storage const& address_and_port, u_int8_t ttl,
+			      unsigned char* buffer, unsigned buffer_size) override;
+	// the RTCP instance reads the packets through it, it ignores the feedback messages
+	virtual Boolean handleRead(unsigned char* buffer, unsigned buffer_max_size,
+				   unsigned& bytes_read,
+				   struct sockaddr_storage& from_address_and_port) override;
+
+	// send the queued packets now
+	void Flush();
+
+	// with retransmission, the keyframe packets sent and the ones the receiver NACKed at
+	// least once, which it lost on the way
+	uint64_t KeyframePackets() const { return keyframe_packets_; }
+	uint64_t LostKeyframePackets() const { return lost_keyframe_packets_; }
+
+private:
+	struct Packet {
+		struct sockaddr_storage address;
+		unsigned size;
+	};
+
+	// a slot of `kSlotSize` bytes for every packet, the sink reuses its buffer for the
+	// next packet
+	std::vector<unsigned char> slots_;
+	std::vector<Packet> packets_;
+	// the packets before it are sent already
+	size_t sent_;
+	TaskToken send_task_;
+
+	// the packets from `sent_` on leave through it
+	Pacer pacer_;
+
+	uint64_t packet_count_;
+	uint64_t syscall_count_;
+
+	// the RTP groupsock of a RTCP one and the other way around
+	BatchingGroupsock* feedback_peer_;
+	RetransmissionCache* cache_;
+	std::vector<RetransmissionCache::Nack> nacks_;
+	ServerStats* stats_;
+	unsigned char rtx_payload_type_;
+	u_int32_t rtx_ssrc_;
+	uint16_t rtx_seq_;
+	std::vector<unsigned char> rtx_buffer_;
+	bool hevc_;
+	uint64_t keyframe_packets_;
+	uint64_t lost_keyframe_packets_;
+	FecEncoder* fec_;
+	BatchingGroupsock* fec_target_;
+	ServerStats* fec_stats_;
+
+	// the kernel or the interface rejected a GSO send once, shared by all the server loops
+	static std::atomic<bool> gso_supported_;
+
+	static void SendTask(void* data);
+	// queues or sends a packet, paced & batched like the ones of the sink
+	Boolean Output(struct sockaddr_storage const& address_and_port, u_int8_t ttl,
+		       unsigned char* buffer, unsigned buffer_size);
+	void Enqueue(struct sockaddr_storage const& address_and_port, unsigned char* buffer,
+		     unsigned buffer_size);
+	// send the packets the bucket has tokens for, wait for the tokens of the rest
+	void Drain();
+	// sends the packets in [`first`, `last`), returns where to continue, which is before
+	// `last` if only a part of them fits into one sendmmsg or if the GSO send failed
+	size_t Send(size_t first, size_t last, bool gso);
+	// the RTCP compound packet of a receiver, picks out the generic NACKs
+	void OnFeedback(const unsigned char* packet, unsigned size);
+	void Retransmit(u_int32_t ssrc, uint16_t seq);
+};
+} // namespace output
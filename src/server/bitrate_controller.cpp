@@ -0,0 +1,133 @@
+#include "bitrate_controller.h"
+
+#include <obs.h>
+
+#include <algorithm>
+
+namespace output {
+// more loss than this is congestion, less than `kLowLoss` leaves room to grow
+static const double kHighLoss = 0.10;
+static const double kLowLoss = 0.02;
+// the jitter of a congested path grows with the queue in front of the bottleneck
+static const double kJitterGrowth = 1.5;
+static const double kJitterGrowthMinMs = 5.0;
+// a decrease needs a while to show up in the reports, don't react to the same congestion
+// twice
+static const uint64_t kDecreaseHoldOff = 2000000000ULL;   // 2 s
+// the bitrate only grows back after this long without a decrease
+static const uint64_t kIncreaseHoldOff = 8000000000ULL;   // 8 s
+static const uint64_t kIncreaseInterval = 2000000000ULL;  // 2 s
+static const double kIncreaseFactor = 1.08;
+// a receiver which didn't report for this long doesn't hold the increases back anymore
+static const uint64_t kReceiverTimeout = 30000000000ULL;  // 30 s
+// smaller steps aren't worth reconfiguring the encoder
+static const double kMinStep = 0.05;
+
+BitrateController::BitrateController(unsigned start_kbps, unsigned min_kbps, unsigned max_kbps,
+				     const std::string& primary)
+  : min_kbps_(std::max(1u, min_kbps)),
+    max_kbps_(std::max(min_kbps_, max_kbps)),
+    primary_(primary),
+    target_kbps_(std::min(std::max(start_kbps, min_kbps_), max_kbps_)),
+    last_decrease_ns_(0),
+    last_increase_ns_(0) {}
+
+unsigned BitrateController::Update(const std::vector<ClientStats>& clients, uint64_t now_ns) {
+	// the worst of the new reports
+	bool reported = false;
+	double loss = 0.0;
+	bool jitter_growing = false;
+	const ClientStats* worst = nullptr;
+	for (auto& receiver : receivers_) { receiver.second.present = false; }
+	for (auto& client : clients) {
+		if (client.audio)
+			continue;
+		if (!primary_.empty() && client.address != primary_)
+			continue;
+
+		// a client without a report yet holds the increases back as well
+		Receiver& receiver = receivers_[{client.address, client.session_id}];
+		receiver.present = true;
+		if (receiver.report_ns == 0)
+			receiver.report_ns = now_ns;
+		if (client.report_seq == 0 || receiver.report_seq == client.report_seq)
+			continue;
+		bool first = receiver.report_seq == 0;
+		receiver.report_seq = client.report_seq;
+		receiver.report_ns = now_ns;
+		receiver.loss = client.loss;
+		receiver.fresh = true;
+		reported = true;
+
+		if (!first && client.jitter_ms > receiver.jitter_ms * kJitterGrowth &&
+		    client.jitter_ms - receiver.jitter_ms > kJitterGrowthMinMs)
+			jitter_growing = true;
+		// the baseline follows the jitter slowly, a congested path doesn't become the norm
+		receiver.jitter_ms = first ? client.jitter_ms
+					   : receiver.jitter_ms * 0.9 + client.jitter_ms * 0.1;
+		if (worst == nullptr || client.loss > loss) {
+			loss = client.loss;
+			worst = &client;
+		}
+	}
+	// the clients which left, and the latest loss of the ones which still report
+	bool all_fresh = true;
+	double latest_loss = 0.0;
+	for (auto it = receivers_.begin(); it != receivers_.end();) {
+		Receiver& receiver = it->second;
+		if (!receiver.present) {
+			it = receivers_.erase(it);
+			continue;
+		}
+		if (now_ns - receiver.report_ns <= kReceiverTimeout) {
+			all_fresh = all_fresh && receiver.fresh;
+			latest_loss = std::max(latest_loss, receiver.loss);
+		}
+		++it;
+	}
+	if (!reported)
+		return 0;
+
+	unsigned target = target_kbps_;
+	const char* reason = nullptr;
+	if (loss > kHighLoss || jitter_growing) {
+		if (now_ns - last_decrease_ns_ < kDecreaseHoldOff)
+			return 0;
+		// back off by half the loss, the jitter alone by a fixed step
+		double factor = loss > kHighLoss ? 1.0 - 0.5 * loss : 0.85;
+		target = (unsigned)(target_kbps_ * factor);
+		reason = loss > kHighLoss ? "loss" : "jitter";
+	} else if (loss < kLowLoss) {
+		// the receivers which didn't report since the last change may still see it hurt
+		if (!all_fresh || latest_loss >= kLowLoss)
+			return 0;
+		if (now_ns - last_decrease_ns_ < kIncreaseHoldOff ||
+		    now_ns - last_increase_ns_ < kIncreaseInterval)
+			return 0;
+		target = (unsigned)(target_kbps_ * kIncreaseFactor);
+		reason = "no loss";
+	} else {
+		// between the thresholds, hold
+		return 0;
+	}
+
+	target = std::min(std::max(target, min_kbps_), max_kbps_);
+	if (target == target_kbps_)
+		return 0;
+	double step = target > target_kbps_ ? (double)(target - target_kbps_) / target_kbps_
+					    : (double)(target_kbps_ - target) / target_kbps_;
+	// the limits may leave only a small step, take it anyway
+	if (step < kMinStep && target != min_kbps_ && target != max_kbps_)
+		return 0;
+
+	if (target < target_kbps_)
+		last_decrease_ns_ = now_ns;
+	else
+		last_increase_ns_ = now_ns;
+	for (auto& receiver : receivers_) { receiver.second.fresh = false; }
+	blog(LOG_INFO, "rtsp video bitrate %u -> %u kbps(%s, loss %.1f%% from %s)", target_kbps_,
+	     target, reason, loss * 100.0, worst != nullptr ? worst->address.c_str() : "-");
+	target_kbps_ = target;
+	return target;
+}
+} // namespace output
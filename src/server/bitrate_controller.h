@@ -0,0 +1,52 @@
+#pragma once
+
+#include "server_stats.h"
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace output {
+/// <summary>
+/// Picks the video bitrate from the RTCP receiver reports of the clients, loss based like
+/// the sender side of GCC: a high loss fraction or a growing jitter backs off right away,
+/// the bitrate only grows back after a calm period, and only once every receiver reported
+/// since the last change with a low loss. Only new reports count, a report which the
+/// trackers publish every second is looked at once.
+/// </summary>
+class BitrateController {
+public:
+	// `primary`: only the video clients with this address steer the bitrate, empty for
+	// the worst one of all the clients
+	BitrateController(unsigned start_kbps, unsigned min_kbps, unsigned max_kbps,
+			  const std::string& primary);
+	BitrateController(const BitrateController&) = delete;
+
+	// the new bitrate in kbps, 0 if it stays the same
+	unsigned Update(const std::vector<ClientStats>& clients, uint64_t now_ns);
+	unsigned Target() const { return target_kbps_; }
+
+private:
+	// the last report seen from a client & its jitter baseline
+	struct Receiver {
+		uint32_t report_seq = 0;
+		double jitter_ms = 0.0;
+		double loss = 0.0;
+		// the last new report, or when the client showed up without one
+		uint64_t report_ns = 0;
+		// it reported since the last change of the bitrate
+		bool fresh = false;
+		bool present = false;
+	};
+
+	unsigned min_kbps_;
+	unsigned max_kbps_;
+	std::string primary_;
+	unsigned target_kbps_;
+	uint64_t last_decrease_ns_;
+	uint64_t last_increase_ns_;
+	std::map<std::pair<std::string, unsigned>, Receiver> receivers_;
+};
+} // namespace output
@@ -0,0 +1,108 @@
+#include "client_tracker.h"
+#include "batching_groupsock.h"
+#include "obs_framed_source.h"
+
+#include "GroupsockHelper.hh"
+
+#include <util/platform.h>
+
+#include <algorithm>
+
+namespace output {
+// the receivers send a report every few seconds
+static const int64_t kUpdateInterval = 1000000; // 1 s
+static const unsigned kRtpHeaderSize = 12;
+
+ClientTracker::ClientTracker(UsageEnvironment& env, ServerStats& stats, bool audio)
+  : env_(env),
+    stats_(stats),
+    audio_(audio),
+    update_task_(nullptr) {}
+
+ClientTracker::~ClientTracker() {
+	env_.taskScheduler().unscheduleDelayedTask(update_task_);
+	for (auto& client : clients_) { stats_.RemoveClient({this, client.first}); }
+}
+
+void ClientTracker::Add(unsigned session_id, const struct sockaddr_storage& address, bool tcp,
+			RTPSink* sink, source::OBSFramedSource* source,
+			BatchingGroupsock* groupsock) {
+	if (sink == nullptr)
+		return;
+
+	Client client = {};
+	AddressString name(address);
+	client.stats.address = name.val();
+	client.stats.session_id = session_id;
+	client.stats.audio = audio_;
+	client.stats.tcp = tcp;
+	client.stats.connect_ns = os_gettime_ns();
+	client.sink = sink;
+	client.source = source;
+	client.groupsock = groupsock;
+	client.packets = sink->packetCount();
+	client.octets = sink->octetCount();
+	clients_[session_id] = client;
+	stats_.UpdateClient({this, session_id}, client.stats);
+
+	if (update_task_ == nullptr)
+		update_task_ =
+		  env_.taskScheduler().scheduleDelayedTask(kUpdateInterval, UpdateTask, this);
+}
+
+void ClientTracker::Remove(unsigned session_id) {
+	auto it = clients_.find(session_id);
+	if (it == clients_.end())
+		return;
+	Update(it->second);
+	stats_.RemoveClient({this, session_id});
+	clients_.erase(it);
+}
+
+void ClientTracker::UpdateTask(void* data) {
+	auto tracker = static_cast<ClientTracker*>(data);
+	tracker->update_task_ = nullptr;
+	for (auto& client : tracker->clients_) {
+		tracker->Update(client.second);
+		tracker->stats_.UpdateClient({tracker, client.first}, client.second.stats);
+	}
+	if (!tracker->clients_.empty())
+		tracker->update_task_ = tracker->env_.taskScheduler().scheduleDelayedTask(
+		  kUpdateInterval, UpdateTask, tracker);
+}
+
+void ClientTracker::Update(Client& client) {
+	RTPSink* sink = client.sink;
+	// the counters of the sink are 32 bit, the differences survive the wrap around
+	u_int32_t packets = sink->packetCount() - client.packets;
+	u_int32_t octets = sink->octetCount() - client.octets;
+	client.packets += packets;
+	client.octets += octets;
+	uint64_t bytes = octets + (uint64_t)packets * kRtpHeaderSize;
+	client.stats.packets += packets;
+	client.stats.bytes += bytes;
+	stats_.packets_sent.fetch_add(packets, std::memory_order_relaxed);
+	stats_.bytes_sent.fetch_add(bytes, std::memory_order_relaxed);
+
+	if (client.source != nullptr)
+		client.stats.dropped_frames = client.source->Dropped();
+	if (client.groupsock != nullptr) {
+		client.stats.keyframe_packets = client.groupsock->KeyframePackets();
+		client.stats.lost_keyframe_packets = client.groupsock->LostKeyframePackets();
+	}
+
+	// a unicast sink has the one receiver
+	RTPTransmissionStatsDB::Iterator it(sink->transmissionStatsDB());
+	RTPTransmissionStats* report = it.next();
+	if (report == nullptr)
+		return;
+	client.stats.report_seq = report->lastPacketNumReceived();
+	client.stats.loss = report->packetLossRatio() / 256.0;
+	client.stats.lost_packets = report->totNumPacketsLost();
+	if (sink->rtpTimestampFrequency() > 0)
+		client.stats.jitter_ms = report->jitter() * 1000.0 / sink->rtpTimestampFrequency();
+	client.stats.max_jitter_ms = std::max(client.stats.max_jitter_ms, client.stats.jitter_ms);
+	// in 1/65536 seconds, 0 until the receiver echoed a sender report
+	client.stats.rtt_ms = report->roundTripDelay() * 1000.0 / 65536.0;
+}
+} // namespace output
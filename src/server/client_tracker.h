@@ -0,0 +1,53 @@
+#pragma once
+
+#include "liveMedia.hh"
+#include "server_stats.h"
+
+#include <map>
+
+namespace output {
+class BatchingGroupsock;
+
+namespace source {
+class OBSFramedSource;
+} // namespace source
+
+/// <summary>
+/// Publishes the `ClientStats` of the clients of one subsession to the `ServerStats`,
+/// from the counters of their RTP sinks and the RTCP receiver reports. Runs on the
+/// server loop of the subsession.
+/// </summary>
+class ClientTracker {
+public:
+	ClientTracker(UsageEnvironment& env, ServerStats& stats, bool audio);
+	~ClientTracker();
+	ClientTracker(const ClientTracker&) = delete;
+
+	// `source` may be null if the track has no per client queue, `groupsock` unless the
+	// video goes over UDP. both are closed after `Remove`
+	void Add(unsigned session_id, const struct sockaddr_storage& address, bool tcp,
+		 RTPSink* sink, source::OBSFramedSource* source, BatchingGroupsock* groupsock);
+	// before the sink is closed, the final counts are added to the totals
+	void Remove(unsigned session_id);
+
+private:
+	struct Client {
+		ClientStats stats;
+		RTPSink* sink;
+		source::OBSFramedSource* source;
+		BatchingGroupsock* groupsock;
+		// the 32 bit counters of the sink at the last update
+		u_int32_t packets;
+		u_int32_t octets;
+	};
+
+	UsageEnvironment& env_;
+	ServerStats& stats_;
+	bool audio_;
+	std::map<unsigned, Client> clients_;
+	TaskToken update_task_;
+
+	static void UpdateTask(void* data);
+	void Update(Client& client);
+};
+} // namespace output
@@ -0,0 +1,66 @@
+#include "fec_encoder.h"
+
+#include "src/utils/ulpfec.h"
+
+#include <algorithm>
+
+namespace output {
+static const size_t kBlockPackets = utils::ulpfec::kLongMaskBits;
+
+FecEncoder::FecEncoder(unsigned overhead_percent, unsigned char payload_type, uint32_t ssrc,
+		       uint16_t seq)
+  : overhead_percent_(std::min(std::max(overhead_percent, 1u), 100u)),
+    payload_type_(payload_type),
+    ssrc_(ssrc),
+    seq_(seq),
+    media_(kBlockPackets),
+    media_count_(0) {}
+
+bool FecEncoder::Add(const unsigned char* packet, unsigned size) {
+	if (size < utils::ulpfec::kRtpHeaderSize)
+		return false;
+	if (media_count_ == kBlockPackets)
+		media_count_ = 0;
+	media_[media_count_++].assign(packet, packet + size);
+	bool marker = (packet[1] & 0x80) != 0;
+	return marker || media_count_ == kBlockPackets;
+}
+
+const std::vector<std::vector<unsigned char>>& FecEncoder::Encode() {
+	size_t count = media_count_;
+	media_count_ = 0;
+	size_t groups = std::max<size_t>(1, (count * overhead_percent_ + 99) / 100);
+	fec_.resize(groups);
+
+	std::vector<utils::ulpfec::Packet> packets;
+	packets.reserve((count + groups - 1) / groups);
+	for (size_t group = 0; group < groups; ++group) {
+		packets.clear();
+		for (size_t i = group; i < count; i += groups) {
+			packets.push_back({media_[i].data(), media_[i].size()});
+		}
+		if (!utils::ulpfec::Protect(packets, payload_)) {
+			fec_.resize(group);
+			break;
+		}
+
+		// the timestamp of the frame, no marker bit
+		const unsigned char* media = media_[0].data();
+		std::vector<unsigned char>& fec = fec_[group];
+		fec.resize(utils::ulpfec::kRtpHeaderSize + payload_.size());
+		unsigned char* out = fec.data();
+		out[0] = 0x80;
+		out[1] = payload_type_;
+		out[2] = (unsigned char)(seq_ >> 8);
+		out[3] = (unsigned char)seq_;
+		++seq_;
+		std::copy(media + 4, media + 8, out + 4);
+		out[8] = (unsigned char)(ssrc_ >> 24);
+		out[9] = (unsigned char)(ssrc_ >> 16);
+		out[10] = (unsigned char)(ssrc_ >> 8);
+		out[11] = (unsigned char)ssrc_;
+		std::copy(payload_.begin(), payload_.end(), out + utils::ulpfec::kRtpHeaderSize);
+	}
+	return fec_;
+}
+} // namespace output
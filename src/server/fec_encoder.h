@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace output {
+/// <summary>
+/// XOR parity(ULPFEC, RFC 5109) of the RTP packets of a frame, for the receivers which
+/// can't wait for a retransmission. The FEC packets form an RTP stream of their own, in
+/// a separate RTP session, so the sequence numbers of the media stay gap free for the
+/// receivers without FEC. A frame of `n` packets gets `n * overhead` FEC
+/// packets, the packets are spread over them round robin so a burst of up to that many
+/// lost packets can be recovered. A frame longer than the 48 bit mask is protected in
+/// blocks of 48 packets.
+/// </summary>
+class FecEncoder {
+public:
+	// `overhead_percent`: FEC packets per 100 media packets, at least one per block.
+	// the FEC packets have the `payload_type`, `ssrc` & the sequence numbers from `seq` on
+	// of the RTP sink of the FEC session
+	FecEncoder(unsigned overhead_percent, unsigned char payload_type, uint32_t ssrc,
+		   uint16_t seq);
+	FecEncoder(const FecEncoder&) = delete;
+
+	// a media packet was sent, true once its block is complete, the marker bit ends
+	// the block early
+	bool Add(const unsigned char* packet, unsigned size);
+	// the FEC packets of the complete block, valid until the next `Add`
+	const std::vector<std::vector<unsigned char>>& Encode();
+
+private:
+	unsigned overhead_percent_;
+	unsigned char payload_type_;
+	uint32_t ssrc_;
+	uint16_t seq_;
+	// the buffers are reused for the next block
+	std::vector<std::vector<unsigned char>> media_;
+	size_t media_count_;
+	std::vector<std::vector<unsigned char>> fec_;
+	std::vector<unsigned char> payload_;
+};
+} // namespace output
@@ -0,0 +1,539 @@
+#include "obs_framed_source.h"
+
+#include "environment.h"
+#include "GroupsockHelper.hh"
+#include "src/utils/h264/h264_common.h"
+#include "src/utils/h265/h265_common.h"
+
+#include <obs.h>
+#include <util/platform.h>
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#endif
+
+namespace output {
+// enough for a couple of seconds of the encoder running ahead of the server loop
+static const size_t kRingCapacity = 128;
+// log the latency every this many delivered frames
+static const uint64_t kLatencyLogInterval = 1800;
+// frames referenced by the ring, the GOP cache and the reader queues, the pool grows
+// past it if needed
+static const size_t kPoolSize = 512;
+// frames a reader can fall behind before it starts dropping up to the next keyframe
+static const size_t kReaderQueueCapacity = 128;
+// the same in bytes, a slow TCP client can't hold more than this in the server
+static const size_t kReaderQueueBytes = 4 * 1024 * 1024;
+// room for a couple of IDR frames in the socket of a TCP client
+static const unsigned kTcpSendBufferSize = 1024 * 1024;
+// how often a TCP client with a full socket buffer is polled
+static const int64_t kTcpRetryInterval = 2000; // 2 ms
+// the longest GOP which is cached for the new readers, 2 seconds at 60 fps, it must fit
+// into the reader queue
+static const size_t kGopCacheCapacity = 120;
+// enough for the NAL units of a typical access unit
+static const size_t kReservedNalus = 16;
+
+void EncodedFramePtr::Reset() {
+	if (frame_ == nullptr)
+		return;
+	if (frame_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		// the packet goes back to libobs, `nalus` keeps its capacity for the next one
+		obs_encoder_packet_release(frame_->packet);
+		frame_->data = nullptr;
+		frame_->size = 0;
+		frame_->nalus.clear();
+		frame_->in_use.store(false, std::memory_order_release);
+	}
+	frame_ = nullptr;
+}
+
+FramePool::FramePool(size_t size) : next_(0) {
+	frames_.reserve(size);
+	for (size_t i = 0; i < size; ++i) {
+		auto frame = new EncodedFrame();
+		frame->packet = new encoder_packet();
+		frame->nalus.reserve(kReservedNalus);
+		frames_.push_back(frame);
+	}
+}
+
+FramePool::~FramePool() {
+	for (auto frame : frames_) {
+		delete frame->packet;
+		delete frame;
+	}
+}
+
+size_t FrameQueue::DropDisposable(size_t keep) {
+	size_t kept = keep;
+	for (size_t i = keep; i < size_; ++i) {
+		auto& frame = frames_[(head_ + i) % frames_.size()];
+		if (frame->disposable) {
+			bytes_ -= frame->size;
+			frame.Reset();
+		} else {
+			if (kept != i)
+				frames_[(head_ + kept) % frames_.size()] = std::move(frame);
+			++kept;
+		}
+	}
+	size_t dropped = size_ - kept;
+	size_ = kept;
+	return dropped;
+}
+
+EncodedFrame* FramePool::Acquire() {
+	for (size_t i = 0; i < frames_.size(); ++i) {
+		auto frame = frames_[next_];
+		next_ = (next_ + 1) % frames_.size();
+		if (!frame->in_use.load(std::memory_order_acquire)) {
+			frame->in_use.store(true, std::memory_order_relaxed);
+			return frame;
+		}
+	}
+
+	// every frame is referenced by a slow reader, better to allocate than to drop it
+	auto frame = new EncodedFrame();
+	frame->packet = new encoder_packet();
+	frame->nalus.reserve(kReservedNalus);
+	frame->in_use.store(true, std::memory_order_relaxed);
+	frames_.push_back(frame);
+	blog(LOG_INFO, "rtsp server frame pool grown to %zu frames", frames_.size());
+	return frame;
+}
+
+// whether no other picture references the slices of the frame, the nal_ref_idc of H264,
+// the sub-layer non-reference types of H265(the OBS encoders use a single temporal layer)
+static bool IsDisposable(const EncodedFrame& frame, bool hevc) {
+	bool has_slices = false;
+	for (auto& nalu : frame.nalus) {
+		if (nalu.payload_size == 0)
+			continue;
+		uint8_t header = frame.data[nalu.payload_start_offset];
+		if (hevc) {
+			uint8_t type = utils::h265::ParseNaluType(header);
+			if (type >= utils::h265::kVps)
+				continue;
+			if (type > 14 || type % 2 == 1)
+				return false;
+		} else {
+			uint8_t type = utils::h264::ParseNaluType(header);
+			if (type < utils::h264::kSlice || type > utils::h264::kIdr)
+				continue;
+			if ((header & 0x60) != 0)
+				return false;
+		}
+		has_slices = true;
+	}
+	return has_slices;
+}
+
+// whether the frame starts an intra refresh instead of being an IDR, some encoders flag
+// them as keyframes, others don't
+static bool IsRecoveryPoint(const EncodedFrame& frame, bool hevc) {
+	bool recovery_point = false;
+	for (auto& nalu : frame.nalus) {
+		if (nalu.payload_size == 0)
+			continue;
+		const uint8_t* payload = frame.data + nalu.payload_start_offset;
+		if (hevc) {
+			uint8_t type = utils::h265::ParseNaluType(payload[0]);
+			if (type >= utils::h265::kBlaWLp && type <= utils::h265::kRsvIrapVcl23)
+				return false;
+			if (type == utils::h265::kPrefixSei && !recovery_point &&
+			    nalu.payload_size > utils::h265::kNaluTypeSize)
+				recovery_point = utils::h265::HasRecoveryPoint(
+				  payload + utils::h265::kNaluTypeSize,
+				  nalu.payload_size - utils::h265::kNaluTypeSize);
+		} else {
+			uint8_t type = utils::h264::ParseNaluType(payload[0]);
+			if (type == utils::h264::kIdr)
+				return false;
+			if (type == utils::h264::kSei && !recovery_point &&
+			    nalu.payload_size > utils::h264::kNaluTypeSize)
+				recovery_point = utils::h264::HasRecoveryPoint(
+				  payload + utils::h264::kNaluTypeSize,
+				  nalu.payload_size - utils::h264::kNaluTypeSize);
+		}
+	}
+	return recovery_point;
+}
+
+FrameBuilder::FrameBuilder(StreamClock& clock, ServerStats& stats, bool hevc)
+  : clock_(clock),
+    stats_(stats),
+    hevc_(hevc),
+    pool_(kPoolSize) {}
+
+EncodedFramePtr FrameBuilder::Build(struct encoder_packet* packet) {
+	uint64_t received_ns = os_gettime_ns();
+	// the interleaved output hands over refcounted packets, the frame holds a reference
+	// instead of a copy until the last reader is done with it
+	EncodedFrame* frame = pool_.Acquire();
+	frame->received_ns = received_ns;
+	obs_encoder_packet_ref(frame->packet, packet);
+	frame->data = frame->packet->data;
+	frame->size = frame->packet->size;
+	if (packet->size > stats_.largest_frame.load(std::memory_order_relaxed))
+		stats_.largest_frame.store(packet->size, std::memory_order_relaxed);
+	frame->audio = packet->type == OBS_ENCODER_AUDIO;
+	frame->keyframe = packet->keyframe;
+	// every video packet is one frame, one tick of the encoder timebase, an audio
+	// packet holds a frame of samples in a 1/sample_rate timebase
+	int64_t ticks = 1;
+	if (frame->audio) {
+		ticks = packet->encoder != nullptr ? obs_encoder_get_frame_size(packet->encoder) : 0;
+		if (ticks == 0)
+			ticks = 1024; // AAC
+	} else if (hevc_) {
+		utils::h265::FindNaluIndices(frame->data, frame->size, frame->nalus);
+	} else {
+		utils::h264::FindNaluIndices(frame->data, frame->size, frame->nalus);
+	}
+	// with intra refresh the recovery points take the place of the IDRs, for the GOP
+	// cache & the new readers alike
+	frame->recovery_point = !frame->audio && IsRecoveryPoint(*frame, hevc_);
+	frame->keyframe = frame->keyframe || frame->recovery_point;
+	frame->disposable = !frame->audio && !frame->keyframe && IsDisposable(*frame, hevc_);
+	// RTP timestamps follow the encoder pts, the queueing in the server doesn't matter
+	frame->presentation_time =
+	  clock_.ToWallClock(packet->pts, packet->timebase_num, packet->timebase_den);
+	frame->duration_us = (unsigned)StreamClock::ToMicroseconds(ticks, packet->timebase_num,
+								     packet->timebase_den);
+	return EncodedFramePtr(frame);
+}
+
+FrameFanout::FrameFanout(Environment& env, ServerStats& stats, bool video)
+  : env_(env),
+    stats_(stats),
+    video_(video),
+    drain_trigger_(env.taskScheduler().createEventTrigger(DrainRing)),
+    ring_(kRingCapacity),
+    reader_count_(0),
+    gop_valid_(false),
+    drop_gop_(false),
+    latency_count_(0),
+    latency_total_(0),
+    latency_max_(0) {
+	if (video_)
+		gop_.reserve(kGopCacheCapacity);
+}
+
+FrameFanout::~FrameFanout() {
+	env_.taskScheduler().deleteEventTrigger(drain_trigger_);
+	// release the frames which were never drained
+	EncodedFramePtr frame;
+	while (ring_.Pop(frame)) {}
+}
+
+void FrameFanout::AddReader(source::OBSFramedSource* reader) {
+	readers_.push_back(reader);
+	reader_count_.store(readers_.size(), std::memory_order_release);
+	// the reader can start from the last keyframe instead of waiting for the next one
+	DropStaleGop();
+	if (gop_valid_ && !gop_.empty())
+		reader->Burst(gop_);
+	else if (video_)
+		reader->WaitForKeyframe();
+}
+
+void FrameFanout::RemoveReader(source::OBSFramedSource* reader) {
+	readers_.erase(std::remove(readers_.begin(), readers_.end(), reader), readers_.end());
+	reader_count_.store(readers_.size(), std::memory_order_release);
+}
+
+void FrameFanout::OnFrameSent(const EncodedFrame& frame) {
+	uint64_t latency = os_gettime_ns() - frame.received_ns;
+	latency_total_ += latency;
+	latency_max_ = std::max(latency_max_, latency);
+	if (++latency_count_ < kLatencyLogInterval)
+		return;
+
+	blog(LOG_DEBUG, "rtsp server latency: avg %.2f ms, max %.2f ms over %llu frames",
+	     (double)latency_total_ / latency_count_ / 1000000.0, (double)latency_max_ / 1000000.0,
+	     (unsigned long long)latency_count_);
+	latency_count_ = 0;
+	latency_total_ = 0;
+	latency_max_ = 0;
+}
+
+void FrameFanout::OnFrameTruncated(size_t size, size_t max_size) {
+	uint64_t count = stats_.truncated_frames.fetch_add(1, std::memory_order_relaxed);
+	stats_.truncated_bytes.fetch_add(size - max_size, std::memory_order_relaxed);
+	// the video sinks grow instead, up to their limit
+	if (count % 100 == 0)
+		blog(LOG_WARNING, "rtsp server truncated a %zu bytes frame to %zu bytes", size,
+		     max_size);
+}
+
+void FrameFanout::OnFramesDropped(size_t count) {
+	stats_.client_dropped_frames.fetch_add(count, std::memory_order_relaxed);
+}
+
+void FrameFanout::Feed(const EncodedFramePtr& frame) {
+	EncodedFramePtr shared(frame);
+	if (!ring_.Push(std::move(shared))) {
+		// the server loop is stalled, the frame is lost either way
+		uint64_t dropped = stats_.dropped_frames.fetch_add(1, std::memory_order_relaxed);
+		if (dropped % 100 == 0)
+			blog(LOG_WARNING, "rtsp server is falling behind, %llu frames dropped",
+			     (unsigned long long)dropped + 1);
+		return;
+	}
+	// the trigger is the only thread safe call into the scheduler, `wakeup` breaks the
+	// select() of the loop so the frame doesn't wait for the next scheduler tick
+	env_.taskScheduler().triggerEvent(drain_trigger_, this);
+	env_.wakeup();
+}
+
+void FrameFanout::DrainRing(void* data) {
+	static_cast<FrameFanout*>(data)->DrainRing1();
+}
+
+void FrameFanout::DrainRing1() {
+	EncodedFramePtr frame;
+	while (ring_.Pop(frame)) {
+		if (video_) {
+			DropStaleGop();
+			CacheFrame(frame);
+		}
+		for (auto reader : readers_) { reader->Feed(frame); }
+	}
+}
+
+void FrameFanout::CacheFrame(const EncodedFramePtr& frame) {
+	// `clear` keeps the capacity, the cache doesn't allocate after the first GOP
+	if (frame->keyframe) {
+		gop_.clear();
+		gop_valid_ = true;
+	}
+	if (!gop_valid_)
+		return;
+	if (gop_.size() >= kGopCacheCapacity) {
+		// the GOP is too long for a burst, the new readers wait for the next keyframe
+		gop_.clear();
+		gop_valid_ = false;
+		return;
+	}
+	gop_.push_back(frame);
+}
+
+void FrameFanout::DropStaleGop() {
+	if (!drop_gop_.load(std::memory_order_acquire) || !drop_gop_.exchange(false))
+		return;
+	gop_.clear();
+	gop_valid_ = false;
+}
+} // namespace output
+
+namespace output::source {
+OBSFramedSource::OBSFramedSource(UsageEnvironment& env, FrameFanout& fanout, bool split_nalus)
+  : FramedSource(env),
+    fanout_(fanout),
+    split_nalus_(split_nalus),
+    frames_(kReaderQueueCapacity),
+    next_nalu_(0),
+    waiting_for_keyframe_(false),
+    dropped_(0),
+    burst_frames_(0),
+    sink_(nullptr),
+    tcp_socket_(-1),
+    retry_task_(nullptr) {
+	fanout_.AddReader(this);
+}
+
+OBSFramedSource::~OBSFramedSource() {
+	envir().taskScheduler().unscheduleDelayedTask(retry_task_);
+	fanout_.RemoveReader(this);
+	if (dropped_ > 0)
+		blog(LOG_INFO, "rtsp client %s dropped %zu frames", client_.c_str(), dropped_);
+}
+
+void OBSFramedSource::SetClient(const char* name, int tcp_socket) {
+	client_ = name;
+	tcp_socket_ = tcp_socket;
+	if (tcp_socket_ >= 0)
+		increaseSendBufferTo(envir(), tcp_socket_, kTcpSendBufferSize);
+}
+
+void OBSFramedSource::Feed(const EncodedFramePtr& frame) {
+	if (frame->audio) {
+		// nothing depends on the oldest frame, drop it to make room
+		while (!frames_.Empty() && OverBudget(*frame)) {
+			frames_.PopFront();
+			CountDropped(1);
+		}
+	} else if (frame->keyframe && (!frame->recovery_point || waiting_for_keyframe_)) {
+		// the keyframe doesn't depend on anything before it, the queued frames are
+		// only adding latency now. A recovery point does, skipping to it would smear
+		// the picture until the refresh is done, only a waiting reader takes that
+		DropQueuedFrames();
+		waiting_for_keyframe_ = false;
+	} else if (waiting_for_keyframe_) {
+		CountDropped(1);
+		return;
+	} else if (OverBudget(*frame)) {
+		// the sink is falling behind, skipping the frames which nothing references
+		// only costs smoothness
+		if (frame->disposable) {
+			CountDropped(1);
+			return;
+		}
+		// the burst is still needed to decode the live frames
+		size_t keep = std::max(next_nalu_ > 0 ? (size_t)1 : 0, burst_frames_);
+		CountDropped(frames_.DropDisposable(keep));
+		if (OverBudget(*frame)) {
+			// the later frames reference the dropped one, skip the rest of the GOP
+			DropQueuedFrames();
+			waiting_for_keyframe_ = true;
+			CountDropped(1);
+			return;
+		}
+	}
+
+	frames_.Push(frame);
+	DeliverFrame();
+}
+
+void OBSFramedSource::Burst(const std::vector<EncodedFramePtr>& gop) {
+	for (auto& frame : gop) { Feed(frame); }
+	burst_frames_ = frames_.Size();
+}
+
+bool OBSFramedSource::OverBudget(const EncodedFrame& frame) const {
+	return frames_.Full() || frames_.Bytes() + frame.size > kReaderQueueBytes;
+}
+
+void OBSFramedSource::DropQueuedFrames() {
+	// the front frame may be partially delivered, its remaining NAL units are still needed
+	size_t keep = next_nalu_ > 0 ? 1 : 0;
+	size_t count = 0;
+	while (frames_.Size() > keep) {
+		frames_.PopBack();
+		++count;
+	}
+	CountDropped(count);
+	burst_frames_ = std::min(burst_frames_, frames_.Size());
+}
+
+void OBSFramedSource::CountDropped(size_t count) {
+	if (count == 0)
+		return;
+	dropped_ += count;
+	fanout_.OnFramesDropped(count);
+}
+
+// whether `size` more bytes fit into the send buffer of `socket` without blocking
+static bool SocketHasRoom(int socket, size_t size) {
+#ifdef __linux__
+	int queued = 0;
+	int buffer_size = 0;
+	socklen_t len = sizeof(buffer_size);
+	if (ioctl(socket, SIOCOUTQ, &queued) == 0 &&
+	    getsockopt(socket, SOL_SOCKET, SO_SNDBUF, (char*)&buffer_size, &len) == 0)
+		// a frame bigger than the whole buffer goes out once the buffer is empty
+		return queued == 0 || (size_t)queued + size <= (size_t)buffer_size;
+#else
+	(void)size;
+#endif
+	// writable only tells that some room is left
+	fd_set set;
+	FD_ZERO(&set);
+	FD_SET((unsigned)socket, &set);
+	struct timeval timeout = {0, 0};
+	return select(socket + 1, nullptr, &set, nullptr, &timeout) > 0;
+}
+
+void OBSFramedSource::RetryDelivery(void* data) {
+	auto source = static_cast<OBSFramedSource*>(data);
+	source->retry_task_ = nullptr;
+	source->DeliverFrame();
+}
+
+void OBSFramedSource::DeliverFrame() {
+	if (!isCurrentlyAwaitingData())
+		return;
+
+	// skip the frames which have nothing to deliver
+	while (!frames_.Empty() && split_nalus_ && next_nalu_ >= frames_.Front()->nalus.size()) {
+		frames_.PopFront();
+		next_nalu_ = 0;
+	}
+	if (frames_.Empty())
+		return;
+
+	// live555 blocks or drops packets once the socket of a TCP client is full, the frame
+	// waits in the queue instead, which drops frames by itself if the client can't keep up
+	if (next_nalu_ == 0 && tcp_socket_ >= 0 &&
+	    !SocketHasRoom(tcp_socket_, frames_.Front()->size)) {
+		if (retry_task_ == nullptr)
+			retry_task_ = envir().taskScheduler().scheduleDelayedTask(kTcpRetryInterval,
+										  RetryDelivery, this);
+		return;
+	}
+
+	// keep the frame alive, it's popped before the sink consumes the data
+	EncodedFramePtr frame = frames_.Front();
+	bool first_nalu = next_nalu_ == 0;
+	// the burst frames are old, they would only skew the latency
+	bool live = burst_frames_ == 0;
+	// Set the 'presentation time', all the NAL units of a frame share it:
+	fPresentationTime = frame->presentation_time;
+
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+	if (split_nalus_) {
+		auto& nalu = frame->nalus[next_nalu_++];
+		data = frame->data + nalu.payload_start_offset;
+		size = nalu.payload_size;
+	} else {
+		data = frame->data;
+		size = frame->size;
+	}
+
+	// the sink makes room for the NAL unit and asks for it again, a stopped sink doesn't
+	// await data so it never gets here
+	if (size > fMaxSize && split_nalus_ && sink_ != nullptr && sink_->Grow(size)) {
+		--next_nalu_;
+		return;
+	}
+
+	// Deliver a data frame:
+	if (size > fMaxSize) {
+		fFrameSize = fMaxSize;
+		fNumTruncatedBytes = (unsigned)size - fMaxSize;
+		fanout_.OnFrameTruncated(size, fMaxSize);
+	} else {
+		fFrameSize = (unsigned)size;
+		fNumTruncatedBytes = 0;
+	}
+	memcpy(fTo, data, fFrameSize);
+
+	// the frame is shared with the other clients, only drop our reference
+	if (!split_nalus_ || next_nalu_ >= frame->nalus.size()) {
+		frames_.PopFront();
+		next_nalu_ = 0;
+		// the sink sends the NAL units of a frame back to back and paces the frames,
+		// except the burst which has to catch up with the live frames
+		if (burst_frames_ > 0) {
+			--burst_frames_;
+			fDurationInMicroseconds = 0;
+		} else {
+			fDurationInMicroseconds = frame->duration_us;
+		}
+	} else {
+		fDurationInMicroseconds = 0;
+	}
+
+	// Tell the reader that the data is now available:
+	FrameFanout& fanout = fanout_;
+	FramedSource::afterGetting(this);
+	// the RTP sink packs and sends the first packet of the frame within `afterGetting`
+	if (first_nalu && live)
+		fanout.OnFrameSent(*frame);
+}
+} // namespace output::source
@@ -0,0 +1,279 @@
+#pragma once
+
+#include "liveMedia.hh"
+#include "server_stats.h"
+#include "spsc_ring.h"
+#include "stream_clock.h"
+#include "src/utils/video_utils.h"
+
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Environment;
+struct encoder_packet;
+
+namespace output {
+namespace source {
+class OBSFramedSource;
+} // namespace source
+
+// An encoded OBS packet, referenced rather than copied and split into NAL units once,
+// every client of the server only holds a reference to it.
+// The frames are recycled by the `FramePool`, `nalus` keeps its capacity.
+struct EncodedFrame {
+	// the refcounted packet of the interleaved output, released with the last reference
+	struct encoder_packet* packet = nullptr;
+	// its data
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+	std::vector<utils::video::NaluIndex> nalus;
+	// decoding can start at the frame, an IDR or a recovery point
+	bool keyframe = false;
+	// a recovery point SEI without an IDR, the picture is only complete after the intra
+	// refresh went over it, the frames before it are still referenced
+	bool recovery_point = false;
+	// no other frame references it, the first thing to drop for a slow client
+	bool disposable = false;
+	// every audio frame decodes on its own
+	bool audio = false;
+	// `os_gettime_ns` when OBS handed over the packet
+	uint64_t received_ns = 0;
+	// the encoder pts on the `StreamClock`, shared by all the NAL units of the frame
+	struct timeval presentation_time = {0, 0};
+	unsigned duration_us = 0;
+
+	std::atomic<int> refs{0};
+	std::atomic<bool> in_use{false};
+};
+
+// Reference to a pooled `EncodedFrame`, the frame goes back to the pool with the last one.
+class EncodedFramePtr {
+public:
+	EncodedFramePtr() : frame_(nullptr) {}
+	// takes a reference on `frame`
+	explicit EncodedFramePtr(EncodedFrame* frame) : frame_(frame) {
+		if (frame_ != nullptr)
+			frame_->refs.fetch_add(1, std::memory_order_relaxed);
+	}
+	EncodedFramePtr(const EncodedFramePtr& other) : EncodedFramePtr(other.frame_) {}
+	EncodedFramePtr(EncodedFramePtr&& other) noexcept : frame_(other.frame_) {
+		other.frame_ = nullptr;
+	}
+	~EncodedFramePtr() { Reset(); }
+
+	EncodedFramePtr& operator=(EncodedFramePtr other) noexcept {
+		std::swap(frame_, other.frame_);
+		return *this;
+	}
+
+	void Reset();
+
+	const EncodedFrame* get() const { return frame_; }
+	const EncodedFrame* operator->() const { return frame_; }
+	const EncodedFrame& operator*() const { return *frame_; }
+	explicit operator bool() const { return frame_ != nullptr; }
+
+private:
+	EncodedFrame* frame_;
+};
+
+// Preallocated frames, acquired on the encoder thread and released on whichever
+// thread drops the last reference.
+class FramePool {
+public:
+	FramePool(size_t size);
+	~FramePool();
+	FramePool(const FramePool&) = delete;
+
+	// encoder thread, grows the pool if every frame is still referenced
+	EncodedFrame* Acquire();
+
+private:
+	std::vector<EncodedFrame*> frames_;
+	size_t next_;
+};
+
+// Fixed capacity FIFO of frames for a single reader, never allocates after construction.
+class FrameQueue {
+public:
+	FrameQueue(size_t capacity) : frames_(capacity), head_(0), size_(0), bytes_(0) {}
+
+	bool Empty() const { return size_ == 0; }
+	bool Full() const { return size_ == frames_.size(); }
+	size_t Size() const { return size_; }
+	// the encoded size of the queued frames
+	size_t Bytes() const { return bytes_; }
+
+	const EncodedFramePtr& Front() const { return frames_[head_]; }
+	void Push(const EncodedFramePtr& frame) {
+		bytes_ += frame->size;
+		frames_[(head_ + size_++) % frames_.size()] = frame;
+	}
+	void PopFront() {
+		bytes_ -= frames_[head_]->size;
+		frames_[head_].Reset();
+		head_ = (head_ + 1) % frames_.size();
+		--size_;
+	}
+	void PopBack() {
+		auto& frame = frames_[(head_ + --size_) % frames_.size()];
+		bytes_ -= frame->size;
+		frame.Reset();
+	}
+	// removes the disposable frames after the first `keep` ones, keeps the order of the
+	// others, returns the number of removed frames
+	size_t DropDisposable(size_t keep);
+
+private:
+	std::vector<EncodedFramePtr> frames_;
+	size_t head_;
+	size_t size_;
+	size_t bytes_;
+};
+
+// Wraps the OBS packets of one track into pooled frames on the encoder thread, a frame
+// is built once and shared by the fanouts of every server loop.
+class FrameBuilder {
+public:
+	// `hevc`: the video packets are H265, only affects the NAL unit splitting
+	FrameBuilder(StreamClock& clock, ServerStats& stats, bool hevc = false);
+	FrameBuilder(const FrameBuilder&) = delete;
+
+	// encoder thread
+	EncodedFramePtr Build(struct encoder_packet* packet);
+
+private:
+	StreamClock& clock_;
+	ServerStats& stats_;
+	bool hevc_;
+	FramePool pool_;
+};
+
+// Fans out the encoded frames to every `OBSFramedSource` of one server loop.
+// `Feed` is called on the OBS encoder thread, it only pushes the frame into a ring and
+// wakes up the server thread, which owns the readers and all the live555 objects.
+class FrameFanout {
+public:
+	// `video`: keep the last GOP for the new readers
+	FrameFanout(Environment& env, ServerStats& stats, bool video);
+	~FrameFanout();
+	FrameFanout(const FrameFanout&) = delete;
+
+	// server thread, a new reader starts with a burst of the cached GOP, or waits for the
+	// next keyframe without one
+	void AddReader(source::OBSFramedSource* reader);
+	void RemoveReader(source::OBSFramedSource* reader);
+	// server thread, the first RTP packet of a frame was sent
+	void OnFrameSent(const EncodedFrame& frame);
+	// server thread, the sink buffer was too small for `size` bytes
+	void OnFrameTruncated(size_t size, size_t max_size);
+	// server thread, a slow reader skipped `count` frames
+	void OnFramesDropped(size_t count);
+
+	// encoder thread, hand the frame over to the server thread
+	void Feed(const EncodedFramePtr& frame);
+	// any thread, the encoders stopped: the cached GOP is stale by the time they run
+	// again, it's dropped before the next reader or frame
+	void DropGop() { drop_gop_.store(true, std::memory_order_release); }
+	// any thread
+	bool HasReaders() const { return reader_count_.load(std::memory_order_acquire) > 0; }
+
+	const ServerStats& Stats() const { return stats_; }
+	ServerStats& Stats() { return stats_; }
+
+private:
+	Environment& env_;
+	ServerStats& stats_;
+	bool video_;
+	EventTriggerId drain_trigger_;
+	SpscRing<EncodedFramePtr> ring_;
+	std::atomic<size_t> reader_count_;
+	std::vector<source::OBSFramedSource*> readers_;
+	// server thread, the frames since the last keyframe, empty if the GOP is too long
+	std::vector<EncodedFramePtr> gop_;
+	bool gop_valid_;
+	std::atomic<bool> drop_gop_;
+
+	// `encoded_packet` to the first RTP packet latency, in nanoseconds
+	uint64_t latency_count_;
+	uint64_t latency_total_;
+	uint64_t latency_max_;
+
+	static void DrainRing(void* data);
+	void DrainRing1();
+	void CacheFrame(const EncodedFramePtr& frame);
+	void DropStaleGop();
+};
+
+namespace source {
+// The sink of a video source, it can make room for a NAL unit bigger than its buffer.
+class GrowableSink {
+public:
+	virtual ~GrowableSink() = default;
+	// later on the loop, the source delivers the same NAL unit again then. False if the
+	// sink can't, the NAL unit is truncated
+	virtual bool Grow(size_t size) = 0;
+};
+
+// Custom FramedSource subclass for OBS integration
+class OBSFramedSource : public FramedSource {
+public:
+	// `split_nalus`: deliver one NAL unit(without start code) at a time for the discrete
+	// framers, otherwise deliver the whole access unit
+	static OBSFramedSource* createNew(UsageEnvironment& env, FrameFanout& fanout,
+					  bool split_nalus) {
+		return new OBSFramedSource(env, fanout, split_nalus);
+	}
+
+	void Feed(const EncodedFramePtr& frame);
+	// queue the cached GOP, it's sent as fast as the sink can go to catch up with live
+	void Burst(const std::vector<EncodedFramePtr>& gop);
+	// skip the frames up to the next keyframe, nothing before them was delivered
+	void WaitForKeyframe() { waiting_for_keyframe_ = true; }
+	// the client is `name`, `tcp_socket` is its RTSP connection if the RTP packets are
+	// interleaved into it, otherwise -1
+	void SetClient(const char* name, int tcp_socket);
+	// the sink which reads the NAL units, it's closed before the source
+	void SetSink(GrowableSink* sink) { sink_ = sink; }
+	// frames skipped for this client
+	size_t Dropped() const { return dropped_; }
+
+protected:
+	OBSFramedSource(UsageEnvironment& env, FrameFanout& fanout, bool split_nalus);
+	virtual ~OBSFramedSource();
+
+	virtual void doGetNextFrame() override { DeliverFrame(); }
+
+private:
+	FrameFanout& fanout_;
+	bool split_nalus_;
+
+	// the frames waiting to be delivered to the sink
+	FrameQueue frames_;
+	// index of the next NAL unit in `frames_.Front()`
+	size_t next_nalu_;
+	// a frame was dropped, the following ones can't be decoded until the next keyframe
+	bool waiting_for_keyframe_;
+	size_t dropped_;
+	// frames at the front of `frames_` which belong to the initial burst
+	size_t burst_frames_;
+
+	GrowableSink* sink_;
+	std::string client_;
+	// the frames are held back while the socket buffer is full, the send would block
+	// the whole server loop
+	int tcp_socket_;
+	TaskToken retry_task_;
+
+	void DeliverFrame();
+	static void RetryDelivery(void* data);
+	// the queue can't take `frame` without going over its frame or byte limit
+	bool OverBudget(const EncodedFrame& frame) const;
+	// drop the frames which haven't been started yet
+	void DropQueuedFrames();
+	void CountDropped(size_t count);
+};
+} // namespace source
+} // namespace output
@@ -0,0 +1,501 @@
+#include "obs_media_subsession.h"
+#include "batching_groupsock.h"
+#include "obs_framed_source.h"
+#include "video_rtp_sink.h"
+
+#include "GroupsockHelper.hh"
+
+#include <algorithm>
+#include <string>
+
+namespace output::source {
+// the old fixed size, enough for 1080p at the usual bitrates
+static const size_t kMinRtpBufferSize = 300000;
+// the video track is 96, the audio track 97 & the FEC track 98, or 97 without audio
+static const unsigned char kRtxPayloadType = 99;
+
+// the size the sinks start with, `RtpBufferGuard` only grows it
+static size_t RtpBufferSize(const VideoConfig& config, const ServerStats& stats) {
+	// an IDR rarely exceeds half a second of the configured bitrate
+	size_t size = std::max(kMinRtpBufferSize, (size_t)config.bitrate * 1000 / 8 / 2);
+	// and never below the largest frame so far
+	return std::max(size, RtpBufferSizeFor(stats.largest_frame.load(std::memory_order_relaxed)));
+}
+
+// tell the new source of a client where it streams to, RTP over TCP is held back while
+// the client's socket is full
+static void SetupClientSource(OBSFramedSource* source,
+			      struct sockaddr_storage const& client_address, int tcp_socket_num) {
+	if (source == nullptr)
+		return;
+	AddressString name(client_address);
+	source->SetClient(name.val(), tcp_socket_num);
+}
+
+// keeps `playing` up to date, `on_play` only hears about the changes
+static void SetPlaying(std::set<unsigned>& playing, const PlayCallback& on_play,
+		       unsigned client_session_id, bool play) {
+	bool changed = play ? playing.insert(client_session_id).second
+			    : playing.erase(client_session_id) > 0;
+	if (changed && on_play)
+		on_play(play ? 1 : -1);
+}
+
+// the `lines` of the subsession and its "a=mid", null while there are no lines
+static char* AddMid(char const* lines, const char* mid) {
+	if (lines == nullptr)
+		return nullptr;
+	return strDup((std::string(lines) + "a=mid:" + mid + "\r\n").c_str());
+}
+
+// the source waits for the sink to grow instead of truncating a NAL unit
+template<class Sink> static RTPSink* ConnectSink(Sink* sink, OBSFramedSource* source) {
+	if (source != nullptr)
+		source->SetSink(sink);
+	return sink;
+}
+
+RTPSink* CreateVideoRTPSink(UsageEnvironment& env, Groupsock* rtp_groupsock,
+			    unsigned char rtp_payload_type, const VideoConfig& config,
+			    const ServerStats& stats, OBSFramedSource* source) {
+	RtpBufferGuard guard(RtpBufferSize(config, stats));
+	if (!config.HasParameterSets()) {
+		// the sink takes the parameter sets from the framer once it saw them
+		if (config.hevc)
+			return ConnectSink(GrowingH265VideoRTPSink::createNew(env, rtp_groupsock,
+									      rtp_payload_type),
+					   source);
+		return ConnectSink(
+		  GrowingH264VideoRTPSink::createNew(env, rtp_groupsock, rtp_payload_type), source);
+	}
+
+	// the SDP gets the sprop-parameter-sets(or sprop-vps/sps/pps) right away
+	if (!config.hevc)
+		return ConnectSink(GrowingH264VideoRTPSink::createNew(
+				     env, rtp_groupsock, rtp_payload_type, config.sps.data(),
+				     (unsigned)config.sps.size(), config.pps.data(),
+				     (unsigned)config.pps.size()),
+				   source);
+	return ConnectSink(GrowingH265VideoRTPSink::createNew(
+			     env, rtp_groupsock, rtp_payload_type, config.vps.data(),
+			     (unsigned)config.vps.size(), config.sps.data(),
+			     (unsigned)config.sps.size(), config.pps.data(),
+			     (unsigned)config.pps.size()),
+			   source);
+}
+
+ObsVideoSubsession::ObsVideoSubsession(UsageEnvironment& env, FrameFanout& fanout,
+				       const VideoConfig& config, const PlayCallback& on_play)
+  : OnDemandServerMediaSubsession(env, False /* every client has its own source */),
+    fanout_(fanout),
+    config_(config),
+    sdp_lines_(nullptr),
+    new_rtp_groupsock_(nullptr),
+    new_source_(nullptr),
+    tracker_(env, fanout.Stats(), false),
+    on_play_(on_play),
+    aux_sdp_line_(nullptr),
+    done_flag_(0),
+    dummy_sink_(nullptr) {}
+
+ObsVideoSubsession::~ObsVideoSubsession() {
+	if (!playing_.empty() && on_play_)
+		on_play_(-(int)playing_.size());
+	delete[] aux_sdp_line_;
+	delete[] sdp_lines_;
+}
+
+void ObsVideoSubsession::AfterPlayingDummy(void* data) {
+	auto subsession = static_cast<ObsVideoSubsession*>(data);
+	// Unschedule any pending 'checking' task:
+	subsession->envir().taskScheduler().unscheduleDelayedTask(subsession->nextTask());
+	// And signal the event loop that we're done:
+	subsession->done_flag_ = ~0;
+}
+
+void ObsVideoSubsession::CheckForAuxSDPLine(void* data) {
+	static_cast<ObsVideoSubsession*>(data)->CheckForAuxSDPLine1();
+}
+
+void ObsVideoSubsession::CheckForAuxSDPLine1() {
+	nextTask() = nullptr;
+
+	char const* dasl = nullptr;
+	if (aux_sdp_line_ != nullptr) {
+		// Signal the event loop that we're done:
+		done_flag_ = ~0;
+	} else if (dummy_sink_ != nullptr && (dasl = dummy_sink_->auxSDPLine()) != nullptr) {
+		aux_sdp_line_ = strDup(dasl);
+		dummy_sink_ = nullptr;
+
+		// Signal the event loop that we're done:
+		done_flag_ = ~0;
+	} else if (!done_flag_) {
+		// try again after a brief delay:
+		int delay = 100000; // 100 ms
+		nextTask() = envir().taskScheduler().scheduleDelayedTask(delay, CheckForAuxSDPLine,
+									  this);
+	}
+}
+
+char const* ObsVideoSubsession::sdpLines(int address_family) {
+	if (sdp_lines_ != nullptr)
+		return sdp_lines_;
+	char const* lines = OnDemandServerMediaSubsession::sdpLines(address_family);
+	if (config_.retransmit_ms == 0 || lines == nullptr) {
+		sdp_lines_ = AddMid(lines, kVideoMid);
+		return sdp_lines_;
+	}
+
+	// "m=video 0 RTP/AVP 96", the payload type of the track ends the first line
+	std::string sdp = lines;
+	size_t line_end = sdp.find("\r\n");
+	if (line_end == std::string::npos)
+		return lines;
+	size_t type_start = sdp.rfind(' ', line_end) + 1;
+	std::string payload_type = sdp.substr(type_start, line_end - type_start);
+
+	// the profile stays RTP/AVP: the SETUP parser of live555 only knows "RTP/AVP/TCP", a
+	// client which saw RTP/AVPF asks for "RTP/AVPF/TCP" and would be served over UDP.
+	// an AVP receiver ignores the rtcp-fb line (RFC 4585 4.2), so the NACKs come from the
+	// receivers which are set up for retransmission only
+	std::string extra = "a=rtcp-fb:" + payload_type + " nack\r\n";
+	if (config_.rtx) {
+		std::string rtx_type = std::to_string(kRtxPayloadType);
+		sdp.insert(line_end, " " + rtx_type);
+		extra += "a=rtpmap:" + rtx_type + " rtx/90000\r\n";
+		extra += "a=fmtp:" + rtx_type + " apt=" + payload_type +
+			 ";rtx-time=" + std::to_string(config_.retransmit_ms) + "\r\n";
+	}
+	sdp += extra;
+	sdp_lines_ = AddMid(sdp.c_str(), kVideoMid);
+	return sdp_lines_;
+}
+
+char const* ObsVideoSubsession::getAuxSDPLine(RTPSink* rtp_sink, FramedSource* input_source) {
+	if (aux_sdp_line_ != nullptr)
+		return aux_sdp_line_; // it's already been set up (for a previous client)
+	// the sink was created with the parameter sets from the encoder
+	if (config_.HasParameterSets())
+		return OnDemandServerMediaSubsession::getAuxSDPLine(rtp_sink, input_source);
+
+	if (dummy_sink_ == nullptr) {
+		// we're not already setting it up for another, concurrent stream
+		// Note: For H264 video, the 'config' information ("profile-level-id" and
+		// "sprop-parameter-sets") isn't known until we start reading the stream.
+		dummy_sink_ = rtp_sink;
+		{
+			// the fragmenter of the sink is set up with the buffer size
+			RtpBufferGuard guard(0);
+			dummy_sink_->startPlaying(*input_source, AfterPlayingDummy, this);
+		}
+		// Check whether the sink's 'auxSDPLine()' is ready:
+		CheckForAuxSDPLine(this);
+	}
+
+	envir().taskScheduler().doEventLoop(&done_flag_);
+
+	return aux_sdp_line_;
+}
+
+void ObsVideoSubsession::getStreamParameters(
+  unsigned client_session_id, struct sockaddr_storage const& client_address,
+  Port const& client_rtp_port, Port const& client_rtcp_port, int tcp_socket_num,
+  unsigned char rtp_channel_id, unsigned char rtcp_channel_id, TLSState* tls_state,
+  struct sockaddr_storage& destination_address, u_int8_t& destination_ttl,
+  Boolean& is_multicast, Port& server_rtp_port, Port& server_rtcp_port, void*& stream_token) {
+	new_source_ = nullptr;
+	OnDemandServerMediaSubsession::getStreamParameters(
+	  client_session_id, client_address, client_rtp_port, client_rtcp_port, tcp_socket_num,
+	  rtp_channel_id, rtcp_channel_id, tls_state, destination_address, destination_ttl,
+	  is_multicast, server_rtp_port, server_rtcp_port, stream_token);
+	SetupClientSource(new_source_, client_address, tcp_socket_num);
+	auto state = static_cast<StreamState*>(stream_token);
+	// the groupsocks of `createGroupsock`, the FEC track of the client sends through it
+	BatchingGroupsock* groupsock = nullptr;
+	if (state != nullptr && tcp_socket_num < 0) {
+		groupsock = static_cast<BatchingGroupsock*>(&state->rtpSink()->groupsockBeingUsed());
+		udp_groupsocks_[client_session_id] = groupsock;
+	}
+	if (state != nullptr)
+		tracker_.Add(client_session_id, client_address, tcp_socket_num >= 0, state->rtpSink(),
+			     new_source_, groupsock);
+	new_source_ = nullptr;
+}
+
+void ObsVideoSubsession::startStream(
+  unsigned client_session_id, void* stream_token, TaskFunc* rtcp_rr_handler,
+  void* rtcp_rr_handler_client_data, unsigned short& rtp_seq_num, unsigned& rtp_timestamp,
+  ServerRequestAlternativeByteHandler* alternative_byte_handler,
+  void* alternative_byte_handler_client_data) {
+	{
+		// the fragmenter of the sink is set up with the buffer size
+		RtpBufferGuard guard(0);
+		OnDemandServerMediaSubsession::startStream(
+		  client_session_id, stream_token, rtcp_rr_handler, rtcp_rr_handler_client_data,
+		  rtp_seq_num, rtp_timestamp, alternative_byte_handler,
+		  alternative_byte_handler_client_data);
+	}
+	SetPlaying(playing_, on_play_, client_session_id, true);
+}
+
+void ObsVideoSubsession::pauseStream(unsigned client_session_id, void* stream_token) {
+	SetPlaying(playing_, on_play_, client_session_id, false);
+	OnDemandServerMediaSubsession::pauseStream(client_session_id, stream_token);
+}
+
+void ObsVideoSubsession::deleteStream(unsigned client_session_id, void*& stream_token) {
+	// the sink & the groupsocks are closed with the stream
+	tracker_.Remove(client_session_id);
+	udp_groupsocks_.erase(client_session_id);
+	SetPlaying(playing_, on_play_, client_session_id, false);
+	OnDemandServerMediaSubsession::deleteStream(client_session_id, stream_token);
+}
+
+void ObsVideoSubsession::AttachFec(unsigned client_session_id, BatchingGroupsock* fec,
+				   RTPSink* fec_sink, uint16_t seq) {
+	auto it = udp_groupsocks_.find(client_session_id);
+	if (it != udp_groupsocks_.end())
+		it->second->SetFecTarget(fec, config_.fec_percent, fec_sink->rtpPayloadType(),
+					 fec_sink->SSRC(), seq, fanout_.Stats());
+}
+
+void ObsVideoSubsession::DetachFec(unsigned client_session_id) {
+	auto it = udp_groupsocks_.find(client_session_id);
+	if (it != udp_groupsocks_.end())
+		it->second->SetFecTarget(nullptr, 0, 0, 0, 0, fanout_.Stats());
+}
+
+FramedSource* ObsVideoSubsession::createNewStreamSource(unsigned client_session_id,
+							 unsigned& est_bitrate) {
+	est_bitrate = 5000; // kbps, estimate
+
+	// the OBS packets are complete access units, split them into NAL units once
+	// in the fanout, no need to parse the bitstream again for every client
+	auto source = OBSFramedSource::createNew(envir(), fanout_, true);
+	new_source_ = source;
+	if (config_.hevc)
+		return H265VideoStreamDiscreteFramer::createNew(envir(), source);
+	return H264VideoStreamDiscreteFramer::createNew(envir(), source);
+}
+
+RTPSink* ObsVideoSubsession::createNewRTPSink(Groupsock* rtp_groupsock,
+					       unsigned char rtp_payload_type_if_dynamic,
+					       FramedSource* input_source) {
+	return CreateVideoRTPSink(envir(), rtp_groupsock, rtp_payload_type_if_dynamic, config_,
+				  fanout_.Stats(), new_source_);
+}
+
+Groupsock* ObsVideoSubsession::createGroupsock(struct sockaddr_storage const& address, Port port) {
+	// an IDR is hundreds of packets, a syscall for each one adds up on the server loop
+	auto groupsock = new BatchingGroupsock(envir(), address, port, 255);
+	// and a burst of them overflows the switch & receiver buffers
+	groupsock->SetPacing(config_.bitrate,
+			     (uint64_t)(config_.pacing * (double)config_.frame_interval_ns));
+	if (config_.retransmit_ms == 0)
+		return groupsock;
+
+	// the dummy groupsock of the SDP has port 0 and no RTCP groupsock
+	if (port.num() == 0)
+		return groupsock;
+
+	// live555 asks for the RTP groupsock, then for the RTCP groupsock on the next port.
+	// a port which fails to bind is skipped, so the RTP port isn't always even: go by
+	// the order of the calls instead.
+	if (new_rtp_groupsock_ == nullptr) {
+		// no RTCP groupsock follows a failed one, live555 tries the next port for RTP
+		if (groupsock->socketNum() < 0)
+			return groupsock;
+		groupsock->EnableRetransmission((uint64_t)config_.retransmit_ms * 1000000,
+						std::max(config_.bitrate, 1000u),
+						config_.rtx ? kRtxPayloadType : 0, config_.hevc,
+						fanout_.Stats());
+		new_rtp_groupsock_ = groupsock;
+	} else {
+		// on failure live555 drops both groupsocks and starts over with RTP
+		if (groupsock->socketNum() >= 0)
+			groupsock->SetFeedbackTarget(new_rtp_groupsock_);
+		new_rtp_groupsock_ = nullptr;
+	}
+	return groupsock;
+}
+
+// the source of the FEC track, the FEC packets come from the video groupsock
+class IdleSource : public FramedSource {
+public:
+	static IdleSource* createNew(UsageEnvironment& env) { return new IdleSource(env); }
+
+protected:
+	IdleSource(UsageEnvironment& env) : FramedSource(env) {}
+
+	virtual void doGetNextFrame() override {}
+};
+
+ObsFecSubsession::ObsFecSubsession(UsageEnvironment& env, ObsVideoSubsession& video,
+				   const VideoConfig& config)
+  : OnDemandServerMediaSubsession(env, False /* every client has its own source */),
+    video_(video),
+    config_(config),
+    sdp_lines_(nullptr) {}
+
+ObsFecSubsession::~ObsFecSubsession() {
+	delete[] sdp_lines_;
+}
+
+char const* ObsFecSubsession::sdpLines(int address_family) {
+	if (sdp_lines_ == nullptr)
+		sdp_lines_ = AddMid(OnDemandServerMediaSubsession::sdpLines(address_family), kFecMid);
+	return sdp_lines_;
+}
+
+void ObsFecSubsession::getStreamParameters(
+  unsigned client_session_id, struct sockaddr_storage const& client_address,
+  Port const& client_rtp_port, Port const& client_rtcp_port, int tcp_socket_num,
+  unsigned char rtp_channel_id, unsigned char rtcp_channel_id, TLSState* tls_state,
+  struct sockaddr_storage& destination_address, u_int8_t& destination_ttl,
+  Boolean& is_multicast, Port& server_rtp_port, Port& server_rtcp_port, void*& stream_token) {
+	OnDemandServerMediaSubsession::getStreamParameters(
+	  client_session_id, client_address, client_rtp_port, client_rtcp_port, tcp_socket_num,
+	  rtp_channel_id, rtcp_channel_id, tls_state, destination_address, destination_ttl,
+	  is_multicast, server_rtp_port, server_rtcp_port, stream_token);
+	// over TCP the sink would have to send the packets, it never does
+	if (stream_token != nullptr && tcp_socket_num < 0)
+		udp_clients_.insert(client_session_id);
+}
+
+void ObsFecSubsession::startStream(
+  unsigned client_session_id, void* stream_token, TaskFunc* rtcp_rr_handler,
+  void* rtcp_rr_handler_client_data, unsigned short& rtp_seq_num, unsigned& rtp_timestamp,
+  ServerRequestAlternativeByteHandler* alternative_byte_handler,
+  void* alternative_byte_handler_client_data) {
+	OnDemandServerMediaSubsession::startStream(
+	  client_session_id, stream_token, rtcp_rr_handler, rtcp_rr_handler_client_data,
+	  rtp_seq_num, rtp_timestamp, alternative_byte_handler,
+	  alternative_byte_handler_client_data);
+	// the destination of the groupsock is the client's FEC port from now on, the FEC
+	// packets continue the sequence numbers of the RTP-Info
+	auto state = static_cast<StreamState*>(stream_token);
+	if (state == nullptr || udp_clients_.count(client_session_id) == 0)
+		return;
+	RTPSink* sink = state->rtpSink();
+	video_.AttachFec(client_session_id,
+			 static_cast<BatchingGroupsock*>(&sink->groupsockBeingUsed()), sink,
+			 rtp_seq_num);
+}
+
+void ObsFecSubsession::pauseStream(unsigned client_session_id, void* stream_token) {
+	video_.DetachFec(client_session_id);
+	OnDemandServerMediaSubsession::pauseStream(client_session_id, stream_token);
+}
+
+void ObsFecSubsession::deleteStream(unsigned client_session_id, void*& stream_token) {
+	// before the groupsock is closed with the stream
+	video_.DetachFec(client_session_id);
+	udp_clients_.erase(client_session_id);
+	OnDemandServerMediaSubsession::deleteStream(client_session_id, stream_token);
+}
+
+FramedSource* ObsFecSubsession::createNewStreamSource(unsigned client_session_id,
+						      unsigned& est_bitrate) {
+	est_bitrate = std::max(config_.bitrate * config_.fec_percent / 100, 1u); // kbps
+	return IdleSource::createNew(envir());
+}
+
+RTPSink* ObsFecSubsession::createNewRTPSink(Groupsock* rtp_groupsock,
+					    unsigned char rtp_payload_type_if_dynamic,
+					    FramedSource* input_source) {
+	RtpBufferGuard guard(0);
+	return SimpleRTPSink::createNew(envir(), rtp_groupsock, rtp_payload_type_if_dynamic,
+					90000, "application", "ulpfec");
+}
+
+Groupsock* ObsFecSubsession::createGroupsock(struct sockaddr_storage const& address, Port port) {
+	auto groupsock = new BatchingGroupsock(envir(), address, port, 255);
+	groupsock->SetPacing(std::max(config_.bitrate * config_.fec_percent / 100, 1u),
+			     (uint64_t)(config_.pacing * (double)config_.frame_interval_ns));
+	return groupsock;
+}
+
+ObsAudioSubsession::ObsAudioSubsession(UsageEnvironment& env, FrameFanout& fanout,
+				       const AudioConfig& config, const PlayCallback& on_play)
+  : OnDemandServerMediaSubsession(env, False /* every client has its own source */),
+    fanout_(fanout),
+    config_(config),
+    sdp_lines_(nullptr),
+    new_source_(nullptr),
+    tracker_(env, fanout.Stats(), true),
+    on_play_(on_play) {}
+
+ObsAudioSubsession::~ObsAudioSubsession() {
+	if (!playing_.empty() && on_play_)
+		on_play_(-(int)playing_.size());
+	delete[] sdp_lines_;
+}
+
+char const* ObsAudioSubsession::sdpLines(int address_family) {
+	if (sdp_lines_ == nullptr)
+		sdp_lines_ = AddMid(OnDemandServerMediaSubsession::sdpLines(address_family), kAudioMid);
+	return sdp_lines_;
+}
+
+void ObsAudioSubsession::getStreamParameters(
+  unsigned client_session_id, struct sockaddr_storage const& client_address,
+  Port const& client_rtp_port, Port const& client_rtcp_port, int tcp_socket_num,
+  unsigned char rtp_channel_id, unsigned char rtcp_channel_id, TLSState* tls_state,
+  struct sockaddr_storage& destination_address, u_int8_t& destination_ttl,
+  Boolean& is_multicast, Port& server_rtp_port, Port& server_rtcp_port, void*& stream_token) {
+	new_source_ = nullptr;
+	OnDemandServerMediaSubsession::getStreamParameters(
+	  client_session_id, client_address, client_rtp_port, client_rtcp_port, tcp_socket_num,
+	  rtp_channel_id, rtcp_channel_id, tls_state, destination_address, destination_ttl,
+	  is_multicast, server_rtp_port, server_rtcp_port, stream_token);
+	SetupClientSource(new_source_, client_address, tcp_socket_num);
+	auto state = static_cast<StreamState*>(stream_token);
+	if (state != nullptr)
+		tracker_.Add(client_session_id, client_address, tcp_socket_num >= 0, state->rtpSink(),
+			     new_source_, nullptr);
+	new_source_ = nullptr;
+}
+
+void ObsAudioSubsession::startStream(
+  unsigned client_session_id, void* stream_token, TaskFunc* rtcp_rr_handler,
+  void* rtcp_rr_handler_client_data, unsigned short& rtp_seq_num, unsigned& rtp_timestamp,
+  ServerRequestAlternativeByteHandler* alternative_byte_handler,
+  void* alternative_byte_handler_client_data) {
+	OnDemandServerMediaSubsession::startStream(
+	  client_session_id, stream_token, rtcp_rr_handler, rtcp_rr_handler_client_data,
+	  rtp_seq_num, rtp_timestamp, alternative_byte_handler,
+	  alternative_byte_handler_client_data);
+	SetPlaying(playing_, on_play_, client_session_id, true);
+}
+
+void ObsAudioSubsession::pauseStream(unsigned client_session_id, void* stream_token) {
+	SetPlaying(playing_, on_play_, client_session_id, false);
+	OnDemandServerMediaSubsession::pauseStream(client_session_id, stream_token);
+}
+
+void ObsAudioSubsession::deleteStream(unsigned client_session_id, void*& stream_token) {
+	// the sink is closed with the stream
+	tracker_.Remove(client_session_id);
+	SetPlaying(playing_, on_play_, client_session_id, false);
+	OnDemandServerMediaSubsession::deleteStream(client_session_id, stream_token);
+}
+
+FramedSource* ObsAudioSubsession::createNewStreamSource(unsigned client_session_id,
+							unsigned& est_bitrate) {
+	est_bitrate = 160; // kbps, estimate
+
+	// every OBS audio packet is one raw AAC frame, which is what the sink expects
+	new_source_ = OBSFramedSource::createNew(envir(), fanout_, false);
+	return new_source_;
+}
+
+RTPSink* ObsAudioSubsession::createNewRTPSink(Groupsock* rtp_groupsock,
+					      unsigned char rtp_payload_type_if_dynamic,
+					      FramedSource* input_source) {
+	RtpBufferGuard guard(0);
+	return MPEG4GenericRTPSink::createNew(envir(), rtp_groupsock, rtp_payload_type_if_dynamic,
+					      config_.sample_rate, "audio", "AAC-hbr",
+					      config_.config.c_str(), config_.channels);
+}
+} // namespace output::source
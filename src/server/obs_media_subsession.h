@@ -0,0 +1,219 @@
+#pragma once
+
+#include "liveMedia.hh"
+#include "client_tracker.h"
+#include "rtsp_server.h"
+
+#include <functional>
+#include <map>
+#include <set>
+
+namespace output {
+class BatchingGroupsock;
+class FrameFanout;
+} // namespace output
+
+namespace output::source {
+class OBSFramedSource;
+
+// H264 or H265 RTP sink, it gets the parameter sets of `config` for the SDP.
+// the sink buffer is sized after the bitrate and the largest frame in `stats`, and grows
+// for the bigger NAL units of `source`
+RTPSink* CreateVideoRTPSink(UsageEnvironment& env, Groupsock* rtp_groupsock,
+			    unsigned char rtp_payload_type, const VideoConfig& config,
+			    const ServerStats& stats, OBSFramedSource* source);
+
+// server loop, a client started(+1) or stopped(-1) playing a track of the mount
+typedef std::function<void(int)> PlayCallback;
+
+// the "a=mid"(RFC 5888) of the unicast tracks, the "a=group:FEC"(RFC 5956) line of the
+// session pairs the FEC track with the video it protects
+inline constexpr char kVideoMid[] = "video";
+inline constexpr char kAudioMid[] = "audio";
+inline constexpr char kFecMid[] = "fec";
+
+/// <summary>
+/// Unicast H264/H265 video subsession, every client gets its own source & RTP sink
+/// which read the shared frames from the `FrameFanout`
+/// </summary>
+class ObsVideoSubsession : public OnDemandServerMediaSubsession {
+public:
+	static ObsVideoSubsession* createNew(UsageEnvironment& env, FrameFanout& fanout,
+					     const VideoConfig& config,
+					     const PlayCallback& on_play = nullptr) {
+		return new ObsVideoSubsession(env, fanout, config, on_play);
+	}
+
+	// the FEC of the client's video stream goes out through `fec`, the RTP groupsock of
+	// its FEC session, with the payload type & SSRC of `fec_sink` and the sequence numbers
+	// from `seq` on. a client which doesn't get the video over UDP gets no FEC
+	void AttachFec(unsigned client_session_id, BatchingGroupsock* fec, RTPSink* fec_sink,
+		       uint16_t seq);
+	void DetachFec(unsigned client_session_id);
+
+protected:
+	ObsVideoSubsession(UsageEnvironment& env, FrameFanout& fanout, const VideoConfig& config,
+			   const PlayCallback& on_play);
+	virtual ~ObsVideoSubsession();
+
+	// announces the "a=mid", the NACK feedback & the RTX payload type on top of the
+	// usual lines
+	virtual char const* sdpLines(int address_family) override;
+	virtual char const* getAuxSDPLine(RTPSink* rtp_sink, FramedSource* input_source) override;
+	virtual void getStreamParameters(unsigned client_session_id,
+					 struct sockaddr_storage const& client_address,
+					 Port const& client_rtp_port, Port const& client_rtcp_port,
+					 int tcp_socket_num, unsigned char rtp_channel_id,
+					 unsigned char rtcp_channel_id, TLSState* tls_state,
+					 struct sockaddr_storage& destination_address,
+					 u_int8_t& destination_ttl, Boolean& is_multicast,
+					 Port& server_rtp_port, Port& server_rtcp_port,
+					 void*& stream_token) override;
+	virtual void startStream(unsigned client_session_id, void* stream_token,
+				 TaskFunc* rtcp_rr_handler, void* rtcp_rr_handler_client_data,
+				 unsigned short& rtp_seq_num, unsigned& rtp_timestamp,
+				 ServerRequestAlternativeByteHandler* alternative_byte_handler,
+				 void* alternative_byte_handler_client_data) override;
+	virtual void pauseStream(unsigned client_session_id, void* stream_token) override;
+	virtual void deleteStream(unsigned client_session_id, void*& stream_token) override;
+	virtual FramedSource* createNewStreamSource(unsigned client_session_id,
+						    unsigned& est_bitrate) override;
+	virtual RTPSink* createNewRTPSink(Groupsock* rtp_groupsock,
+					  unsigned char rtp_payload_type_if_dynamic,
+					  FramedSource* input_source) override;
+	// the packets of a frame are sent in batches
+	virtual Groupsock* createGroupsock(struct sockaddr_storage const& address, Port port) override;
+
+private:
+	FrameFanout& fanout_;
+	VideoConfig config_;
+	char* sdp_lines_;
+	// the RTP groupsock created last while its RTCP groupsock is next, otherwise null
+	BatchingGroupsock* new_rtp_groupsock_;
+	// the source created by the `getStreamParameters` in progress
+	OBSFramedSource* new_source_;
+	ClientTracker tracker_;
+	// the client sessions which are playing the track
+	PlayCallback on_play_;
+	std::set<unsigned> playing_;
+	// the RTP groupsocks of the client sessions which get the video over UDP
+	std::map<unsigned, BatchingGroupsock*> udp_groupsocks_;
+
+	// the SDP needs the SPS/PPS, read the stream with a dummy sink until the framer has them
+	char* aux_sdp_line_;
+	char done_flag_;
+	RTPSink* dummy_sink_;
+
+	static void AfterPlayingDummy(void* data);
+	static void CheckForAuxSDPLine(void* data);
+	void CheckForAuxSDPLine1();
+};
+
+/// <summary>
+/// The FEC(RFC 5109) of the video as a track of its own, "m=application" with the
+/// "ulpfec" payload format. The FEC packets never share the RTP session of the video,
+/// whose sequence numbers stay gap free, and only the clients which set up the track get
+/// them. Its RTP sink never sends, the video groupsock of the client sends the FEC
+/// packets through the groupsock of the track. UDP only, like the video it protects.
+/// </summary>
+class ObsFecSubsession : public OnDemandServerMediaSubsession {
+public:
+	static ObsFecSubsession* createNew(UsageEnvironment& env, ObsVideoSubsession& video,
+					   const VideoConfig& config) {
+		return new ObsFecSubsession(env, video, config);
+	}
+
+protected:
+	ObsFecSubsession(UsageEnvironment& env, ObsVideoSubsession& video,
+			 const VideoConfig& config);
+	virtual ~ObsFecSubsession();
+
+	// the usual lines & the "a=mid" the FEC group refers to
+	virtual char const* sdpLines(int address_family) override;
+
+	virtual void getStreamParameters(unsigned client_session_id,
+					 struct sockaddr_storage const& client_address,
+					 Port const& client_rtp_port, Port const& client_rtcp_port,
+					 int tcp_socket_num, unsigned char rtp_channel_id,
+					 unsigned char rtcp_channel_id, TLSState* tls_state,
+					 struct sockaddr_storage& destination_address,
+					 u_int8_t& destination_ttl, Boolean& is_multicast,
+					 Port& server_rtp_port, Port& server_rtcp_port,
+					 void*& stream_token) override;
+	virtual void startStream(unsigned client_session_id, void* stream_token,
+				 TaskFunc* rtcp_rr_handler, void* rtcp_rr_handler_client_data,
+				 unsigned short& rtp_seq_num, unsigned& rtp_timestamp,
+				 ServerRequestAlternativeByteHandler* alternative_byte_handler,
+				 void* alternative_byte_handler_client_data) override;
+	virtual void pauseStream(unsigned client_session_id, void* stream_token) override;
+	virtual void deleteStream(unsigned client_session_id, void*& stream_token) override;
+	virtual FramedSource* createNewStreamSource(unsigned client_session_id,
+						    unsigned& est_bitrate) override;
+	virtual RTPSink* createNewRTPSink(Groupsock* rtp_groupsock,
+					  unsigned char rtp_payload_type_if_dynamic,
+					  FramedSource* input_source) override;
+	// the FEC packets are paced & batched like the video
+	virtual Groupsock* createGroupsock(struct sockaddr_storage const& address, Port port) override;
+
+private:
+	ObsVideoSubsession& video_;
+	VideoConfig config_;
+	char* sdp_lines_;
+	// the client sessions which set up the track over UDP
+	std::set<unsigned> udp_clients_;
+};
+
+/// <summary>
+/// Unicast AAC subsession, the OBS audio packets are raw AAC frames and the
+/// AudioSpecificConfig comes from the encoder, so the SDP is known up front
+/// </summary>
+class ObsAudioSubsession : public OnDemandServerMediaSubsession {
+public:
+	static ObsAudioSubsession* createNew(UsageEnvironment& env, FrameFanout& fanout,
+					     const AudioConfig& config,
+					     const PlayCallback& on_play = nullptr) {
+		return new ObsAudioSubsession(env, fanout, config, on_play);
+	}
+
+protected:
+	ObsAudioSubsession(UsageEnvironment& env, FrameFanout& fanout, const AudioConfig& config,
+			   const PlayCallback& on_play);
+	virtual ~ObsAudioSubsession();
+
+	// the usual lines & the "a=mid"
+	virtual char const* sdpLines(int address_family) override;
+
+	virtual void getStreamParameters(unsigned client_session_id,
+					 struct sockaddr_storage const& client_address,
+					 Port const& client_rtp_port, Port const& client_rtcp_port,
+					 int tcp_socket_num, unsigned char rtp_channel_id,
+					 unsigned char rtcp_channel_id, TLSState* tls_state,
+					 struct sockaddr_storage& destination_address,
+					 u_int8_t& destination_ttl, Boolean& is_multicast,
+					 Port& server_rtp_port, Port& server_rtcp_port,
+					 void*& stream_token) override;
+	virtual void startStream(unsigned client_session_id, void* stream_token,
+				 TaskFunc* rtcp_rr_handler, void* rtcp_rr_handler_client_data,
+				 unsigned short& rtp_seq_num, unsigned& rtp_timestamp,
+				 ServerRequestAlternativeByteHandler* alternative_byte_handler,
+				 void* alternative_byte_handler_client_data) override;
+	virtual void pauseStream(unsigned client_session_id, void* stream_token) override;
+	virtual void deleteStream(unsigned client_session_id, void*& stream_token) override;
+	virtual FramedSource* createNewStreamSource(unsigned client_session_id,
+						    unsigned& est_bitrate) override;
+	virtual RTPSink* createNewRTPSink(Groupsock* rtp_groupsock,
+					  unsigned char rtp_payload_type_if_dynamic,
+					  FramedSource* input_source) override;
+
+private:
+	FrameFanout& fanout_;
+	AudioConfig config_;
+	char* sdp_lines_;
+	// the source created by the `getStreamParameters` in progress
+	OBSFramedSource* new_source_;
+	ClientTracker tracker_;
+	// the client sessions which are playing the track
+	PlayCallback on_play_;
+	std::set<unsigned> playing_;
+};
+} // namespace output::source
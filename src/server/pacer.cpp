@@ -0,0 +1,67 @@
+#include "pacer.h"
+
+#include <algorithm>
+
+namespace output {
+// the burst the bucket allows, at the bitrate of the encoder
+static const double kBucketDuration = 0.005; // 5 ms
+
+Pacer::Pacer()
+  : spread_ns_(0),
+    min_rate_(0),
+    rate_(0),
+    bucket_(0),
+    tokens_(0),
+    refill_ns_(0),
+    queued_bytes_(0) {}
+
+void Pacer::Configure(unsigned bitrate, uint64_t spread_ns, unsigned max_packet,
+		      uint64_t now_ns) {
+	spread_ns_ = spread_ns;
+	min_rate_ = bitrate * 1000.0 / 8.0;
+	rate_ = min_rate_;
+	// the bucket has to hold the largest packet, or it would never send it
+	bucket_ = std::max(min_rate_ * kBucketDuration, 2.0 * max_packet);
+	tokens_ = bucket_;
+	refill_ns_ = now_ns;
+	queued_bytes_ = 0;
+}
+
+void Pacer::Refill(uint64_t now_ns) {
+	if (now_ns <= refill_ns_)
+		return;
+	tokens_ = std::min(bucket_, tokens_ + (now_ns - refill_ns_) * rate_ / 1e9);
+	refill_ns_ = now_ns;
+}
+
+void Pacer::Enqueue(unsigned size, uint64_t now_ns) {
+	queued_bytes_ += size;
+	if (spread_ns_ == 0)
+		return;
+	// the tokens until now come at the old rate, the queued frames have to be out within
+	// the spread
+	Refill(now_ns);
+	rate_ = std::max(min_rate_, queued_bytes_ * 1e9 / (double)spread_ns_);
+}
+
+double Pacer::TokensAvailable(uint64_t now_ns) {
+	Refill(now_ns);
+	return tokens_;
+}
+
+bool Pacer::Take(unsigned size, uint64_t now_ns) {
+	if (TokensAvailable(now_ns) < size)
+		return false;
+	tokens_ -= size;
+	queued_bytes_ -= std::min<uint64_t>(queued_bytes_, size);
+	return true;
+}
+
+uint64_t Pacer::NextSendNs(unsigned size, uint64_t now_ns) {
+	double missing = size - TokensAvailable(now_ns);
+	if (missing <= 0)
+		return now_ns;
+	// rounded up, the tokens are there by then
+	return now_ns + (uint64_t)(missing * 1e9 / rate_) + 1;
+}
+} // namespace output
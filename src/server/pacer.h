@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace output {
+/// <summary>
+/// Token bucket which spreads the packets of a frame over a part of the frame interval.
+/// The rate follows the queued bytes, so whatever is queued leaves within the spread,
+/// but never drops below the bitrate of the encoder, which also sizes the bucket.
+/// It only does the accounting, the caller queues the packets and sends them.
+/// </summary>
+class Pacer {
+public:
+	Pacer();
+
+	// spread the queued packets over `spread_ns`, never slower than `bitrate`(kbps).
+	// `max_packet` bytes always fit into the bucket. 0 `spread_ns` disables the pacing
+	void Configure(unsigned bitrate, uint64_t spread_ns, unsigned max_packet, uint64_t now_ns);
+	bool Enabled() const { return spread_ns_ > 0; }
+
+	// a packet of `size` bytes was queued
+	void Enqueue(unsigned size, uint64_t now_ns);
+	// the bytes the bucket has for sending at `now_ns`
+	double TokensAvailable(uint64_t now_ns);
+	// takes the tokens of a packet of `size` bytes if the bucket has them
+	bool Take(unsigned size, uint64_t now_ns);
+	// when the bucket has the tokens for a packet of `size` bytes, `now_ns` if it has them
+	// already
+	uint64_t NextSendNs(unsigned size, uint64_t now_ns);
+	// the queued packets were sent without the bucket
+	void Clear() { queued_bytes_ = 0; }
+
+	uint64_t QueuedBytes() const { return queued_bytes_; }
+
+private:
+	// in bytes & bytes per second
+	uint64_t spread_ns_;
+	double min_rate_;
+	double rate_;
+	double bucket_;
+	double tokens_;
+	uint64_t refill_ns_;
+	uint64_t queued_bytes_;
+
+	void Refill(uint64_t now_ns);
+};
+} // namespace output
@@ -0,0 +1,79 @@
+#include "retransmission_cache.h"
+
+namespace output {
+// a typical video RTP packet, the ring has room for twice the history at the bitrate
+static const unsigned kTypicalPacketSize = 1200;
+// a power of two which divides the 16 bit sequence space
+static const size_t kMinEntries = 256;
+static const size_t kMaxEntries = 16384;
+static const unsigned kRtpHeaderSize = 12;
+// RTPFB, and its generic NACK format
+static const unsigned char kRtcpRtpFeedback = 205;
+static const unsigned char kGenericNack = 1;
+
+void RetransmissionCache::ParseNacks(const unsigned char* packet, unsigned size,
+				     std::vector<Nack>& nacks) {
+	nacks.clear();
+	while (size >= 4) {
+		unsigned length = (((unsigned)packet[2] << 8 | packet[3]) + 1) * 4;
+		if (length > size)
+			break;
+		// header, sender SSRC, media SSRC, then a PID & BLP pair for every FCI
+		if (packet[1] == kRtcpRtpFeedback && (packet[0] & 0x1F) == kGenericNack &&
+		    length >= 16) {
+			u_int32_t ssrc = ((u_int32_t)packet[8] << 24) | ((u_int32_t)packet[9] << 16) |
+					 ((u_int32_t)packet[10] << 8) | packet[11];
+			for (unsigned i = 12; i + 4 <= length; i += 4) {
+				uint16_t pid = (uint16_t)(packet[i] << 8 | packet[i + 1]);
+				uint16_t blp = (uint16_t)(packet[i + 2] << 8 | packet[i + 3]);
+				nacks.push_back({ssrc, pid});
+				for (int bit = 0; bit < 16; ++bit) {
+					if (blp & (1 << bit))
+						nacks.push_back({ssrc, (uint16_t)(pid + bit + 1)});
+				}
+			}
+		}
+		packet += length;
+		size -= length;
+	}
+}
+
+RetransmissionCache::RetransmissionCache(uint64_t history_ns, unsigned bitrate)
+  : history_ns_(history_ns) {
+	double packets = bitrate * 1000.0 / 8.0 / kTypicalPacketSize * (history_ns / 1e9) * 2.0;
+	size_t size = kMinEntries;
+	while (size < packets && size < kMaxEntries) { size *= 2; }
+	entries_.resize(size);
+	mask_ = size - 1;
+}
+
+void RetransmissionCache::Store(struct sockaddr_storage const& address, u_int8_t ttl,
+				const unsigned char* packet, unsigned size, bool keyframe,
+				uint64_t now_ns) {
+	if (size < kRtpHeaderSize)
+		return;
+	uint16_t seq = (uint16_t)((packet[2] << 8) | packet[3]);
+	Entry& entry = entries_[seq & mask_];
+	entry.valid = true;
+	entry.seq = seq;
+	entry.ssrc = ((u_int32_t)packet[8] << 24) | ((u_int32_t)packet[9] << 16) |
+		     ((u_int32_t)packet[10] << 8) | packet[11];
+	entry.sent_ns = now_ns;
+	entry.resends = 0;
+	entry.keyframe = keyframe;
+	entry.nacked = false;
+	entry.address = address;
+	entry.ttl = ttl;
+	// keeps the capacity, no allocation once the ring went around
+	entry.data.assign(packet, packet + size);
+}
+
+RetransmissionCache::Entry* RetransmissionCache::Find(u_int32_t ssrc, uint16_t seq,
+						      uint64_t now_ns) {
+	Entry& entry = entries_[seq & mask_];
+	if (!entry.valid || entry.seq != seq || entry.ssrc != ssrc ||
+	    now_ns - entry.sent_ns > history_ns_)
+		return nullptr;
+	return &entry;
+}
+} // namespace output
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <vector>
+
+namespace output {
+/// <summary>
+/// The RTP packets sent to one client over the last few hundred ms, indexed by their
+/// sequence number, so the packets a receiver NACKs can be sent again. A ring of
+/// `2^n` entries, the buffers of an entry are reused for the packet which replaces it.
+/// </summary>
+class RetransmissionCache {
+public:
+	struct Entry {
+		bool valid = false;
+		uint16_t seq = 0;
+		u_int32_t ssrc = 0;
+		uint64_t sent_ns = 0;
+		unsigned resends = 0;
+		// a packet of a keyframe or its parameter sets, and whether a NACK asked for it
+		bool keyframe = false;
+		bool nacked = false;
+		struct sockaddr_storage address = {};
+		u_int8_t ttl = 0;
+		std::vector<unsigned char> data;
+	};
+
+	// a packet a generic NACK asks for
+	struct Nack {
+		u_int32_t ssrc;
+		uint16_t seq;
+	};
+
+	// the packets the generic NACKs(RFC 4585) of an RTCP compound packet ask for
+	static void ParseNacks(const unsigned char* packet, unsigned size, std::vector<Nack>& nacks);
+
+	// `history_ns`: how long a packet can be asked for, `bitrate`(kbps) sizes the ring
+	RetransmissionCache(uint64_t history_ns, unsigned bitrate);
+	RetransmissionCache(const RetransmissionCache&) = delete;
+
+	// an RTP packet was sent to `address`
+	void Store(struct sockaddr_storage const& address, u_int8_t ttl,
+		   const unsigned char* packet, unsigned size, bool keyframe, uint64_t now_ns);
+	// the packet `seq` of the stream `ssrc`, null if it's gone or older than the history
+	Entry* Find(u_int32_t ssrc, uint16_t seq, uint64_t now_ns);
+
+private:
+	uint64_t history_ns_;
+	std::vector<Entry> entries_;
+	size_t mask_;
+};
+} // namespace output
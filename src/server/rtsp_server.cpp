@@ -1,4 +1,14 @@
 #include "rtsp_server.h"
+#include "bitrate_controller.h"
+#include "client_tracker.h"
+#include "obs_framed_source.h"
+#include "obs_media_subsession.h"
+#include "server_host.h"
+#include "server_shard.h"
+#include "stream_clock.h"
+#include "video_rtp_sink.h"
+#include "src/utils/h264/h264_common.h"
+#include "src/utils/h265/h265_common.h"
 
 #include "liveMedia.hh"
 #include "environment.h"
@@ -6,91 +16,30 @@
 #include "GroupsockHelper.hh"
 
 #include <obs.h>
+#include <util/platform.h>
 #include <util/threading.h>
 
+#include <algorithm>
+#include <cstring>
 #include <string>
 
 namespace output::source {
-// Custom FramedSource subclass for OBS integration
-class OBSFramedSource : public FramedSource {
-public:
-	static OBSFramedSource* createNew(UsageEnvironment& env) {
-		return new OBSFramedSource(env);
-	}
-
-	void Feed(struct encoder_packet* packet) {
-		if (encoded_data_ != nullptr) {
-			delete[] encoded_data_;
-			encoded_data_ = nullptr;
-		}
-
-		encoded_data_ = new unsigned char[packet->size];
-		memcpy(encoded_data_, packet->data, packet->size);
-		encoded_data_size_ = (unsigned int)packet->size;
-
-		DeliverFrame();
-	}
-
-private:
-	OBSFramedSource(UsageEnvironment& env)
-	  : FramedSource(env),
-	    encoded_data_(nullptr),
-	    encoded_data_size_(0) {}
-
-	virtual ~OBSFramedSource() { delete[] encoded_data_; }
-
-	void DeliverFrame() {
-		if (encoded_data_ != nullptr) {
-			if (!isCurrentlyAwaitingData())
-				return;
-
-			// Set the 'presentation time':
-			struct timeval presentation_time;
-			gettimeofday(&presentation_time, nullptr);
-
-			// Deliver a data frame:
-			if (encoded_data_size_ > fMaxSize) {
-				fFrameSize = fMaxSize;
-				fNumTruncatedBytes = encoded_data_size_ - fMaxSize;
-			} else {
-				fFrameSize = encoded_data_size_;
-			}
-
-			memmove(fTo, encoded_data_, fFrameSize);
-
-			fDurationInMicroseconds = 0;
-			fPresentationTime = presentation_time;
-			fNumTruncatedBytes = 0;
-
-			delete[] encoded_data_;
-			encoded_data_ = nullptr;
-
-			// Tell the reader that the data is now available:
-			FramedSource::afterGetting(this);
-		}
-	}
-
-protected:
-	virtual void doGetNextFrame() { DeliverFrame(); }
-
-private:
-	// OBS encoded video data buffer
-	unsigned char* encoded_data_;
-	unsigned int encoded_data_size_;
-};
-
 /// <summary>
-/// Customized video source from OBS output
+/// Streams one track of the OBS output to a SSM multicast group
 /// </summary>
-class RtspVideoSource {
+class RtspMulticastSource {
 public:
-	RtspVideoSource(Environment& env, struct sockaddr_storage& dst_address)
-	  : source_(nullptr),
+	RtspMulticastSource(Environment& env, FrameFanout& fanout,
+			    struct sockaddr_storage& dst_address, unsigned short rtp_port_num,
+			    unsigned estimated_bandwidth, bool audio)
+	  : fanout_(fanout),
+	    estimated_bandwidth_(estimated_bandwidth),
+	    source_(nullptr),
 	    sink_(nullptr),
 	    rtcp_(nullptr),
-	    obs_source_(nullptr) {
+	    dst_address_(dst_address),
+	    tracker_(env, fanout.Stats(), audio) {
 		// Create 'groupsocks' for RTP and RTCP:
-		const unsigned short rtp_port_num = 18888;
 		const unsigned short rtcp_port_num = rtp_port_num + 1;
 		const unsigned char ttl = 255;
 		const Port rtp_port(rtp_port_num);
@@ -99,25 +48,9 @@ public:
 		rtp_groupsock_->multicastSendOnly();
 		rtcp_groupsock_ = new Groupsock(env, dst_address, rtcp_port, ttl);
 		rtcp_groupsock_->multicastSendOnly();
-
-		/* Increase the buffer size so we can handle high res streams.. */
-		OutPacketBuffer::maxSize = 300000;
-		// Create a 'H264 Video RTP' sink from the RTP 'groupsock':
-		sink_ = H264VideoRTPSink::createNew(env, rtp_groupsock_, 96);
-
-		// Create (and start) a 'RTCP instance' for this RTP sink:
-		const unsigned estimated_session_bandwidth = 500; // in kbps; for RTCP b/w share
-		const unsigned max_cname_len = 100;
-		unsigned char CNAME[max_cname_len + 1] = {0};
-		gethostname((char*)CNAME, max_cname_len);
-		CNAME[max_cname_len] = '\0'; // just in case
-
-		rtcp_ = RTCPInstance::createNew(env, rtcp_groupsock_, estimated_session_bandwidth,
-						CNAME, sink_, nullptr /* we're a server */, true);
-		// Note: This starts RTCP running automatically
 	}
 
-	~RtspVideoSource() {
+	virtual ~RtspMulticastSource() {
 		Stop();
 		delete rtp_groupsock_;
 		delete rtcp_groupsock_;
@@ -128,6 +61,22 @@ public:
 			blog(LOG_INFO, "already playing");
 			return false;
 		}
+		// the video sink grows its buffer for the NAL units of the source
+		source_ = CreateSource(env, fanout_);
+		sink_ = CreateSink(env, rtp_groupsock_, fanout_);
+		// the group counts as one client
+		tracker_.Add(0, dst_address_, false, sink_, nullptr, nullptr);
+
+		// Create (and start) a 'RTCP instance' for this RTP sink:
+		const unsigned max_cname_len = 100;
+		unsigned char CNAME[max_cname_len + 1] = {0};
+		gethostname((char*)CNAME, max_cname_len);
+		CNAME[max_cname_len] = '\0'; // just in case
+
+		rtcp_ = RTCPInstance::createNew(env, rtcp_groupsock_, estimated_bandwidth_, CNAME,
+						sink_, nullptr /* we're a server */, true);
+		// Note: This starts RTCP running automatically
+
 		// Add to the media session:
 		bool ret =
 		  sms->addSubsession(PassiveServerMediaSubsession::createNew(*sink_, rtcp_));
@@ -135,11 +84,12 @@ public:
 			blog(LOG_ERROR, "add to media session failed");
 			return false;
 		}
-		// Create a framer for the Video Elementary Stream:
-		obs_source_ = OBSFramedSource::createNew(env);
-		source_ = H264VideoStreamFramer::createNew(env, obs_source_);
 		// Start playing the sink:
-		ret = sink_->startPlaying(*source_, AfterPlaying, this);
+		{
+			// the fragmenter of the video sink is set up with the buffer size
+			RtpBufferGuard guard(0);
+			ret = sink_->startPlaying(*source_, AfterPlaying, this);
+		}
 		if (!ret) {
 			blog(LOG_ERROR, "start playing failed");
 		}
@@ -148,54 +98,141 @@ public:
 	}
 
 	void Stop() {
+		tracker_.Remove(0);
 		if (sink_ != nullptr)
 			sink_->stopPlaying();
-		if (source_ != nullptr)
+		if (source_ != nullptr) {
 			Medium::close(source_);
+			source_ = nullptr;
+		}
 	}
 
-	void Feed(struct encoder_packet* packet) { obs_source_->Feed(packet); }
-
 	static void AfterPlaying(void* data) {
-		auto source = static_cast<RtspVideoSource*>(data);
+		auto source = static_cast<RtspMulticastSource*>(data);
 		source->Stop();
 	}
 
+protected:
+	virtual RTPSink* CreateSink(Environment& env, Groupsock* rtp_groupsock,
+				    FrameFanout& fanout) = 0;
+	virtual FramedSource* CreateSource(Environment& env, FrameFanout& fanout) = 0;
+
 private:
-	H264VideoStreamFramer* source_;
+	FrameFanout& fanout_;
+	unsigned estimated_bandwidth_; // in kbps; for RTCP b/w share
+	FramedSource* source_;
 	RTPSink* sink_;
 	RTCPInstance* rtcp_;
-	OBSFramedSource* obs_source_;
 	Groupsock* rtp_groupsock_;
 	Groupsock* rtcp_groupsock_;
+	struct sockaddr_storage dst_address_;
+	ClientTracker tracker_;
 };
 
 /// <summary>
-/// Customized audio source from OBS output
+/// Customized video source from OBS output, streams to a SSM multicast group
 /// </summary>
-class RtspAudioSource : public FramedSource {
+class RtspVideoSource : public RtspMulticastSource {
 public:
-	static RtspAudioSource* createNew(UsageEnvironment& env) {
-		return new RtspAudioSource(env);
+	RtspVideoSource(Environment& env, FrameFanout& fanout, struct sockaddr_storage& dst_address,
+			const VideoConfig& config)
+	  : RtspMulticastSource(env, fanout, dst_address, 18888, 500, false),
+	    config_(config),
+	    obs_source_(nullptr) {}
+
+protected:
+	virtual RTPSink* CreateSink(Environment& env, Groupsock* rtp_groupsock,
+				    FrameFanout& fanout) override {
+		// Create a 'H264/H265 Video RTP' sink from the RTP 'groupsock':
+		return CreateVideoRTPSink(env, rtp_groupsock, 96, config_, fanout.Stats(),
+					  obs_source_);
 	}
-	virtual ~RtspAudioSource() {}
 
-	virtual void doGetNextFrame() override {}
+	virtual FramedSource* CreateSource(Environment& env, FrameFanout& fanout) override {
+		// OBS hands over complete access units which the fanout already split into
+		// NAL units, the discrete framer takes them as they are instead of scanning
+		// the whole bitstream for start codes again
+		obs_source_ = OBSFramedSource::createNew(env, fanout, true);
+		if (config_.hevc)
+			return H265VideoStreamDiscreteFramer::createNew(env, obs_source_);
+		return H264VideoStreamDiscreteFramer::createNew(env, obs_source_);
+	}
+
+private:
+	VideoConfig config_;
+	// the source inside the framer, created before the sink
+	OBSFramedSource* obs_source_;
+};
+
+/// <summary>
+/// Customized AAC audio source from OBS output, streams to a SSM multicast group
+/// </summary>
+class RtspAudioSource : public RtspMulticastSource {
+public:
+	RtspAudioSource(Environment& env, FrameFanout& fanout, struct sockaddr_storage& dst_address,
+			const AudioConfig& config)
+	  : RtspMulticastSource(env, fanout, dst_address, 18890, 160, true),
+	    config_(config) {}
 
 protected:
-	RtspAudioSource(UsageEnvironment& env) : FramedSource(env) {}
+	virtual RTPSink* CreateSink(Environment& env, Groupsock* rtp_groupsock,
+				    FrameFanout&) override {
+		RtpBufferGuard guard(0);
+		return MPEG4GenericRTPSink::createNew(env, rtp_groupsock, 97, config_.sample_rate,
+						      "audio", "AAC-hbr", config_.config.c_str(),
+						      config_.channels);
+	}
+
+	virtual FramedSource* CreateSource(Environment& env, FrameFanout& fanout) override {
+		// every OBS audio packet is one raw AAC frame, which is what the sink expects
+		return OBSFramedSource::createNew(env, fanout, false);
+	}
+
+private:
+	AudioConfig config_;
 };
 } // namespace output::source
 
 namespace output {
-RtspServer::RtspServer(uint16_t port)
-  : server_(nullptr),
-    env_(nullptr),
-    port_(port),
+// the trackers publish the receiver reports every second
+static const uint64_t kBitrateUpdateInterval = 1000000000ULL; // 1 s
+
+RtspServer::RtspServer(uint16_t port, bool multicast, unsigned threads, unsigned pacing,
+		       const std::string& mount)
+  : port_(port),
+    multicast_(multicast),
+    threads_(threads),
+    pacing_(std::min(pacing, 100u)),
+    mount_(mount),
+    connect_time_ms_(0),
+    host_(nullptr),
+    mounted_(false),
+    playing_(0),
+    clock_(nullptr),
+    video_builder_(nullptr),
+    audio_builder_(nullptr),
+    video_encoder_(nullptr),
+    audio_encoder_(nullptr),
+    adapt_bitrate_(false),
+    min_bitrate_(0),
+    max_bitrate_(0),
+    retransmit_ms_(0),
+    rtx_(false),
+    fec_percent_(0),
+    bitrate_controller_(nullptr),
+    configured_bitrate_(0),
+    next_bitrate_update_ns_(0),
     audio_source_(nullptr),
     video_source_(nullptr) {
-	if (port == 0) {
-		port = 8554;
+	if (port_ == 0) {
+		port_ = 8554;
+	}
+	if (mount_.empty()) {
+		mount_ = "obs_live";
+	}
+	if (threads_ == 0) {
+		// leave some cores to OBS itself
+		threads_ = std::max(1u, std::min(4u, std::thread::hardware_concurrency() / 2));
 	}
 }
 
@@ -203,111 +240,433 @@ RtspServer::~RtspServer() {
 	Stop();
 }
 
-bool RtspServer::Start() {
-	if (server_ != nullptr) {
+void RtspServer::SetVideoEncoder(obs_encoder_t* encoder) {
+	video_encoder_ = encoder;
+}
+
+void RtspServer::SetAudioEncoder(obs_encoder_t* encoder) {
+	audio_encoder_ = encoder;
+}
+
+void RtspServer::SetBitrateAdaptation(unsigned min_kbps, unsigned max_kbps,
+				      const std::string& primary) {
+	adapt_bitrate_ = true;
+	min_bitrate_ = min_kbps;
+	max_bitrate_ = max_kbps;
+	primary_client_ = primary;
+}
+
+void RtspServer::SetRetransmission(unsigned history_ms, bool rtx) {
+	retransmit_ms_ = history_ms;
+	rtx_ = rtx;
+}
+
+void RtspServer::GetVideoConfig(VideoConfig& config) {
+	config = VideoConfig();
+	if (video_encoder_ == nullptr)
+		return;
+
+	const char* codec = obs_encoder_get_codec(video_encoder_);
+	config.hevc = codec != nullptr && strcmp(codec, "hevc") == 0;
+
+	obs_data_t* settings = obs_encoder_get_settings(video_encoder_);
+	if (settings != nullptr) {
+		config.bitrate = (unsigned)obs_data_get_int(settings, "bitrate");
+		obs_data_release(settings);
+	}
+	video_t* video = obs_encoder_video(video_encoder_);
+	if (video != nullptr)
+		config.frame_interval_ns = video_output_get_frame_time(video);
+	config.pacing = pacing_ / 100.0;
+	config.retransmit_ms = retransmit_ms_;
+	config.rtx = rtx_ && retransmit_ms_ > 0;
+	config.fec_percent = std::min(fec_percent_, 100u);
+
+	uint8_t* extra_data = nullptr;
+	size_t extra_size = 0;
+	if (!obs_encoder_get_extra_data(video_encoder_, &extra_data, &extra_size) ||
+	    extra_size == 0)
+		return;
+
+	// the extra data holds the parameter sets in Annex B format
+	utils::video::NaluReader reader(extra_data, extra_size);
+	utils::video::NaluIndex index;
+	while (reader.Next(index)) {
+		if (index.payload_size == 0)
+			continue;
+		const uint8_t* nalu = extra_data + index.payload_start_offset;
+		std::vector<uint8_t>* target = nullptr;
+		if (config.hevc) {
+			switch (utils::h265::ParseNaluType(nalu[0])) {
+			case utils::h265::kVps: target = &config.vps; break;
+			case utils::h265::kSps: target = &config.sps; break;
+			case utils::h265::kPps: target = &config.pps; break;
+			default: break;
+			}
+		} else {
+			switch (utils::h264::ParseNaluType(nalu[0])) {
+			case utils::h264::kSps: target = &config.sps; break;
+			case utils::h264::kPps: target = &config.pps; break;
+			default: break;
+			}
+		}
+		if (target != nullptr && target->empty())
+			target->assign(nalu, nalu + index.payload_size);
+	}
+}
+
+bool RtspServer::GetAudioConfig(AudioConfig& config) {
+	if (audio_encoder_ == nullptr)
+		return false;
+
+	uint8_t* extra_data = nullptr;
+	size_t extra_size = 0;
+	if (!obs_encoder_get_extra_data(audio_encoder_, &extra_data, &extra_size) ||
+	    extra_size == 0) {
+		blog(LOG_WARNING, "the audio encoder has no AudioSpecificConfig");
 		return false;
 	}
 
-	env_ = new Environment();
+	// the AudioSpecificConfig as a hex string for the SDP
+	static const char hex[] = "0123456789ABCDEF";
+	config.config.clear();
+	for (size_t i = 0; i < extra_size; ++i) {
+		config.config.push_back(hex[extra_data[i] >> 4]);
+		config.config.push_back(hex[extra_data[i] & 0x0F]);
+	}
+	config.sample_rate = obs_encoder_get_sample_rate(audio_encoder_);
+	config.channels = (unsigned)audio_output_get_channels(obs_encoder_audio(audio_encoder_));
+	return true;
+}
 
-	UserAuthenticationDatabase* auth_db = nullptr;
-#ifdef ACCESS_CONTROL
-	// To implement client access control to the RTSP server, do the following:
-	auth_db = new UserAuthenticationDatabase;
-	auth_db->addUserRecord("username1", "password1"); // replace these with real strings
-	// Repeat the above with each <username>, <password> that you wish to allow
-	// access to the server.
-#endif
-	server_ = RTSPServer::createNew(*env_, port_, auth_db);
-	if (server_ == nullptr) {
+bool RtspServer::Start() {
+	if (host_ != nullptr) {
+		return false;
+	}
+
+	uint64_t start_ns = os_gettime_ns();
+	// the multicast stream has only one sink per track, so it can't be served by the
+	// worker loops
+	host_ = ServerHost::Acquire(port_, multicast_ ? 1 : threads_);
+	if (host_ == nullptr) {
 		blog(LOG_ERROR, "failed to create RTSP server");
 		return false;
 	}
+	if (multicast_ && host_->LoopCount() > 1) {
+		blog(LOG_ERROR, "multicast stream %s needs a single server loop, port %u has %zu",
+		     mount_.c_str(), (unsigned)port_, host_->LoopCount());
+		Stop();
+		return false;
+	}
+	if (!host_->AddMount(mount_)) {
+		blog(LOG_ERROR, "port %u already serves a stream called %s", (unsigned)port_,
+		     mount_.c_str());
+		Stop();
+		return false;
+	}
+	mounted_ = true;
+
+	// a new stream, a new mapping of the encoder timestamps
+	clock_ = new StreamClock();
+	VideoConfig video_config;
+	GetVideoConfig(video_config);
+	// the frames are built once and shared by the fanouts of all the loops
+	video_builder_ = new FrameBuilder(*clock_, stats_, video_config.hevc);
+	// audio & video share the clock, so the receivers can sync them from the RTCP reports
+	AudioConfig audio_config;
+	bool has_audio = GetAudioConfig(audio_config);
+	if (has_audio)
+		audio_builder_ = new FrameBuilder(*clock_, stats_);
+
+	if (adapt_bitrate_ && video_config.bitrate > 0) {
+		configured_bitrate_ = video_config.bitrate;
+		unsigned max_kbps = max_bitrate_ > 0 ? max_bitrate_ : video_config.bitrate;
+		bitrate_controller_ = new BitrateController(video_config.bitrate, min_bitrate_,
+							    max_kbps, primary_client_);
+		stats_.target_bitrate.store(bitrate_controller_->Target(), std::memory_order_relaxed);
+		next_bitrate_update_ns_ = 0;
+	} else if (adapt_bitrate_) {
+		blog(LOG_WARNING, "the video encoder has no bitrate setting, it isn't adapted");
+	}
+
+	// the unicast clients of the mount may land on any loop of the host
+	loops_.resize(multicast_ ? 1 : host_->LoopCount());
+	for (size_t i = 0; i < loops_.size(); ++i) {
+		bool added = false;
+		host_->Loop(i).Run([&]() {
+			added = AddSession(i, video_config, has_audio ? &audio_config : nullptr);
+		});
+		if (!added) {
+			Stop();
+			return false;
+		}
+	}
+	// the clients can connect from now on
+	connect_time_ms_ = (int)((os_gettime_ns() - start_ns) / 1000000);
+	return true;
+}
 
-	auto sms = ServerMediaSession::createNew(*env_, "obs_live",
-						 "Live stream from OBS rtsp plugin", "live stream");
+bool RtspServer::AddSession(size_t index, const VideoConfig& video_config,
+			    const AudioConfig* audio_config) {
+	ServerShard& loop = host_->Loop(index);
+	Environment& env = loop.Env();
+	MountLoop& mount = loops_[index];
+	mount.video_fanout = new FrameFanout(env, stats_, true);
+	if (audio_config != nullptr)
+		mount.audio_fanout = new FrameFanout(env, stats_, false);
+
+	// the FEC track protects the video track(RFC 5956)
+	std::string group_lines;
+	if (!multicast_ && video_config.fec_percent > 0)
+		group_lines = std::string("a=group:FEC ") + source::kVideoMid + " " +
+			      source::kFecMid + "\r\n";
+	auto sms = ServerMediaSession::createNew(
+	  env, mount_.c_str(), "Live stream from OBS rtsp plugin", "live stream", False,
+	  group_lines.empty() ? nullptr : group_lines.c_str());
 	if (sms == nullptr) {
 		blog(LOG_ERROR, "failed to create RTSP server media session");
 		return false;
 	}
 
-	// Create video source
-	struct sockaddr_storage dst_address = {0};
-	dst_address.ss_family = AF_INET;
-	((struct sockaddr_in&)dst_address).sin_addr.s_addr = chooseRandomIPv4SSMAddress(*env_);
-
-	video_source_ = new source::RtspVideoSource(*env_, dst_address);
-	if (!video_source_->Play(*env_, sms)) {
-		blog(LOG_ERROR, "failed to play video source");
-		delete video_source_;
-		video_source_ = nullptr;
-		return false;
+	if (multicast_) {
+		// Create video source
+		struct sockaddr_storage dst_address = {0};
+		dst_address.ss_family = AF_INET;
+		((struct sockaddr_in&)dst_address).sin_addr.s_addr =
+		  chooseRandomIPv4SSMAddress(env);
+
+		video_source_ =
+		  new source::RtspVideoSource(env, *mount.video_fanout, dst_address, video_config);
+		if (!video_source_->Play(env, sms)) {
+			blog(LOG_ERROR, "failed to play video source");
+			Medium::close(sms);
+			return false;
+		}
+		if (audio_config != nullptr) {
+			audio_source_ = new source::RtspAudioSource(env, *mount.audio_fanout,
+								    dst_address, *audio_config);
+			if (!audio_source_->Play(env, sms)) {
+				blog(LOG_ERROR, "failed to play audio source");
+				Medium::close(sms);
+				return false;
+			}
+		}
+	} else {
+		// every client gets its own RTP session, the frames are shared
+		auto on_play = [this](int delta) { OnPlay(delta); };
+		auto video = source::ObsVideoSubsession::createNew(env, *mount.video_fanout,
+								   video_config, on_play);
+		if (!sms->addSubsession(video)) {
+			blog(LOG_ERROR, "add to media session failed");
+			Medium::close(sms);
+			return false;
+		}
+		if (audio_config != nullptr &&
+		    !sms->addSubsession(source::ObsAudioSubsession::createNew(
+		      env, *mount.audio_fanout, *audio_config, on_play))) {
+			blog(LOG_ERROR, "add audio to media session failed");
+			Medium::close(sms);
+			return false;
+		}
+		// the FEC is a track of its own, after the a/v tracks for the clients which only
+		// know those
+		if (video_config.fec_percent > 0 &&
+		    !sms->addSubsession(
+		      source::ObsFecSubsession::createNew(env, *video, video_config))) {
+			blog(LOG_ERROR, "add FEC to media session failed");
+			Medium::close(sms);
+			return false;
+		}
 	}
 
 	// Add subsession to media session
-	server_->addServerMediaSession(sms);
-
-	// Start to playing in the `rtsp_server_thread`
-	server_thread_ = std::thread(&RtspServer::ServerThread, this);
-
-	blog(LOG_INFO, "play this stream using the URL: ");
-	if (weHaveAnIPv4Address(*env_)) {
-		auto url = server_->ipv4rtspURL(sms);
-		blog(LOG_INFO, "%s", url);
-		delete[] url;
+	loop.Server()->addServerMediaSession(sms);
+	mount.sms = sms;
+
+	if (index == 0) {
+		blog(LOG_INFO, "play this stream using the URL: ");
+		if (weHaveAnIPv4Address(env)) {
+			auto url = loop.Server()->ipv4rtspURL(sms);
+			blog(LOG_INFO, "%s", url);
+			delete[] url;
+		}
 	}
-
 	return true;
 }
 
-bool RtspServer::Stop() {
-	// stop env loop
-	if (env_ != nullptr) {
-		env_->stop();
-	}
-	// detach thread
-	if (server_thread_.joinable())
-		server_thread_.join();
-	// reclaim env
-	if (env_ != nullptr) {
-		env_->reclaim();
-		env_ = nullptr;
+void RtspServer::RemoveSession(size_t index) {
+	MountLoop& mount = loops_[index];
+	// closes the client sessions of the mount, and with them its readers
+	if (mount.sms != nullptr) {
+		host_->Loop(index).Server()->deleteServerMediaSession(mount.sms);
+		mount.sms = nullptr;
 	}
-
 	// release a/v sources
-	if (audio_source_ != nullptr) {
+	if (index == 0) {
 		delete audio_source_;
 		audio_source_ = nullptr;
-	}
-	if (video_source_ != nullptr) {
 		delete video_source_;
 		video_source_ = nullptr;
 	}
-	// close server
-	if (server_ != nullptr) {
-		Medium::close(server_);
-		server_ = nullptr;
+	// nobody reads the fanouts anymore
+	delete mount.video_fanout;
+	mount.video_fanout = nullptr;
+	delete mount.audio_fanout;
+	mount.audio_fanout = nullptr;
+}
+
+void RtspServer::OnPlay(int delta) {
+	// the loops race each other, the callback re-reads the count instead of trusting
+	// the order of the calls
+	int playing = playing_.fetch_add(delta, std::memory_order_acq_rel) + delta;
+	if ((playing == 0 || playing == delta) && play_callback_)
+		play_callback_();
+}
+
+bool RtspServer::Stop() {
+	if (host_ == nullptr)
+		return true;
+
+	// the other mounts of the host keep running
+	for (size_t i = 0; i < loops_.size(); ++i) {
+		host_->Loop(i).Run([this, i]() { RemoveSession(i); });
+	}
+	loops_.clear();
+	if (bitrate_controller_ != nullptr) {
+		// the encoder settings are saved with the profile, leave them as they were
+		if (bitrate_controller_->Target() != configured_bitrate_)
+			SetEncoderBitrate(configured_bitrate_);
+		delete bitrate_controller_;
+		bitrate_controller_ = nullptr;
+	}
+	// every fanout released its frames, the pools can go
+	if (video_builder_ != nullptr) {
+		delete video_builder_;
+		video_builder_ = nullptr;
+	}
+	if (audio_builder_ != nullptr) {
+		delete audio_builder_;
+		audio_builder_ = nullptr;
 	}
+	if (clock_ != nullptr) {
+		delete clock_;
+		clock_ = nullptr;
+	}
+	if (mounted_) {
+		host_->RemoveMount(mount_);
+		mounted_ = false;
+	}
+	ServerHost::Release(host_);
+	host_ = nullptr;
 	return true;
 }
 
-void RtspServer::ServerThread() {
-	os_set_thread_name("rtsp_server_thread");
-	env_->mainloop();
+void RtspServer::Data(struct encoder_packet* packet) {
+	// encoder thread, the fanouts hand the frame over to the server loops
+	if (packet->type == OBS_ENCODER_VIDEO && video_builder_ != nullptr) {
+		// always built, the GOP caches are kept warm for the first viewer
+		auto frame = video_builder_->Build(packet);
+		for (auto& loop : loops_) { loop.video_fanout->Feed(frame); }
+		if (bitrate_controller_ != nullptr)
+			UpdateBitrate();
+	} else if (packet->type == OBS_ENCODER_AUDIO && audio_builder_ != nullptr) {
+		bool has_readers = false;
+		for (auto& loop : loops_) {
+			has_readers = has_readers || loop.audio_fanout->HasReaders();
+		}
+		if (!has_readers) // nobody is listening
+			return;
+
+		auto frame = audio_builder_->Build(packet);
+		for (auto& loop : loops_) { loop.audio_fanout->Feed(frame); }
+	}
 }
 
-void RtspServer::Data(struct encoder_packet* packet) {
-	if (video_source_ != nullptr && packet->type == OBS_ENCODER_VIDEO) {
-		video_source_->Feed(packet);
+void RtspServer::DropCachedGops() {
+	for (auto& loop : loops_) {
+		if (loop.video_fanout != nullptr)
+			loop.video_fanout->DropGop();
 	}
 }
 
+int RtspServer::GetDroppedFrames() {
+	// the frames skipped by the slow clients are lost to the viewers just the same
+	return (int)(stats_.dropped_frames.load(std::memory_order_relaxed) +
+		     stats_.truncated_frames.load(std::memory_order_relaxed) +
+		     stats_.client_dropped_frames.load(std::memory_order_relaxed));
+}
+
 size_t RtspServer::GetTotalBytes() {
-	return 0;
+	return (size_t)stats_.bytes_sent.load(std::memory_order_relaxed);
+}
+
+uint64_t RtspServer::GetTotalPackets() {
+	return stats_.packets_sent.load(std::memory_order_relaxed);
 }
 
 int RtspServer::GetConnectTime() {
-	return 0;
+	return connect_time_ms_;
+}
+
+std::vector<ClientStats> RtspServer::GetClientStats() {
+	return stats_.Clients();
+}
+
+uint64_t RtspServer::GetNackedPackets() {
+	return stats_.nacked_packets.load(std::memory_order_relaxed);
+}
+
+uint64_t RtspServer::GetRetransmittedPackets() {
+	return stats_.retransmitted_packets.load(std::memory_order_relaxed);
+}
+
+double RtspServer::GetRetransmitDelayMs() {
+	uint64_t count = stats_.retransmitted_packets.load(std::memory_order_relaxed);
+	if (count == 0)
+		return 0.0;
+	return stats_.retransmit_delay_ns.load(std::memory_order_relaxed) / 1000000.0 / count;
+}
+
+uint64_t RtspServer::GetFecPackets() {
+	return stats_.fec_packets.load(std::memory_order_relaxed);
+}
+
+unsigned RtspServer::GetTargetBitrate() {
+	return stats_.target_bitrate.load(std::memory_order_relaxed);
+}
+
+uint64_t RtspServer::GetBitrateDecreases() {
+	return stats_.bitrate_decreases.load(std::memory_order_relaxed);
+}
+
+uint64_t RtspServer::GetBitrateIncreases() {
+	return stats_.bitrate_increases.load(std::memory_order_relaxed);
+}
+
+void RtspServer::UpdateBitrate() {
+	uint64_t now = os_gettime_ns();
+	if (now < next_bitrate_update_ns_)
+		return;
+	next_bitrate_update_ns_ = now + kBitrateUpdateInterval;
+
+	unsigned previous = bitrate_controller_->Target();
+	unsigned target = bitrate_controller_->Update(stats_.Clients(), now);
+	if (target == 0)
+		return;
+	SetEncoderBitrate(target);
+	stats_.target_bitrate.store(target, std::memory_order_relaxed);
+	if (target < previous)
+		stats_.bitrate_decreases.fetch_add(1, std::memory_order_relaxed);
+	else
+		stats_.bitrate_increases.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RtspServer::SetEncoderBitrate(unsigned kbps) {
+	// libobs applies the update on the encoder thread at the next frame
+	obs_data_t* settings = obs_data_create();
+	obs_data_set_int(settings, "bitrate", kbps);
+	obs_encoder_update(video_encoder_, settings);
+	obs_data_release(settings);
 }
 
 } // namespace output
@@ -1,47 +1,185 @@
 #pragma once
 
+#include "server_stats.h"
+
 #include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <string>
 #include <thread>
+#include <vector>
 
 // forward declarations
-class RTSPServer;
-class Environment;
+class ServerMediaSession;
 struct encoder_packet;
+typedef struct obs_encoder obs_encoder_t;
 
 namespace output::source {
 class RtspAudioSource;
 class RtspVideoSource;
 } // namespace output::source
 
+namespace output {
+class BitrateController;
+class FrameBuilder;
+class FrameFanout;
+class ServerHost;
+class StreamClock;
+
+// parameters of the video track, from the OBS video encoder
+struct VideoConfig {
+	bool hevc = false;
+	unsigned bitrate = 0; // kbps, from the encoder settings
+	// from the OBS video output
+	uint64_t frame_interval_ns = 0;
+	// spread the packets of a frame over this part of the frame interval, 0 sends every
+	// frame as a burst
+	double pacing = 0.0;
+	// keep the sent packets this long for the NACKs of the receivers, 0 ignores them
+	unsigned retransmit_ms = 0;
+	// resend them as RTX packets(RFC 4588) instead of repeating the originals
+	bool rtx = false;
+	// FEC packets(RFC 5109) per 100 RTP packets, 0 for none
+	unsigned fec_percent = 0;
+	// parameter sets from the encoder's extra data(without start codes), empty if unknown
+	std::vector<uint8_t> vps;
+	std::vector<uint8_t> sps;
+	std::vector<uint8_t> pps;
+
+	bool HasParameterSets() const {
+		return !sps.empty() && !pps.empty() && (!hevc || !vps.empty());
+	}
+};
+
+// parameters of the AAC track, from the OBS audio encoder
+struct AudioConfig {
+	unsigned sample_rate = 48000;
+	unsigned channels = 2;
+	// AudioSpecificConfig in hex, for the `config` of the SDP fmtp line
+	std::string config;
+};
+} // namespace output
+
 namespace output {
 class RtspServer {
 public:
-	RtspServer(uint16_t port = 8554);
+	// `multicast`: stream to a SSM multicast group instead of unicast RTP sessions
+	// `threads`: event loops serving the unicast clients, 0 picks it after the cores
+	// `pacing`: percent of the frame interval the packets of a unicast frame are spread
+	// over, 0 disables the pacing
+	// `mount`: the path of the stream, the servers of the same port share the listener
+	// and its loops, each one with its own path
+	RtspServer(uint16_t port = 8554, bool multicast = false, unsigned threads = 0,
+		   unsigned pacing = 0, const std::string& mount = "obs_live");
 	~RtspServer();
 	// copy & move are deleted
 	RtspServer(const RtspServer&) = delete;
 	RtspServer(RtspServer&&) noexcept = delete;
 
+	// picks H264 or H265 for the video track, call before `Start`
+	void SetVideoEncoder(obs_encoder_t* encoder);
+	// the AAC track is only served if the audio encoder is set before `Start`
+	void SetAudioEncoder(obs_encoder_t* encoder);
+	// adapt the bitrate of the video encoder to the receiver reports within the limits,
+	// `max_kbps` 0 for the configured bitrate, `primary` the address of the client which
+	// steers it, empty for the worst of all. Call before `Start`
+	void SetBitrateAdaptation(unsigned min_kbps, unsigned max_kbps,
+				  const std::string& primary = "");
+	// answer the generic NACKs of the unicast UDP clients from the packets of the last
+	// `history_ms`, as a RTX stream if `rtx`, it's announced in the SDP. Call before `Start`
+	void SetRetransmission(unsigned history_ms, bool rtx);
+	// protect the video of the unicast UDP clients with `overhead_percent` XOR parity
+	// packets for every 100 RTP packets, announced in the SDP. Call before `Start`
+	void SetFec(unsigned overhead_percent) { fec_percent_ = overhead_percent; }
+	// called on a server loop whenever the first client starts playing the mount or the
+	// last one stops, it must not block. Call before `Start`
+	void SetPlayCallback(const std::function<void()>& callback) { play_callback_ = callback; }
 	bool Start();
 	bool Stop();
 	void Data(struct encoder_packet* packet);
+	// between `Start` & `Stop`, any thread. The output paused the encoders for lack of
+	// viewers: the cached GOPs are dropped, the new viewers wait for the next keyframe
+	void DropCachedGops();
+	const std::string& Mount() const { return mount_; }
+	// the tracks the clients of the mount are playing right now, any thread
+	int GetPlayingStreams() const { return playing_.load(std::memory_order_acquire); }
+	// frames the server lost, dropped for falling behind or truncated by the sink buffer
+	int GetDroppedFrames();
+	// RTP bytes & packets sent to all the clients of the mount so far, updated every second
 	size_t GetTotalBytes();
+	uint64_t GetTotalPackets();
+	// how long `Start` took until the clients could connect, in ms
 	int GetConnectTime();
-
-  // static void AfterPlayingVideo(void* data);
+	// every track of every connected client, a multicast group counts as one client
+	std::vector<ClientStats> GetClientStats();
+	// the packets the receivers NACKed, the ones sent again and their average delay
+	uint64_t GetNackedPackets();
+	uint64_t GetRetransmittedPackets();
+	double GetRetransmitDelayMs();
+	// the FEC packets sent to all the clients
+	uint64_t GetFecPackets();
+	// the adapted video bitrate and how often it changed
+	unsigned GetTargetBitrate();
+	uint64_t GetBitrateDecreases();
+	uint64_t GetBitrateIncreases();
 
 private:
-	RTSPServer* server_;
-  Environment* env_;
+	// the part of the mount on one loop of the host
+	struct MountLoop {
+		FrameFanout* video_fanout = nullptr;
+		FrameFanout* audio_fanout = nullptr;
+		ServerMediaSession* sms = nullptr;
+	};
+
 	uint16_t port_; // default port is 8554
-  std::thread server_thread_;
+	bool multicast_;
+	unsigned threads_;
+	unsigned pacing_;
+	std::string mount_;
+	int connect_time_ms_;
+	ServerHost* host_;
+	bool mounted_;
+	// indexed like the loops of the host
+	std::vector<MountLoop> loops_;
 
-	// sources
+	ServerStats stats_;
+	std::atomic<int> playing_;
+	std::function<void()> play_callback_;
+	// maps the encoder timestamps of all the tracks to the wall clock
+	StreamClock* clock_;
+	// the frames are built once and shared by the fanouts of all the loops
+	FrameBuilder* video_builder_;
+	FrameBuilder* audio_builder_;
+	obs_encoder_t* video_encoder_;
+	obs_encoder_t* audio_encoder_;
+
+	bool adapt_bitrate_;
+	unsigned min_bitrate_;
+	unsigned max_bitrate_;
+	std::string primary_client_;
+	unsigned retransmit_ms_;
+	bool rtx_;
+	unsigned fec_percent_;
+	// encoder thread, the bitrate of the encoder settings before the first change
+	BitrateController* bitrate_controller_;
+	unsigned configured_bitrate_;
+	uint64_t next_bitrate_update_ns_;
+
+	// multicast sources, on loop 0
 	source::RtspAudioSource* audio_source_;
 	source::RtspVideoSource* video_source_;
 
-  // void CreateVideoSource();
-
-  void ServerThread();
+	void GetVideoConfig(VideoConfig& config);
+	bool GetAudioConfig(AudioConfig& config);
+	// loop thread, adds the session of the mount to loop `index`
+	bool AddSession(size_t index, const VideoConfig& video_config,
+			const AudioConfig* audio_config);
+	// loop thread, the clients of the mount are gone after it
+	void RemoveSession(size_t index);
+	// loop thread, `delta` tracks started(or stopped) playing
+	void OnPlay(int delta);
+	// encoder thread, feeds the latest receiver reports to the controller
+	void UpdateBitrate();
+	void SetEncoderBitrate(unsigned kbps);
 };
 } // namespace output
@@ -0,0 +1,96 @@
+#include "server_host.h"
+#include "server_shard.h"
+
+#include "liveMedia.hh"
+
+#include <obs.h>
+
+namespace output {
+std::mutex ServerHost::hosts_mutex_;
+std::map<uint16_t, ServerHost*> ServerHost::hosts_;
+
+ServerHost* ServerHost::Acquire(uint16_t port, unsigned loops) {
+	std::lock_guard<std::mutex> guard(hosts_mutex_);
+	auto it = hosts_.find(port);
+	if (it != hosts_.end()) {
+		++it->second->refs_;
+		return it->second;
+	}
+
+	auto host = new ServerHost(port);
+	if (!host->Start(loops)) {
+		delete host;
+		return nullptr;
+	}
+	host->refs_ = 1;
+	hosts_[port] = host;
+	return host;
+}
+
+void ServerHost::Release(ServerHost* host) {
+	if (host == nullptr)
+		return;
+	std::lock_guard<std::mutex> guard(hosts_mutex_);
+	if (--host->refs_ > 0)
+		return;
+	hosts_.erase(host->port_);
+	delete host;
+}
+
+ServerHost::ServerHost(uint16_t port)
+  : port_(port),
+    refs_(0),
+    auth_db_(nullptr),
+    main_(nullptr) {}
+
+ServerHost::~ServerHost() {
+	Stop();
+}
+
+bool ServerHost::AddMount(const std::string& name) {
+	std::lock_guard<std::mutex> guard(hosts_mutex_);
+	return mounts_.insert(name).second;
+}
+
+void ServerHost::RemoveMount(const std::string& name) {
+	std::lock_guard<std::mutex> guard(hosts_mutex_);
+	mounts_.erase(name);
+}
+
+bool ServerHost::Start(unsigned loops) {
+#ifdef ACCESS_CONTROL
+	// To implement client access control to the RTSP server, do the following:
+	auth_db_ = new UserAuthenticationDatabase;
+	auth_db_->addUserRecord("username1", "password1"); // replace these with real strings
+	// Repeat the above with each <username>, <password> that you wish to allow
+	// access to the server.
+#endif
+	// the workers have to run before the main loop hands them connections
+	for (unsigned i = 1; i < loops; ++i) {
+		auto worker = new ServerShard((int)i);
+		workers_.push_back(worker);
+		if (!worker->Start(port_, auth_db_, workers_)) {
+			blog(LOG_ERROR, "failed to start RTSP server shard %u", i);
+			return false;
+		}
+	}
+	main_ = new ServerShard(0);
+	if (!main_->Start(port_, auth_db_, workers_)) {
+		blog(LOG_ERROR, "failed to listen on RTSP port %u", (unsigned)port_);
+		return false;
+	}
+	blog(LOG_INFO, "rtsp server listening on port %u with %zu loops", (unsigned)port_,
+	     LoopCount());
+	return true;
+}
+
+void ServerHost::Stop() {
+	// nothing hands connections to the workers anymore
+	delete main_;
+	main_ = nullptr;
+	for (auto worker : workers_) { delete worker; }
+	workers_.clear();
+	delete auth_db_;
+	auth_db_ = nullptr;
+}
+} // namespace output
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+class UserAuthenticationDatabase;
+
+namespace output {
+class ServerShard;
+
+/// <summary>
+/// The listener & event loops of one RTSP port, shared by every `RtspServer` which
+/// mounts a stream on it. The first user picks the number of loops, the last one
+/// stops them.
+/// </summary>
+class ServerHost {
+public:
+	// the host of `port`, null if it can't listen on the port
+	static ServerHost* Acquire(uint16_t port, unsigned loops);
+	static void Release(ServerHost* host);
+
+	size_t LoopCount() const { return 1 + workers_.size(); }
+	// loop 0 accepts the connections
+	ServerShard& Loop(size_t index) { return index == 0 ? *main_ : *workers_[index - 1]; }
+
+	// false if the path is served already
+	bool AddMount(const std::string& name);
+	void RemoveMount(const std::string& name);
+
+private:
+	ServerHost(uint16_t port);
+	~ServerHost();
+	ServerHost(const ServerHost&) = delete;
+
+	bool Start(unsigned loops);
+	void Stop();
+
+	uint16_t port_;
+	int refs_;
+	UserAuthenticationDatabase* auth_db_;
+	ServerShard* main_;
+	std::vector<ServerShard*> workers_;
+	std::set<std::string> mounts_;
+
+	static std::mutex hosts_mutex_;
+	static std::map<uint16_t, ServerHost*> hosts_;
+};
+} // namespace output
@@ -0,0 +1,306 @@
+#include "server_shard.h"
+
+#include "environment.h"
+#include "GroupsockHelper.hh"
+#include "src/utils/utils.h"
+
+#include <obs.h>
+#include <util/threading.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <future>
+#include <string>
+
+namespace output {
+GenericMediaServer::ClientSession* ShardRtspServer::createNewClientSession(u_int32_t session_id) {
+	return new ShardClientSession(*this, session_id);
+}
+
+ShardRtspServer::ShardClientSession::ShardClientSession(ShardRtspServer& server,
+							u_int32_t session_id)
+  : RTSPClientSession(server, session_id),
+    shard_(server.shard_),
+    session_id_(session_id) {
+	shard_.AddSession(session_id_);
+}
+
+ShardRtspServer::ShardClientSession::~ShardClientSession() {
+	shard_.RemoveSession(session_id_);
+}
+
+ShardingRtspServer* ShardingRtspServer::createNew(UsageEnvironment& env, Port port,
+						  UserAuthenticationDatabase* auth_db,
+						  const std::vector<ServerShard*>& shards) {
+	int socket_ipv4 = setUpOurSocket(env, port, AF_INET);
+	int socket_ipv6 = setUpOurSocket(env, port, AF_INET6);
+	if (socket_ipv4 < 0 && socket_ipv6 < 0)
+		return nullptr;
+	return new ShardingRtspServer(env, socket_ipv4, socket_ipv6, port, auth_db, shards);
+}
+
+ShardingRtspServer::~ShardingRtspServer() {
+	for (auto pending : pending_) {
+		envir().taskScheduler().disableBackgroundHandling(pending->socket);
+		envir().taskScheduler().unscheduleDelayedTask(pending->retry_task);
+		closeSocket(pending->socket);
+		delete pending;
+	}
+}
+
+GenericMediaServer::ClientConnection*
+ShardingRtspServer::createNewClientConnection(int client_socket,
+					      struct sockaddr_storage const& client_address) {
+	// the loop is picked once the first request is in
+	auto pending = new PendingConnection{this, client_socket, client_address, nullptr};
+	pending_.insert(pending);
+	envir().taskScheduler().setBackgroundHandling(client_socket, SOCKET_READABLE,
+						      IncomingRequest, pending);
+	return nullptr;
+}
+
+void ShardingRtspServer::IncomingRequest(void* data, int) {
+	auto pending = static_cast<PendingConnection*>(data);
+	pending->server->IncomingRequest(pending);
+}
+
+void ShardingRtspServer::RetryRequest(void* data) {
+	auto pending = static_cast<PendingConnection*>(data);
+	pending->retry_task = nullptr;
+	pending->server->envir().taskScheduler().setBackgroundHandling(
+		pending->socket, SOCKET_READABLE, IncomingRequest, pending);
+}
+
+void ShardingRtspServer::IncomingRequest(PendingConnection* pending) {
+	// the request stays in the socket for the connection which serves it
+	char buffer[4096];
+	int size = recv(pending->socket, buffer, sizeof(buffer), MSG_PEEK);
+	if (size <= 0) {
+		if (size < 0 && envir().getErrno() == EWOULDBLOCK)
+			return;
+		Close(pending);
+		return;
+	}
+
+	std::string request(buffer, size);
+	if (request.find("\r\n\r\n") == std::string::npos && size < (int)sizeof(buffer)) {
+		// the rest of the headers is on its way, check again instead of spinning on
+		// the bytes which are already there
+		envir().taskScheduler().disableBackgroundHandling(pending->socket);
+		pending->retry_task =
+			envir().taskScheduler().scheduleDelayedTask(10000, RetryRequest, pending);
+		return;
+	}
+	Dispatch(pending, PickLoop(request));
+}
+
+size_t ShardingRtspServer::PickLoop(const std::string& request) {
+	size_t loops = shards_.size() + 1;
+	std::string lower = utils::string::ToLower(request);
+	auto header = [&request, &lower](const char* name) -> std::string {
+		size_t begin = lower.find(name);
+		if (begin == std::string::npos)
+			return std::string();
+		begin += strlen(name);
+		size_t end = request.find_first_of(";\r\n", begin);
+		std::string value = request.substr(begin, end - begin);
+		value.erase(0, value.find_first_not_of(" \t"));
+		value.erase(value.find_last_not_of(" \t") + 1);
+		return value;
+	};
+
+	// the GET & the POST of an RTSP-over-HTTP tunnel need the same loop
+	std::string cookie = header("\nx-sessioncookie:");
+	if (!cookie.empty()) {
+		// FNV-1a
+		uint32_t hash = 2166136261u;
+		for (char c : cookie) { hash = (hash ^ (uint8_t)c) * 16777619u; }
+		return hash % loops;
+	}
+
+	// a client which reconnects for PLAY/TEARDOWN needs the loop of its session
+	std::string session = header("\nsession:");
+	if (!session.empty()) {
+		size_t loop = FindSession(session);
+		if (loop < loops)
+			return loop;
+	}
+
+	size_t loop = next_loop_;
+	next_loop_ = (next_loop_ + 1) % loops;
+	return loop;
+}
+
+size_t ShardingRtspServer::FindSession(const std::string& session_id) {
+	if (lookupClientSession(session_id.c_str()) != nullptr)
+		return 0;
+	// the session ids are 8 hex digits
+	char* end = nullptr;
+	unsigned long id = strtoul(session_id.c_str(), &end, 16);
+	if (end == session_id.c_str() || *end != '\0' || id > 0xFFFFFFFFul)
+		return shards_.size() + 1;
+	for (size_t i = 0; i < shards_.size(); ++i) {
+		if (shards_[i]->HasSession((u_int32_t)id))
+			return i + 1;
+	}
+	return shards_.size() + 1;
+}
+
+void ShardingRtspServer::Dispatch(PendingConnection* pending, size_t loop) {
+	envir().taskScheduler().disableBackgroundHandling(pending->socket);
+	envir().taskScheduler().unscheduleDelayedTask(pending->retry_task);
+	pending_.erase(pending);
+	if (loop == 0) // this loop serves its share of the clients as well
+		RTSPServer::createNewClientConnection(pending->socket, pending->address);
+	else
+		shards_[loop - 1]->AdoptConnection(pending->socket, pending->address);
+	delete pending;
+}
+
+void ShardingRtspServer::Close(PendingConnection* pending) {
+	envir().taskScheduler().disableBackgroundHandling(pending->socket);
+	envir().taskScheduler().unscheduleDelayedTask(pending->retry_task);
+	pending_.erase(pending);
+	closeSocket(pending->socket);
+	delete pending;
+}
+
+ServerShard::ServerShard(int index)
+  : index_(index),
+    env_(nullptr),
+    server_(nullptr),
+    adopt_trigger_(0),
+    task_trigger_(0) {}
+
+ServerShard::~ServerShard() {
+	Stop();
+}
+
+bool ServerShard::Start(uint16_t port, UserAuthenticationDatabase* auth_db,
+			const std::vector<ServerShard*>& workers) {
+	if (env_ != nullptr)
+		return false;
+
+	env_ = new Environment();
+	adopt_trigger_ = env_->taskScheduler().createEventTrigger(AdoptPending);
+	task_trigger_ = env_->taskScheduler().createEventTrigger(RunTasks);
+	if (index_ > 0)
+		server_ = ShardRtspServer::createNew(*env_, Port(port), auth_db, *this);
+	else if (workers.empty())
+		server_ = RTSPServer::createNew(*env_, port, auth_db);
+	else
+		server_ = ShardingRtspServer::createNew(*env_, Port(port), auth_db, workers);
+	if (server_ == nullptr) {
+		blog(LOG_ERROR, "failed to create RTSP server of loop %d", index_);
+		return false;
+	}
+
+	thread_ = std::thread(&ServerShard::ShardThread, this);
+	return true;
+}
+
+void ServerShard::Stop() {
+	if (env_ == nullptr)
+		return;
+
+	env_->stop();
+	if (thread_.joinable())
+		thread_.join();
+
+	// the connections which were never adopted
+	{
+		std::lock_guard<std::mutex> guard(pending_mutex_);
+		for (auto& pending : pending_) { closeSocket(pending.socket); }
+		pending_.clear();
+	}
+	// closes the client connections & sessions, and with them the readers
+	if (server_ != nullptr) {
+		Medium::close(server_);
+		server_ = nullptr;
+	}
+
+	env_->taskScheduler().deleteEventTrigger(adopt_trigger_);
+	env_->taskScheduler().deleteEventTrigger(task_trigger_);
+	env_->reclaim();
+	env_ = nullptr;
+}
+
+void ServerShard::Run(const std::function<void()>& task) {
+	std::promise<void> done;
+	auto future = done.get_future();
+	{
+		std::lock_guard<std::mutex> guard(tasks_mutex_);
+		tasks_.push_back([&task, &done]() {
+			task();
+			done.set_value();
+		});
+	}
+	env_->taskScheduler().triggerEvent(task_trigger_, this);
+	env_->wakeup();
+	future.wait();
+}
+
+void ServerShard::RunTasks(void* data) {
+	static_cast<ServerShard*>(data)->RunTasks1();
+}
+
+void ServerShard::RunTasks1() {
+	std::vector<std::function<void()>> tasks;
+	{
+		std::lock_guard<std::mutex> guard(tasks_mutex_);
+		tasks.swap(tasks_);
+	}
+	for (auto& task : tasks) { task(); }
+}
+
+void ServerShard::AdoptConnection(int client_socket,
+				  const struct sockaddr_storage& client_address) {
+	{
+		std::lock_guard<std::mutex> guard(pending_mutex_);
+		pending_.push_back({client_socket, client_address});
+	}
+	env_->taskScheduler().triggerEvent(adopt_trigger_, this);
+	env_->wakeup();
+}
+
+bool ServerShard::HasSession(u_int32_t session_id) {
+	std::lock_guard<std::mutex> guard(sessions_mutex_);
+	return sessions_.count(session_id) > 0;
+}
+
+void ServerShard::AddSession(u_int32_t session_id) {
+	std::lock_guard<std::mutex> guard(sessions_mutex_);
+	sessions_.insert(session_id);
+}
+
+void ServerShard::RemoveSession(u_int32_t session_id) {
+	std::lock_guard<std::mutex> guard(sessions_mutex_);
+	sessions_.erase(session_id);
+}
+
+void ServerShard::AdoptPending(void* data) {
+	static_cast<ServerShard*>(data)->AdoptPending1();
+}
+
+void ServerShard::AdoptPending1() {
+	std::vector<PendingConnection> pending;
+	{
+		std::lock_guard<std::mutex> guard(pending_mutex_);
+		pending.swap(pending_);
+	}
+	for (auto& connection : pending) {
+		static_cast<ShardRtspServer*>(server_)->AdoptConnection(connection.socket,
+									 connection.address);
+	}
+}
+
+void ServerShard::ShardThread() {
+	if (index_ == 0) {
+		os_set_thread_name("rtsp_server_thread");
+	} else {
+		std::string name = "rtsp_shard_" + std::to_string(index_);
+		os_set_thread_name(name.c_str());
+	}
+	env_->mainloop();
+}
+} // namespace output
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "liveMedia.hh"
+
+#include <stdint.h>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Environment;
+
+namespace output {
+class ServerShard;
+
+/// <summary>
+/// RTSP server of a worker loop, it has no listening socket and only serves the
+/// connections which the main server hands over
+/// </summary>
+class ShardRtspServer : public RTSPServer {
+public:
+	// `shard` is told about every session of the server as it comes and goes
+	static ShardRtspServer* createNew(UsageEnvironment& env, Port port,
+					  UserAuthenticationDatabase* auth_db, ServerShard& shard) {
+		return new ShardRtspServer(env, port, auth_db, shard);
+	}
+
+	// shard thread, take over an accepted connection
+	void AdoptConnection(int client_socket, const struct sockaddr_storage& client_address) {
+		createNewClientConnection(client_socket, client_address);
+	}
+
+protected:
+	ShardRtspServer(UsageEnvironment& env, Port port, UserAuthenticationDatabase* auth_db,
+			ServerShard& shard)
+	  : RTSPServer(env, -1, -1, port, auth_db, 65),
+	    shard_(shard) {}
+	virtual ~ShardRtspServer() = default;
+
+	virtual ClientSession* createNewClientSession(u_int32_t session_id) override;
+
+private:
+	// publishes its id to the shard for its lifetime
+	class ShardClientSession : public RTSPClientSession {
+	public:
+		ShardClientSession(ShardRtspServer& server, u_int32_t session_id);
+		virtual ~ShardClientSession();
+
+	private:
+		ServerShard& shard_;
+		u_int32_t session_id_;
+	};
+
+	ServerShard& shard_;
+};
+
+/// <summary>
+/// RTSP server of the main loop, it accepts every connection and spreads them over
+/// itself and the worker shards. The first request of a connection picks the loop:
+/// the two connections of an RTSP-over-HTTP tunnel share a loop through their session
+/// cookie, a command for an existing session goes to the loop which has the session,
+/// every other connection goes to the next loop round robin.
+/// </summary>
+class ShardingRtspServer : public RTSPServer {
+public:
+	static ShardingRtspServer* createNew(UsageEnvironment& env, Port port,
+					     UserAuthenticationDatabase* auth_db,
+					     const std::vector<ServerShard*>& shards);
+
+protected:
+	ShardingRtspServer(UsageEnvironment& env, int socket_ipv4, int socket_ipv6, Port port,
+			   UserAuthenticationDatabase* auth_db,
+			   const std::vector<ServerShard*>& shards)
+	  : RTSPServer(env, socket_ipv4, socket_ipv6, port, auth_db, 65),
+	    shards_(shards),
+	    next_loop_(0) {}
+	virtual ~ShardingRtspServer();
+
+	virtual ClientConnection*
+	createNewClientConnection(int client_socket,
+				  struct sockaddr_storage const& client_address) override;
+
+private:
+	// an accepted connection which hasn't sent its first request yet
+	struct PendingConnection {
+		ShardingRtspServer* server;
+		int socket;
+		struct sockaddr_storage address;
+		TaskToken retry_task;
+	};
+
+	const std::vector<ServerShard*>& shards_;
+	// the loop the next connection without affinity goes to, 0 is this loop
+	size_t next_loop_;
+	std::set<PendingConnection*> pending_;
+
+	static void IncomingRequest(void* data, int mask);
+	static void RetryRequest(void* data);
+	void IncomingRequest(PendingConnection* pending);
+	// the loop for the connection which sent `request`(its headers at least)
+	size_t PickLoop(const std::string& request);
+	// the loop which has the session, `shards_.size() + 1` if none has it. Never waits
+	// for a worker loop
+	size_t FindSession(const std::string& session_id);
+	void Dispatch(PendingConnection* pending, size_t loop);
+	void Close(PendingConnection* pending);
+};
+
+/// <summary>
+/// An event loop of the RTSP server. Loop 0 owns the listening sockets and spreads the
+/// connections over itself and the worker loops, which only serve the connections they
+/// are handed. The mounts add their sessions to every loop through `Run`.
+/// </summary>
+class ServerShard {
+public:
+	ServerShard(int index);
+	~ServerShard();
+	ServerShard(const ServerShard&) = delete;
+
+	// `workers`: the other loops, only used by loop 0
+	bool Start(uint16_t port, UserAuthenticationDatabase* auth_db,
+		   const std::vector<ServerShard*>& workers);
+	void Stop();
+
+	int Index() const { return index_; }
+	Environment& Env() { return *env_; }
+	RTSPServer* Server() { return server_; }
+
+	// any other thread, runs `task` on the loop and waits for it
+	void Run(const std::function<void()>& task);
+	// any thread, the connection is served by the shard loop from now on
+	void AdoptConnection(int client_socket, const struct sockaddr_storage& client_address);
+	// any thread, whether the RTSP session `session_id` lives on this loop
+	bool HasSession(u_int32_t session_id);
+	// shard thread, a session of the loop's server was created or deleted
+	void AddSession(u_int32_t session_id);
+	void RemoveSession(u_int32_t session_id);
+
+private:
+	struct PendingConnection {
+		int socket;
+		struct sockaddr_storage address;
+	};
+
+	int index_;
+	Environment* env_;
+	RTSPServer* server_;
+	std::thread thread_;
+
+	EventTriggerId adopt_trigger_;
+	std::mutex pending_mutex_;
+	std::vector<PendingConnection> pending_;
+
+	EventTriggerId task_trigger_;
+	std::mutex tasks_mutex_;
+	std::vector<std::function<void()>> tasks_;
+
+	// the sessions of `server_`, for the main loop to look up without a round trip
+	std::mutex sessions_mutex_;
+	std::set<u_int32_t> sessions_;
+
+	void ShardThread();
+	static void AdoptPending(void* data);
+	void AdoptPending1();
+	static void RunTasks(void* data);
+	void RunTasks1();
+};
+} // namespace output
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace output {
+// One track streamed to one client, as of the last update of its `ClientTracker`.
+struct ClientStats {
+	std::string address;
+	unsigned session_id = 0;
+	bool audio = false;
+	bool tcp = false;
+	// `os_gettime_ns` of the SETUP
+	uint64_t connect_ns = 0;
+	// RTP payload & headers
+	uint64_t bytes = 0;
+	uint64_t packets = 0;
+	// skipped by the client's queue for being too slow
+	uint64_t dropped_frames = 0;
+	// from the last RTCP receiver report
+	double loss = 0.0; // fraction lost since the previous report
+	uint64_t lost_packets = 0;
+	double jitter_ms = 0.0;
+	double rtt_ms = 0.0;
+	// the highest jitter of the reports so far, the bursts of the keyframes show up in it
+	double max_jitter_ms = 0.0;
+	// UDP video with retransmission: the packets of the keyframes & their parameter sets
+	// and the ones the client NACKed. the receiver reports only count the lost packets
+	uint64_t keyframe_packets = 0;
+	uint64_t lost_keyframe_packets = 0;
+	// the highest sequence number the last receiver report covers, a new report moves it
+	uint32_t report_seq = 0;
+};
+
+// Counters of the RTSP server, written on the encoder & server threads and read by the
+// OBS statistics, they outlive the fanouts of a single `Start`/`Stop` run.
+struct ServerStats {
+	// frames dropped because the server loop fell behind the encoder
+	std::atomic<uint64_t> dropped_frames{0};
+	// NAL units(or whole frames) which didn't fit the RTP sink buffer
+	std::atomic<uint64_t> truncated_frames{0};
+	std::atomic<uint64_t> truncated_bytes{0};
+	// frames a slow client skipped, summed over all the clients
+	std::atomic<uint64_t> client_dropped_frames{0};
+	// the largest encoded frame so far, the RTP sink buffers are sized after it
+	std::atomic<size_t> largest_frame{0};
+	// sent to all the clients, including the ones which are gone
+	std::atomic<uint64_t> bytes_sent{0};
+	std::atomic<uint64_t> packets_sent{0};
+	// the video bitrate the receiver reports allow, 0 if it isn't adapted
+	std::atomic<unsigned> target_bitrate{0};
+	std::atomic<uint64_t> bitrate_decreases{0};
+	std::atomic<uint64_t> bitrate_increases{0};
+	// the packets the receivers NACKed and the ones which were still in the history, the
+	// resent ones were this much later than the originals in total
+	std::atomic<uint64_t> nacked_packets{0};
+	std::atomic<uint64_t> retransmitted_packets{0};
+	std::atomic<uint64_t> retransmit_delay_ns{0};
+	// the FEC packets sent on top of the media packets they protect
+	std::atomic<uint64_t> fec_packets{0};
+
+	// server threads, `key` identifies the tracker & the client session
+	void UpdateClient(std::pair<const void*, unsigned> key, const ClientStats& client) {
+		std::lock_guard<std::mutex> guard(clients_mutex_);
+		clients_[key] = client;
+	}
+	void RemoveClient(std::pair<const void*, unsigned> key) {
+		std::lock_guard<std::mutex> guard(clients_mutex_);
+		clients_.erase(key);
+	}
+	// any thread
+	std::vector<ClientStats> Clients() {
+		std::lock_guard<std::mutex> guard(clients_mutex_);
+		std::vector<ClientStats> clients;
+		clients.reserve(clients_.size());
+		for (auto& client : clients_) { clients.push_back(client.second); }
+		return clients;
+	}
+
+private:
+	std::mutex clients_mutex_;
+	std::map<std::pair<const void*, unsigned>, ClientStats> clients_;
+};
+} // namespace output
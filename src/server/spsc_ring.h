@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace output {
+// Bounded lock-free ring buffer for exactly one producer and one consumer thread.
+template<typename T> class SpscRing {
+public:
+	// `capacity` is rounded up to a power of two
+	explicit SpscRing(size_t capacity) : head_(0), tail_(0) {
+		size_t size = 1;
+		while (size < capacity) size <<= 1;
+		slots_.resize(size);
+		mask_ = size - 1;
+	}
+	SpscRing(const SpscRing&) = delete;
+
+	// producer only, returns false if the ring is full
+	bool Push(T&& value) {
+		size_t tail = tail_.load(std::memory_order_relaxed);
+		if (tail - head_.load(std::memory_order_acquire) > mask_)
+			return false;
+
+		slots_[tail & mask_] = std::move(value);
+		tail_.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer only, returns false if the ring is empty
+	bool Pop(T& value) {
+		size_t head = head_.load(std::memory_order_relaxed);
+		if (head == tail_.load(std::memory_order_acquire))
+			return false;
+
+		value = std::move(slots_[head & mask_]);
+		slots_[head & mask_] = T();
+		head_.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	size_t Size() const {
+		return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+	}
+
+private:
+	std::vector<T> slots_;
+	size_t mask_;
+	// keep the indices on their own cache lines, they are written by different threads
+	alignas(64) std::atomic<size_t> head_;
+	alignas(64) std::atomic<size_t> tail_;
+};
+} // namespace output
@@ -0,0 +1,21 @@
+#include "stream_clock.h"
+
+#include "GroupsockHelper.hh"
+
+namespace output {
+struct timeval StreamClock::ToWallClock(int64_t ts, int32_t num, int32_t den) {
+	int64_t ts_us = ToMicroseconds(ts, num, den);
+	std::call_once(start_once_, [this, ts_us]() {
+		struct timeval now;
+		gettimeofday(&now, nullptr);
+		start_ts_us_ = ts_us;
+		start_wall_us_ = (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+	});
+
+	int64_t wall_us = start_wall_us_ + (ts_us - start_ts_us_);
+	struct timeval time;
+	time.tv_sec = (long)(wall_us / 1000000);
+	time.tv_usec = (long)(wall_us % 1000000);
+	return time;
+}
+} // namespace output
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "NetCommon.h"
+
+#include <stdint.h>
+#include <mutex>
+
+namespace output {
+// Maps the encoder timestamps of every track onto the wall clock, the stream start is
+// picked once so the RTCP sender reports of audio & video describe the same timeline.
+class StreamClock {
+public:
+	StreamClock() : start_ts_us_(0), start_wall_us_(0) {}
+	StreamClock(const StreamClock&) = delete;
+
+	// thread safe, `ts` in units of `num / den` seconds
+	struct timeval ToWallClock(int64_t ts, int32_t num, int32_t den);
+
+	static int64_t ToMicroseconds(int64_t ts, int32_t num, int32_t den) {
+		return (int64_t)((double)ts * num * 1000000.0 / den);
+	}
+
+private:
+	std::once_flag start_once_;
+	// the encoder timestamp and the wall clock time of the first packet
+	int64_t start_ts_us_;
+	int64_t start_wall_us_;
+};
+} // namespace output
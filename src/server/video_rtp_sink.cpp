@@ -0,0 +1,17 @@
+#include "video_rtp_sink.h"
+
+namespace output::source {
+RtpBufferGuard::RtpBufferGuard(size_t size) : lock_(Mutex()) {
+	if (size > OutPacketBuffer::maxSize)
+		OutPacketBuffer::maxSize = (unsigned)size;
+}
+
+std::mutex& RtpBufferGuard::Mutex() {
+	static std::mutex mutex;
+	return mutex;
+}
+
+size_t RtpBufferSizeFor(size_t size) {
+	return size + size / 2;
+}
+} // namespace output::source
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "liveMedia.hh"
+#include "obs_framed_source.h"
+
+#include <util/base.h>
+
+#include <algorithm>
+#include <mutex>
+
+namespace output::source {
+// `OutPacketBuffer::maxSize` is process global, live555 reads it when it sets up an RTP
+// sink and the fragmenter of a video sink, on whichever loop runs the client. The server
+// sets up its sinks under this guard only, and the size only grows under it.
+class RtpBufferGuard {
+public:
+	// grows `OutPacketBuffer::maxSize` to `size`, if it's smaller
+	explicit RtpBufferGuard(size_t size);
+	RtpBufferGuard(const RtpBufferGuard&) = delete;
+
+private:
+	std::lock_guard<std::mutex> lock_;
+
+	static std::mutex& Mutex();
+};
+
+// the buffer a NAL unit of `size` bytes is given, with some headroom for the next ones
+size_t RtpBufferSizeFor(size_t size);
+
+/// <summary>
+/// H264/H265 RTP sink which makes room for a NAL unit bigger than its buffer instead of
+/// truncating it. The fragmenter of the sink allocates its buffer once, so it's replaced
+/// by a bigger one between two NAL units, while the source holds the NAL unit back.
+/// </summary>
+template<class Sink> class GrowingVideoRTPSink : public Sink, public GrowableSink {
+public:
+	template<class... Args>
+	static GrowingVideoRTPSink* createNew(UsageEnvironment& env, Args... args) {
+		return new GrowingVideoRTPSink(env, args...);
+	}
+
+	virtual bool Grow(size_t size) override {
+		// not playing, or a NAL unit no encoder setting can explain
+		if (this->fOurFragmenter == nullptr || size > kMaxRtpBufferSize)
+			return false;
+		grow_size_ = std::max(grow_size_, size);
+		// not from within the delivery, the fragmenter is waiting for the NAL unit
+		if (grow_task_ == nullptr)
+			grow_task_ = this->envir().taskScheduler().scheduleDelayedTask(0, GrowTask,
+										       this);
+		return true;
+	}
+
+protected:
+	template<class... Args>
+	GrowingVideoRTPSink(UsageEnvironment& env, Args... args)
+	  : Sink(env, args...),
+	    grow_task_(nullptr),
+	    grow_size_(0) {}
+	virtual ~GrowingVideoRTPSink() {
+		this->envir().taskScheduler().unscheduleDelayedTask(grow_task_);
+	}
+
+private:
+	TaskToken grow_task_;
+	size_t grow_size_;
+
+	static void GrowTask(void* data) { static_cast<GrowingVideoRTPSink*>(data)->Regrow(); }
+
+	void Regrow() {
+		grow_task_ = nullptr;
+		if (this->fSource == nullptr || this->fOurFragmenter == nullptr)
+			return;
+		FramedSource* input = this->fOurFragmenter->inputSource();
+		// the fragmenter asks for a NAL unit only once it sent the last one, nothing is
+		// lost with it. The sequence numbers & timestamps belong to the sink and go on.
+		this->stopPlaying();
+		Medium::close(this->fOurFragmenter);
+		this->fOurFragmenter = nullptr;
+		RtpBufferGuard guard(RtpBufferSizeFor(grow_size_));
+		blog(LOG_INFO, "rtsp server grew the RTP buffer of a client to %u bytes for a "
+			       "%zu bytes NAL unit",
+		     OutPacketBuffer::maxSize, grow_size_);
+		// the OBS sources never close, the after function of the first start(which
+		// tears down a stream that ended) has nothing to do
+		this->startPlaying(*input, nullptr, nullptr);
+	}
+
+	static const size_t kMaxRtpBufferSize = 64 * 1024 * 1024;
+};
+
+typedef GrowingVideoRTPSink<H264VideoRTPSink> GrowingH264VideoRTPSink;
+typedef GrowingVideoRTPSink<H265VideoRTPSink> GrowingH265VideoRTPSink;
+} // namespace output::source
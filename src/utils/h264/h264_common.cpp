@@ -1,4 +1,7 @@
 #include "h264_common.h"
+#include "src/utils/start_sequence.h"
+
+#include <cstring>
 
 namespace utils::h264 {
 constexpr uint8_t kNaluTypeMask = 0x1F;
@@ -6,58 +9,32 @@ constexpr int kScalingDeltaMin = -128;
 constexpr int kScaldingDeltaMax = 127;
 
 std::vector<video::NaluIndex> FindNaluIndices(const uint8_t* buffer, size_t buffer_size) {
-	// This is sorta like Boyer-Moore, but with only the first optimization step:
-	// given a 3-byte sequence we're looking at, if the 3rd byte isn't 1 or 0,
-	// skip ahead to the next 3-byte sequence. 0s and 1s are relatively rare, so
-	// this will skip the majority of reads/checks.
 	std::vector<video::NaluIndex> sequences;
-	if (buffer_size < kNaluShortStartSequenceSize)
-		return sequences;
-
-	static_assert(kNaluShortStartSequenceSize >= 2,
-		      "kNaluShortStartSequenceSize must be larger or equals to 2");
-	const size_t end = buffer_size - kNaluShortStartSequenceSize;
-	for (size_t i = 0; i < end;) {
-		if (buffer[i + 2] > 1) {
-			i += 3;
-		} else if (buffer[i + 2] == 1) {
-			if (buffer[i + 1] == 0 && buffer[i] == 0) {
-				// We found a start sequence, now check if it was a 3 of 4 byte one.
-				video::NaluIndex index = {i, i + 3, 0};
-				if (index.start_offset > 0 && buffer[index.start_offset - 1] == 0)
-					--index.start_offset;
-
-				// Update length of previous entry.
-				auto it = sequences.rbegin();
-				if (it != sequences.rend())
-					it->payload_size =
-					  index.start_offset - it->payload_start_offset;
-
-				sequences.push_back(index);
-			}
-
-			i += 3;
-		} else {
-			++i;
-		}
-	}
-
-	// Update length of last entry, if any.
-	auto it = sequences.rbegin();
-	if (it != sequences.rend())
-		it->payload_size = buffer_size - it->payload_start_offset;
-
+	FindNaluIndices(buffer, buffer_size, sequences);
 	return sequences;
 }
 
+void FindNaluIndices(const uint8_t* buffer, size_t buffer_size,
+		     std::vector<video::NaluIndex>& sequences) {
+	sequences.clear();
+	video::NaluReader reader(buffer, buffer_size);
+	video::NaluIndex index;
+	while (reader.Next(index)) { sequences.push_back(index); }
+}
+
 NaluType ParseNaluType(uint8_t data) {
 	return static_cast<NaluType>(data & kNaluTypeMask);
 }
 
 std::vector<uint8_t> ParseRbsp(const uint8_t* data, size_t length) {
-	std::vector<uint8_t> out;
-	out.reserve(length);
+	std::vector<uint8_t> out(length);
+	out.resize(ParseRbsp(data, length, out.data()));
+	return out;
+}
 
+size_t ParseRbsp(const uint8_t* data, size_t length, uint8_t* out) {
+	// the output never runs ahead of the input, `out` can be `data`
+	size_t size = 0;
 	for (size_t i = 0; i < length;) {
 		// Be careful about over/underflow here. byte_length_ - 3 can underflow, and
 		// i + 3 can overflow, but byte_length_ - i can't, because i < byte_length_
@@ -65,20 +42,65 @@ std::vector<uint8_t> ParseRbsp(const uint8_t* data, size_t length) {
 		// the stream including the byte at i.
 		if (length - i >= 3 && !data[i] && !data[i + 1] && data[i + 2] == 3) {
 			// Two rbsp bytes.
-			out.push_back(data[i++]);
-			out.push_back(data[i++]);
+			out[size++] = data[i++];
+			out[size++] = data[i++];
 			// Skip the emulation byte.
 			i++;
 		} else {
 			// Single rbsp byte.
-			out.push_back(data[i++]);
+			out[size++] = data[i++];
+		}
+	}
+	return size;
+}
+
+bool HasRecoveryPoint(const uint8_t* sei, size_t length) {
+	// the emulation prevention bytes are skipped on the fly, no copy of the payload
+	size_t i = 0;
+	int zeros = 0;
+	auto next = [&](uint8_t& byte) -> bool {
+		if (zeros >= 2 && i < length && sei[i] == 3) {
+			++i;
+			zeros = 0;
+		}
+		if (i >= length)
+			return false;
+		byte = sei[i++];
+		zeros = byte == 0 ? zeros + 1 : 0;
+		return true;
+	};
+
+	// sei_message()s up to the rbsp trailing bits, which don't parse as a whole message
+	uint8_t byte = 0;
+	for (;;) {
+		uint32_t type = 0;
+		do {
+			if (!next(byte))
+				return false;
+			type += byte;
+		} while (byte == 0xFF);
+		if (type == kSeiRecoveryPoint)
+			return true;
+
+		uint32_t size = 0;
+		do {
+			if (!next(byte))
+				return false;
+			size += byte;
+		} while (byte == 0xFF);
+		for (uint32_t n = 0; n < size; ++n) {
+			if (!next(byte))
+				return false;
 		}
 	}
-	return out;
 }
 
 std::optional<SpsNalu> ParseSps(const std::vector<uint8_t>& data) {
-	video::BitstreamReader bitstream(data);
+	return ParseSps(data.data(), data.size());
+}
+
+std::optional<SpsNalu> ParseSps(const uint8_t* data, size_t length) {
+	video::BitstreamReader bitstream(data, length);
 	video::ExponentialGolombReader reader(bitstream);
 
 	SpsNalu sps;
@@ -180,6 +202,9 @@ std::optional<SpsNalu> ParseSps(const std::vector<uint8_t>& data) {
 		reader.ReadSE();
 		// num_ref_frames_in_pic_order_cnt_cycle: ue(v)
 		auto num_ref_frames_in_pic_order_cnt_cycle = reader.ReadUE();
+		if (num_ref_frames_in_pic_order_cnt_cycle > 255) {
+			return std::optional<SpsNalu>();
+		}
 		for (size_t i = 0; i < num_ref_frames_in_pic_order_cnt_cycle; ++i) {
 			// offset_for_ref_frame[i]: se(v)
 			reader.ReadSE();
@@ -258,6 +283,10 @@ std::optional<SpsNalu> ParseSps(const std::vector<uint8_t>& data) {
 	sps.width -= (frame_crop_left_offset + frame_crop_right_offset);
 	sps.height -= (frame_crop_top_offset + frame_crop_bottom_offset);
 
+	// a truncated SPS, the fields after the end read as 0
+	if (!reader.Ok()) {
+		return std::optional<SpsNalu>();
+	}
 	return std::optional<SpsNalu>(sps);
 }
 
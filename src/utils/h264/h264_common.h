@@ -1,6 +1,7 @@
 #ifndef COMMON_VIDEO_H264_H264_COMMON_H_
 #define COMMON_VIDEO_H264_H264_COMMON_H_
 
+#include "src/utils/start_sequence.h"
 #include "src/utils/video_utils.h"
 
 #include <optional>
@@ -37,8 +38,15 @@ enum NaluType : uint8_t {
 
 enum SliceType : uint8_t { kP = 0, kB = 1, kI = 2, kSp = 3, kSi = 4 };
 
+// The payloadType of the recovery point SEI message, the same in H265.
+const uint32_t kSeiRecoveryPoint = 6;
+
 // Returns a vector of the NALU indices in the given buffer.
 std::vector<video::NaluIndex> FindNaluIndices(const uint8_t* buffer, size_t buffer_size);
+// Same as above, but fills `sequences` so its capacity can be reused between calls.
+// `video::NaluReader` walks them one at a time without any vector.
+void FindNaluIndices(const uint8_t* buffer, size_t buffer_size,
+		     std::vector<video::NaluIndex>& sequences);
 
 // Get the NAL type from the header byte immediately following start sequence.
 NaluType ParseNaluType(uint8_t data);
@@ -58,6 +66,13 @@ NaluType ParseNaluType(uint8_t data);
 
 // Parse the given data and remove any emulation byte escaping.
 std::vector<uint8_t> ParseRbsp(const uint8_t* data, size_t length);
+// Same as above into `out`, which has room for `length` bytes and may be `data` itself to
+// unescape in place. Returns the size of the RBSP.
+size_t ParseRbsp(const uint8_t* data, size_t length, uint8_t* out);
+
+// Whether the SEI payload(the escaped bytes after the NAL header) holds a recovery point
+// message, decoding can start at the access unit then. Only the message headers are read.
+bool HasRecoveryPoint(const uint8_t* sei, size_t length);
 
 // Representation of a SPS NALU.
 struct SpsNalu {
@@ -80,6 +95,7 @@ struct SpsNalu {
 
 // Parse the given buffer data and return a SpsNalu struct.
 std::optional<SpsNalu> ParseSps(const std::vector<uint8_t>& data);
+std::optional<SpsNalu> ParseSps(const uint8_t* data, size_t length);
 } // namespace utils::h264
 
 #endif // COMMON_VIDEO_H264_H264_COMMON_H_
@@ -3,15 +3,20 @@
 
 namespace utils::h265 {
 constexpr uint8_t kNaluTypeMask = 0x7E;
+// the limits of the SPS syntax, the counts size vectors before they are read
+constexpr uint32_t kMaxDpbSize = 16;
+constexpr uint32_t kMaxShortTermRefPicSets = 64;
+constexpr uint32_t kMaxLongTermRefPicsSps = 32;
 
 std::vector<video::NaluIndex> FindNaluIndices(const uint8_t* buffer, size_t buffer_size) {
-	std::vector<video::NaluIndex> indices = h264::FindNaluIndices(buffer, buffer_size);
-	std::vector<video::NaluIndex> results;
-	for (auto& index : indices) {
-		results.push_back(
-		  {index.start_offset, index.payload_start_offset, index.payload_size});
-	}
-	return results;
+	// the start sequences are the same as in H264
+	return h264::FindNaluIndices(buffer, buffer_size);
+}
+
+void FindNaluIndices(const uint8_t* buffer, size_t buffer_size,
+		     std::vector<video::NaluIndex>& indices) {
+	// the start sequences are the same as in H264
+	h264::FindNaluIndices(buffer, buffer_size, indices);
 }
 
 NaluType ParseNaluType(uint8_t data) {
@@ -22,6 +27,14 @@ std::vector<uint8_t> ParseRbsp(const uint8_t* data, size_t length) {
 	return h264::ParseRbsp(data, length);
 }
 
+size_t ParseRbsp(const uint8_t* data, size_t length, uint8_t* out) {
+	return h264::ParseRbsp(data, length, out);
+}
+
+bool HasRecoveryPoint(const uint8_t* sei, size_t length) {
+	return h264::HasRecoveryPoint(sei, length);
+}
+
 uint32_t Log2(uint32_t value) {
 	uint32_t result = 0;
 	// If value is not a power of two an additional bit is required
@@ -74,7 +87,7 @@ bool ParseScalingListData(video::ExponentialGolombReader& reader) {
 			}
 		}
 	}
-	return true;
+	return reader.Ok();
 }
 
 std::optional<ShortTermRefPicSet>
@@ -98,6 +111,9 @@ ParseShortTermRefPicSet(uint32_t st_rps_idx, uint32_t num_short_term_ref_pic_set
 		reader.ReadBits(1);
 		// abs_delta_rps_minus1: ue(v)
 		reader.ReadUE();
+		if (delta_idx_minus1 >= st_rps_idx) {
+			return std::optional<ShortTermRefPicSet>();
+		}
 		uint32_t ref_rps_idx = st_rps_idx - (delta_idx_minus1 + 1);
 		uint32_t num_delta_pocs = 0;
 		if (short_term_ref_pic_set[ref_rps_idx].inter_ref_pic_set_prediction_flag) {
@@ -131,6 +147,10 @@ ParseShortTermRefPicSet(uint32_t st_rps_idx, uint32_t num_short_term_ref_pic_set
 		ref_pic_set.num_negative_pics = reader.ReadUE();
 		// num_positive_pics: ue(v)
 		ref_pic_set.num_positive_pics = reader.ReadUE();
+		if (ref_pic_set.num_negative_pics > kMaxDpbSize ||
+		    ref_pic_set.num_positive_pics > kMaxDpbSize) {
+			return std::optional<ShortTermRefPicSet>();
+		}
 
 		ref_pic_set.delta_poc_s0_minus1.resize(ref_pic_set.num_negative_pics, 0);
 		ref_pic_set.used_by_curr_pic_s0_flag.resize(ref_pic_set.num_negative_pics, 0);
@@ -150,11 +170,18 @@ ParseShortTermRefPicSet(uint32_t st_rps_idx, uint32_t num_short_term_ref_pic_set
 		}
 	}
 
+	if (!reader.Ok()) {
+		return std::optional<ShortTermRefPicSet>();
+	}
 	return std::optional(ref_pic_set);
 }
 
 std::optional<SpsNalu> ParseSps(const std::vector<uint8_t>& buffer) {
-	video::BitstreamReader bitstream(buffer);
+	return ParseSps(buffer.data(), buffer.size());
+}
+
+std::optional<SpsNalu> ParseSps(const uint8_t* buffer, size_t length) {
+	video::BitstreamReader bitstream(buffer, length);
 	video::ExponentialGolombReader reader(bitstream);
 
 	// Now, we need to use a bit buffer to parse through the actual HEVC SPS
@@ -270,6 +297,9 @@ std::optional<SpsNalu> ParseSps(const std::vector<uint8_t>& buffer) {
 	reader.ReadUE();
 	// log2_max_pic_order_cnt_lsb_minus4: ue(v)
 	sps.log2_max_pic_order_cnt_lsb_minus4 = reader.ReadUE();
+	if (sps.log2_max_pic_order_cnt_lsb_minus4 > 12) {
+		return std::optional<SpsNalu>();
+	}
 	uint32_t sps_sub_layer_ordering_info_present_flag = 0;
 	// sps_sub_layer_ordering_info_present_flag: u(1)
 	sps_sub_layer_ordering_info_present_flag = reader.ReadBit();
@@ -329,6 +359,9 @@ std::optional<SpsNalu> ParseSps(const std::vector<uint8_t>& buffer) {
 
 	// num_short_term_ref_pic_sets: ue(v)
 	sps.num_short_term_ref_pic_sets = reader.ReadUE();
+	if (sps.num_short_term_ref_pic_sets > kMaxShortTermRefPicSets) {
+		return std::optional<SpsNalu>();
+	}
 	sps.short_term_ref_pic_set.resize(sps.num_short_term_ref_pic_sets);
 	for (uint32_t st_rps_idx = 0; st_rps_idx < sps.num_short_term_ref_pic_sets; st_rps_idx++) {
 		// st_ref_pic_set()
@@ -347,6 +380,9 @@ std::optional<SpsNalu> ParseSps(const std::vector<uint8_t>& buffer) {
 	if (sps.long_term_ref_pics_present_flag) {
 		// num_long_term_ref_pics_sps: ue(v)
 		sps.num_long_term_ref_pics_sps = reader.ReadUE();
+		if (sps.num_long_term_ref_pics_sps > kMaxLongTermRefPicsSps) {
+			return std::optional<SpsNalu>();
+		}
 		sps.used_by_curr_pic_lt_sps_flag.resize(sps.num_long_term_ref_pics_sps, 0);
 		for (uint32_t i = 0; i < sps.num_long_term_ref_pics_sps; i++) {
 			// lt_ref_pic_poc_lsb_sps: u(v)
@@ -362,6 +398,10 @@ std::optional<SpsNalu> ParseSps(const std::vector<uint8_t>& buffer) {
 	sps.sps_temporal_mvp_enabled_flag = reader.ReadBit();
 
 	// Far enough! We don't use the rest of the SPS.
+	// a truncated SPS, the fields after the end read as 0
+	if (!reader.Ok()) {
+		return std::optional<SpsNalu>();
+	}
 
 	sps.vps_id = sps_video_parameter_set_id;
 
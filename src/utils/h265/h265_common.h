@@ -49,6 +49,9 @@ enum SliceType : uint8_t { kB = 0, kP = 1, kI = 2 };
 
 // Returns a vector of the NALU indices in the given buffer.
 std::vector<video::NaluIndex> FindNaluIndices(const uint8_t* buffer, size_t buffer_size);
+// Same as above, but fills `indices` so its capacity can be reused between calls.
+void FindNaluIndices(const uint8_t* buffer, size_t buffer_size,
+		     std::vector<video::NaluIndex>& indices);
 
 // Get the NAL type from the header byte immediately following start sequence.
 NaluType ParseNaluType(uint8_t data);
@@ -68,6 +71,13 @@ NaluType ParseNaluType(uint8_t data);
 
 // Parse the given data and remove any emulation byte escaping.
 std::vector<uint8_t> ParseRbsp(const uint8_t* data, size_t length);
+// Same as above into `out`, which has room for `length` bytes and may be `data` itself to
+// unescape in place. Returns the size of the RBSP.
+size_t ParseRbsp(const uint8_t* data, size_t length, uint8_t* out);
+
+// Whether the prefix SEI payload(the escaped bytes after the 2 byte NAL header) holds a
+// recovery point message, the message syntax is the one of H264.
+bool HasRecoveryPoint(const uint8_t* sei, size_t length);
 
 uint32_t Log2(uint32_t value);
 
@@ -122,6 +132,7 @@ ParseShortTermRefPicSet(uint32_t st_rps_idx, uint32_t num_short_term_ref_pic_set
 
 // Parse the given SPS NALU buffer and return the parsed SpsNalu.
 std::optional<h265::SpsNalu> ParseSps(const std::vector<uint8_t>& buffer);
+std::optional<h265::SpsNalu> ParseSps(const uint8_t* buffer, size_t length);
 
 } // namespace utils::h265
 
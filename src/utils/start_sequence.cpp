@@ -0,0 +1,209 @@
+#include "start_sequence.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define START_SEQUENCE_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define START_SEQUENCE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace utils::video {
+typedef const uint8_t* (*FindFunction)(const uint8_t* begin, const uint8_t* end);
+
+#if defined(START_SEQUENCE_X86) || defined(START_SEQUENCE_NEON)
+static inline unsigned CountTrailingZeros(uint64_t value) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return (unsigned)index;
+#else
+	return (unsigned)__builtin_ctzll(value);
+#endif
+}
+#endif
+
+static const uint8_t* FindScalar(const uint8_t* begin, const uint8_t* end) {
+	// Every start sequence ends with a 1, let memchr() find the 1s(it compares a word at
+	// a time) and only check the two bytes before each of them.
+	const uint8_t* p = begin + 2;
+	while (p < end) {
+		p = static_cast<const uint8_t*>(memchr(p, 1, end - p));
+		if (p == nullptr)
+			break;
+		if (p[-1] == 0 && p[-2] == 0)
+			return p - 2;
+		// the next 1 of a start sequence can't be in the 2 bytes after this one
+		p += 3;
+	}
+	return end;
+}
+
+// The vector kernels compare the bytes at `p`, `p + 1` and `p + 2` with 0, 0 and 1 for
+// a whole vector of positions, a set bit of the mask is a start sequence. Unlike a
+// search for the 1s alone, a payload full of 1s doesn't stop them.
+#ifdef START_SEQUENCE_X86
+static const uint8_t* FindSse2(const uint8_t* begin, const uint8_t* end) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi8(1);
+	const uint8_t* p = begin;
+	for (; end - p >= 16 + 2; p += 16) {
+		__m128i b0 = _mm_loadu_si128((const __m128i*)p);
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(p + 1));
+		__m128i b2 = _mm_loadu_si128((const __m128i*)(p + 2));
+		__m128i match = _mm_and_si128(_mm_cmpeq_epi8(b2, one),
+					      _mm_and_si128(_mm_cmpeq_epi8(b0, zero),
+							    _mm_cmpeq_epi8(b1, zero)));
+		unsigned mask = (unsigned)_mm_movemask_epi8(match);
+		if (mask != 0)
+			return p + CountTrailingZeros(mask);
+	}
+	return FindScalar(p, end);
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("avx2")))
+#endif
+static const uint8_t* FindAvx2(const uint8_t* begin, const uint8_t* end) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi8(1);
+	const uint8_t* p = begin;
+	for (; end - p >= 32 + 2; p += 32) {
+		__m256i b0 = _mm256_loadu_si256((const __m256i*)p);
+		__m256i b1 = _mm256_loadu_si256((const __m256i*)(p + 1));
+		__m256i b2 = _mm256_loadu_si256((const __m256i*)(p + 2));
+		__m256i match = _mm256_and_si256(_mm256_cmpeq_epi8(b2, one),
+						 _mm256_and_si256(_mm256_cmpeq_epi8(b0, zero),
+								  _mm256_cmpeq_epi8(b1, zero)));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(match);
+		if (mask != 0)
+			return p + CountTrailingZeros(mask);
+	}
+	// the SSE2 loop takes what is left over of the last 32 bytes
+	return FindSse2(p, end);
+}
+
+static bool HasAvx2() {
+#if defined(__GNUC__) || defined(__clang__)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	// the OS has to save the YMM registers too
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	if (!osxsave || (_xgetbv(0) & 0x6) != 0x6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return false;
+#endif
+}
+#endif
+
+#ifdef START_SEQUENCE_NEON
+static const uint8_t* FindNeon(const uint8_t* begin, const uint8_t* end) {
+	const uint8x16_t zero = vdupq_n_u8(0);
+	const uint8x16_t one = vdupq_n_u8(1);
+	const uint8_t* p = begin;
+	for (; end - p >= 16 + 2; p += 16) {
+		uint8x16_t match = vandq_u8(vceqq_u8(vld1q_u8(p + 2), one),
+					    vandq_u8(vceqq_u8(vld1q_u8(p), zero),
+						     vceqq_u8(vld1q_u8(p + 1), zero)));
+		// no movemask on NEON, narrowing leaves 4 bits for every byte
+		uint64_t mask = vget_lane_u64(
+		  vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0);
+		if (mask != 0)
+			return p + CountTrailingZeros(mask) / 4;
+	}
+	return FindScalar(p, end);
+}
+#endif
+
+struct Kernel {
+	FindFunction find;
+	const char* name;
+};
+
+static Kernel SelectKernel() {
+#if defined(START_SEQUENCE_X86)
+	if (HasAvx2())
+		return {FindAvx2, "avx2"};
+	return {FindSse2, "sse2"};
+#elif defined(START_SEQUENCE_NEON)
+	return {FindNeon, "neon"};
+#else
+	return {FindScalar, "scalar"};
+#endif
+}
+
+static Kernel& GetKernel() {
+	// thread safe, the CPU is only asked once
+	static Kernel kernel = SelectKernel();
+	return kernel;
+}
+
+const uint8_t* FindStartSequence(const uint8_t* begin, const uint8_t* end) {
+	return GetKernel().find(begin, end);
+}
+
+NaluReader::NaluReader(const uint8_t* buffer, size_t buffer_size)
+  : buffer_(buffer),
+    buffer_size_(buffer_size),
+    search_end_(buffer_size >= 3 ? buffer + buffer_size - 1 : buffer),
+    next_(FindStartSequence(buffer, search_end_)) {}
+
+size_t NaluReader::StartOffset(const uint8_t* start_sequence) const {
+	size_t offset = start_sequence - buffer_;
+	return offset > 0 && buffer_[offset - 1] == 0 ? offset - 1 : offset;
+}
+
+bool NaluReader::Next(NaluIndex& nalu) {
+	if (next_ == search_end_)
+		return false;
+	nalu.start_offset = StartOffset(next_);
+	nalu.payload_start_offset = next_ - buffer_ + 3;
+	// the payload ends where the next NAL unit starts
+	next_ = FindStartSequence(next_ + 3, search_end_);
+	nalu.payload_size = (next_ == search_end_ ? buffer_size_ : StartOffset(next_)) -
+			    nalu.payload_start_offset;
+	return true;
+}
+
+const char* StartSequenceKernel() {
+	return GetKernel().name;
+}
+
+bool UseStartSequenceKernel(const char* name) {
+	static const Kernel kernels[] = {
+#if defined(START_SEQUENCE_X86)
+	  {FindAvx2, "avx2"},
+	  {FindSse2, "sse2"},
+#elif defined(START_SEQUENCE_NEON)
+	  {FindNeon, "neon"},
+#endif
+	  {FindScalar, "scalar"},
+	};
+	for (auto& kernel : kernels) {
+		if (strcmp(kernel.name, name) != 0)
+			continue;
+#if defined(START_SEQUENCE_X86)
+		if (kernel.find == FindAvx2 && !HasAvx2())
+			return false;
+#endif
+		GetKernel() = kernel;
+		return true;
+	}
+	return false;
+}
+} // namespace utils::video
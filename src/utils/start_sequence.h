@@ -0,0 +1,45 @@
+#pragma once
+
+#include "video_utils.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace utils::video {
+// The first {0 0 1} start sequence which lies entirely in [`begin`, `end`), `end` if there
+// is none. The H264 and H265 start sequences are the same.
+//
+// Compares a vector of candidate positions at a time, SSE2 or AVX2 on x86-64 (picked
+// once by the CPU the process runs on) and NEON on ARM64. Elsewhere and for the tail
+// of the buffer memchr() looks for the 1s.
+const uint8_t* FindStartSequence(const uint8_t* begin, const uint8_t* end);
+
+// Walks the NAL units of an Annex B buffer one at a time, the same ones `FindNaluIndices`
+// finds, without collecting them. The buffer has to outlive the reader.
+class NaluReader {
+public:
+	NaluReader(const uint8_t* buffer, size_t buffer_size);
+
+	// the next NAL unit, false after the last one
+	bool Next(NaluIndex& nalu);
+
+private:
+	const uint8_t* buffer_;
+	size_t buffer_size_;
+	// a start sequence must be followed by at least one byte
+	const uint8_t* search_end_;
+	// the start sequence of the next NAL unit, `search_end_` if there is none
+	const uint8_t* next_;
+
+	// with the zero before a 4 byte start sequence
+	size_t StartOffset(const uint8_t* start_sequence) const;
+};
+
+// The name of the kernel `FindStartSequence` uses on this CPU, for the logs.
+const char* StartSequenceKernel();
+
+// Makes `FindStartSequence` use the kernel `name`("avx2", "sse2", "neon" or "scalar"), for
+// the tests & benchmarks. False if the build or the CPU has no such kernel. Not thread
+// safe, call it before anything scans.
+bool UseStartSequenceKernel(const char* name);
+} // namespace utils::video
@@ -0,0 +1,123 @@
+#include "ulpfec.h"
+
+#include <algorithm>
+
+namespace utils::ulpfec {
+// the E bit is 0 for RFC 5109, the L bit picks the 48 bit mask
+static const uint8_t kExtensionFlag = 0x80;
+static const uint8_t kLongMaskFlag = 0x40;
+// P X CC of the first header byte, V is always 2
+static const uint8_t kRecoveredBits = 0x3F;
+static const uint8_t kRtpVersion = 0x80;
+
+// the FEC & level 0 header size of the FEC payload, 0 if it's too short
+static size_t HeaderSize(const uint8_t* fec, size_t size) {
+	if (size < kFecHeaderSize || (fec[0] & kExtensionFlag) != 0)
+		return 0;
+	size_t mask_bits = (fec[0] & kLongMaskFlag) != 0 ? kLongMaskBits : kShortMaskBits;
+	size_t header = kFecHeaderSize + 2 + mask_bits / 8;
+	return size < header ? 0 : header;
+}
+
+bool Protect(const std::vector<Packet>& packets, std::vector<uint8_t>& fec) {
+	if (packets.empty())
+		return false;
+	uint16_t base = Seq(packets[0].data);
+	bool long_mask = false;
+	size_t length = 0;
+	for (auto& packet : packets) {
+		if (packet.size < kRtpHeaderSize)
+			return false;
+		uint16_t offset = (uint16_t)(Seq(packet.data) - base);
+		if (offset >= kLongMaskBits)
+			return false;
+		long_mask |= offset >= kShortMaskBits;
+		length = std::max(length, packet.size - kRtpHeaderSize);
+	}
+
+	size_t header = kFecHeaderSize + 2 + (long_mask ? kLongMaskBits : kShortMaskBits) / 8;
+	// keeps the capacity, the caller reuses the buffer for every FEC packet
+	fec.assign(header + length, 0);
+	uint8_t* out = fec.data();
+	for (auto& packet : packets) {
+		const uint8_t* data = packet.data;
+		out[0] ^= data[0] & kRecoveredBits;
+		out[1] ^= data[1];
+		for (size_t i = 4; i < 8; ++i) { out[i] ^= data[i]; }
+		size_t payload_size = packet.size - kRtpHeaderSize;
+		out[8] ^= (uint8_t)(payload_size >> 8);
+		out[9] ^= (uint8_t)payload_size;
+
+		uint16_t offset = (uint16_t)(Seq(data) - base);
+		out[kFecHeaderSize + 2 + offset / 8] |= (uint8_t)(0x80 >> (offset % 8));
+		// the CSRCs & the header extension are part of the protected bytes
+		const uint8_t* payload = data + kRtpHeaderSize;
+		uint8_t* parity = out + header;
+		for (size_t i = 0; i < payload_size; ++i) { parity[i] ^= payload[i]; }
+	}
+	if (long_mask)
+		out[0] |= kLongMaskFlag;
+	out[2] = (uint8_t)(base >> 8);
+	out[3] = (uint8_t)base;
+	out[kFecHeaderSize] = (uint8_t)(length >> 8);
+	out[kFecHeaderSize + 1] = (uint8_t)length;
+	return true;
+}
+
+bool ProtectedSeqs(const uint8_t* fec, size_t size, std::vector<uint16_t>& seqs) {
+	size_t header = HeaderSize(fec, size);
+	if (header == 0)
+		return false;
+	uint16_t base = Seq(fec);
+	seqs.clear();
+	for (size_t bit = 0; bit < (header - kFecHeaderSize - 2) * 8; ++bit) {
+		if ((fec[kFecHeaderSize + 2 + bit / 8] & (0x80 >> (bit % 8))) != 0)
+			seqs.push_back((uint16_t)(base + bit));
+	}
+	return !seqs.empty();
+}
+
+bool Recover(const uint8_t* fec, size_t size, const std::vector<Packet>& packets,
+	     uint16_t missing, uint32_t ssrc, std::vector<uint8_t>& recovered) {
+	size_t header = HeaderSize(fec, size);
+	if (header == 0)
+		return false;
+	size_t length = (size_t)fec[kFecHeaderSize] << 8 | fec[kFecHeaderSize + 1];
+	if (size < header + length)
+		return false;
+
+	uint8_t bits[8];
+	std::copy(fec, fec + 8, bits);
+	size_t payload_size = (size_t)fec[8] << 8 | fec[9];
+	recovered.assign(kRtpHeaderSize + length, 0);
+	uint8_t* parity = recovered.data() + kRtpHeaderSize;
+	std::copy(fec + header, fec + header + length, parity);
+	for (auto& packet : packets) {
+		if (packet.size < kRtpHeaderSize)
+			return false;
+		const uint8_t* data = packet.data;
+		bits[0] ^= data[0] & kRecoveredBits;
+		bits[1] ^= data[1];
+		for (size_t i = 4; i < 8; ++i) { bits[i] ^= data[i]; }
+		size_t protected_size = packet.size - kRtpHeaderSize;
+		payload_size ^= protected_size;
+		const uint8_t* payload = data + kRtpHeaderSize;
+		for (size_t i = 0; i < std::min(protected_size, length); ++i) { parity[i] ^= payload[i]; }
+	}
+	if (payload_size > length)
+		return false;
+
+	recovered.resize(kRtpHeaderSize + payload_size);
+	uint8_t* out = recovered.data();
+	out[0] = kRtpVersion | (bits[0] & kRecoveredBits);
+	out[1] = bits[1];
+	out[2] = (uint8_t)(missing >> 8);
+	out[3] = (uint8_t)missing;
+	std::copy(bits + 4, bits + 8, out + 4);
+	out[8] = (uint8_t)(ssrc >> 24);
+	out[9] = (uint8_t)(ssrc >> 16);
+	out[10] = (uint8_t)(ssrc >> 8);
+	out[11] = (uint8_t)ssrc;
+	return true;
+}
+} // namespace utils::ulpfec
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// the XOR parity packets of RFC 5109, sent as an RTP stream of their own in a separate
+// RTP session, without RED. Only the level 0 protection is used.
+namespace utils::ulpfec {
+const size_t kRtpHeaderSize = 12;
+// E L P X CC M PT, SN base, TS recovery & length recovery
+const size_t kFecHeaderSize = 10;
+// the level 0 header follows, the protection length & a 16 or 48 bit mask
+const size_t kShortMaskBits = 16;
+const size_t kLongMaskBits = 48;
+
+// One RTP packet of the protected stream, the whole packet with its header.
+struct Packet {
+	const uint8_t* data;
+	size_t size;
+};
+
+inline uint16_t Seq(const uint8_t* packet) {
+	return (uint16_t)(packet[2] << 8 | packet[3]);
+}
+
+// Builds the FEC header, the level 0 header and the parity of `packets` into `fec`,
+// which becomes the payload of the FEC packet. The sequence numbers of `packets` are
+// at most `kLongMaskBits` - 1 after the first one, the first one is the SN base.
+// Returns false if they aren't.
+bool Protect(const std::vector<Packet>& packets, std::vector<uint8_t>& fec);
+
+// The sequence numbers the FEC payload protects, false if it isn't one.
+bool ProtectedSeqs(const uint8_t* fec, size_t size, std::vector<uint16_t>& seqs);
+
+// Rebuilds the packet `missing` from the FEC payload & all the other packets it
+// protects, `ssrc` is the SSRC of the media stream. Returns false if the FEC payload
+// is broken.
+bool Recover(const uint8_t* fec, size_t size, const std::vector<Packet>& packets,
+	     uint16_t missing, uint32_t ssrc, std::vector<uint8_t>& recovered);
+} // namespace utils::ulpfec
@@ -1,9 +1,13 @@
 #pragma once
 
 #include <vector>
-#include <stdexcept>
+#include <cstddef>
 #include <cstdint>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace utils::video {
 
 struct NaluIndex {
@@ -15,32 +19,106 @@ struct NaluIndex {
 	size_t payload_size;
 };
 
-// A simple bitstream reader
+// Reads the bits MSB first through a 64 bit cache, which is refilled a word at a time.
+// Running past the end of the data doesn't throw, the reads return 0 from then on and
+// `Ok` turns false, a parser checks it once it's done or before it trusts a count.
 class BitstreamReader {
 public:
-	BitstreamReader(const std::vector<uint8_t>& data) : data_(data), bit_position_(0) {}
+	BitstreamReader(const uint8_t* data, size_t size)
+	  : data_(data), size_(size), position_(0), cache_(0), cache_bits_(0), ok_(true) {}
+	BitstreamReader(const std::vector<uint8_t>& data)
+	  : BitstreamReader(data.data(), data.size()) {}
+
+	// false once a read ran past the end of the data or an Exp-Golomb code was invalid
+	bool Ok() const { return ok_; }
 
+	// up to 64 bits, of more than 32 only the last 32 are returned
 	uint32_t ReadBits(int numBits) {
-		uint32_t value = 0;
-		for (int i = 0; i < numBits; i++) {
-			value <<= 1;
-			value |= ReadBit() ? 1 : 0;
+		if (numBits > 32) {
+			ReadBits(numBits - 32);
+			numBits = 32;
 		}
+		if (numBits <= 0)
+			return 0;
+		if (cache_bits_ < numBits) {
+			Refill();
+			if (cache_bits_ < numBits)
+				return Fail();
+		}
+		uint32_t value = (uint32_t)(cache_ >> (64 - numBits));
+		cache_ <<= numBits;
+		cache_bits_ -= numBits;
 		return value;
 	}
 
-	bool ReadBit() {
-		if (bit_position_ >= data_.size() * 8) {
-			throw std::runtime_error("End of stream");
+	bool ReadBit() { return ReadBits(1) != 0; }
+
+	// ue(v), the leading zeros are counted in the cache at once
+	uint32_t ReadUE() {
+		if (cache_bits_ < 32)
+			Refill();
+		int zeros = CountLeadingZeros(cache_);
+		// a code of 32 or more leading zeros doesn't fit 32 bits
+		if (zeros > 31)
+			return Fail();
+		int length = 2 * zeros + 1;
+		if (length <= cache_bits_) {
+			uint64_t code = cache_ >> (64 - length);
+			cache_ <<= length;
+			cache_bits_ -= length;
+			return (uint32_t)(code - 1);
 		}
-		bool bit = data_[bit_position_ / 8] & (0x80 >> (bit_position_ % 8));
-		bit_position_++;
-		return bit;
+		// the suffix is in the bytes after the cache, or past the end
+		ReadBits(zeros + 1);
+		return (uint32_t)(((uint64_t)1 << zeros) - 1 + ReadBits(zeros));
 	}
 
 private:
-	const std::vector<uint8_t>& data_;
-	size_t bit_position_;
+	const uint8_t* data_;
+	size_t size_;
+	// the next byte to load into the cache
+	size_t position_;
+	// the bits to read next are the top `cache_bits_` bits, the bits below are either 0
+	// or the bytes from `position_` on, loading them again doesn't change them
+	uint64_t cache_;
+	int cache_bits_;
+	bool ok_;
+
+	void Refill() {
+		if (size_ - position_ >= 8) {
+			uint64_t word = 0;
+			for (int i = 0; i < 8; i++) { word = word << 8 | data_[position_ + i]; }
+			cache_ |= word >> cache_bits_;
+			int bytes = (63 - cache_bits_) / 8;
+			position_ += bytes;
+			cache_bits_ += bytes * 8;
+			return;
+		}
+		while (cache_bits_ <= 56 && position_ < size_) {
+			cache_ |= (uint64_t)data_[position_++] << (56 - cache_bits_);
+			cache_bits_ += 8;
+		}
+	}
+
+	uint32_t Fail() {
+		ok_ = false;
+		position_ = size_;
+		cache_ = 0;
+		cache_bits_ = 0;
+		return 0;
+	}
+
+	static int CountLeadingZeros(uint64_t value) {
+		if (value == 0)
+			return 64;
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		return 63 - (int)index;
+#else
+		return __builtin_clzll(value);
+#endif
+	}
 };
 
 // A simple Exp-Golomb code reader
@@ -48,18 +126,14 @@ class ExponentialGolombReader {
 public:
 	ExponentialGolombReader(BitstreamReader& bitstream) : bitstream_(bitstream) {}
 
-	uint32_t ReadUE() {
-		int leadingZeroBits = -1;
-		for (bool bit = false; !bit; leadingZeroBits++) { bit = bitstream_.ReadBit(); }
-		return ((1 << leadingZeroBits) - 1) + bitstream_.ReadBits(leadingZeroBits);
-	}
+	uint32_t ReadUE() { return bitstream_.ReadUE(); }
 
 	int32_t ReadSE() {
 		uint32_t unsigned_val = ReadUE();
 		if (unsigned_val % 2 == 0) {
-			return -static_cast<int>(unsigned_val / 2);
+			return -static_cast<int32_t>(unsigned_val / 2);
 		} else {
-			return (unsigned_val + 1) / 2;
+			return static_cast<int32_t>(unsigned_val / 2 + 1);
 		}
 	}
 
@@ -71,6 +145,8 @@ public:
     return bitstream_.ReadBit();
   }
 
+	bool Ok() const { return bitstream_.Ok(); }
+
 private:
 	BitstreamReader& bitstream_;
 };
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace bench {
+inline volatile uint64_t sink;
+
+// keeps the compiler from dropping a result nobody reads
+inline void Use(uint64_t value) {
+	sink = value;
+}
+
+// calls `function` until `seconds` have passed, the best of 3 rounds in ns per call
+template<class Function> double NsPerCall(Function function, double seconds = 0.3) {
+	double best = 0;
+	for (int round = 0; round < 3; ++round) {
+		uint64_t calls = 0;
+		auto start = std::chrono::steady_clock::now();
+		std::chrono::duration<double> elapsed{};
+		// the clock is only read between batches, it takes longer than a short call
+		for (uint64_t batch = 1; elapsed.count() < seconds / 3; batch *= 2) {
+			for (uint64_t i = 0; i < batch; ++i) { function(); }
+			calls += batch;
+			elapsed = std::chrono::steady_clock::now() - start;
+		}
+		double ns = elapsed.count() * 1e9 / (double)calls;
+		if (round == 0 || ns < best)
+			best = ns;
+	}
+	return best;
+}
+} // namespace bench
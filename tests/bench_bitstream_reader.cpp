@@ -0,0 +1,66 @@
+// Parses the SPS, PPS & slice headers of x264 in a loop with the cached BitstreamReader and
+// with the bit at a time reader it replaced
+#include "bench.h"
+#include "h264_syntax.h"
+#include "reference/bitstream_reader.h"
+#include "src/utils/h264/h264_common.h"
+
+#include <cstdio>
+
+using namespace h264_syntax;
+
+// the old reader throws at the end of the data
+template<class Bits, class Reader, class Parse>
+static double NsPerParse(const std::vector<uint8_t>& data, Parse parse) {
+	return bench::NsPerCall([&]() {
+		Bits bits(data);
+		Reader reader(bits);
+		try {
+			bench::Use(parse(reader));
+		} catch (...) {
+			bench::Use(0);
+		}
+	});
+}
+
+template<class Parse>
+static void Report(const char* name, const std::vector<uint8_t>& data, Parse parse) {
+	double old_ns = NsPerParse<reference::BitstreamReader, reference::ExponentialGolombReader>(
+	  data, parse);
+	double new_ns = NsPerParse<utils::video::BitstreamReader,
+				   utils::video::ExponentialGolombReader>(data, parse);
+	printf("%-12s %7.1f ns -> %6.1f ns  %4.1fx\n", name, old_ns, new_ns, old_ns / new_ns);
+}
+
+int main() {
+	Sps sps = MakeSps();
+	Pps pps = MakePps();
+	Report("sps", WriteSps(sps), [](auto& r) { return ReadSps(r).height_in_map_units_minus1; });
+	Report("pps", WritePps(pps), [](auto& r) { return ReadPps(r).transform_8x8_mode_flag; });
+	Report("idr slice", WriteSliceHeader(MakeSliceHeader(true, 0), true, sps, pps),
+	       [&](auto& r) { return ReadSliceHeader(r, true, sps, pps).slice_qp_delta; });
+	Report("p slice", WriteSliceHeader(MakeSliceHeader(false, 3), false, sps, pps),
+	       [&](auto& r) { return ReadSliceHeader(r, false, sps, pps).slice_qp_delta; });
+
+	// a truncated SPS, as a fuzzer or a lossy link hands it over
+	auto truncated = WriteSps(sps);
+	truncated.resize(truncated.size() / 2);
+	Report("cut sps", truncated, [](auto& r) { return ReadSps(r).height_in_map_units_minus1; });
+
+	// long Exp-Golomb codes, 500 ue(v) values up to 2^16
+	BitWriter writer;
+	for (int i = 0; i < 500; ++i) { writer.UE((i * 2654435761u) >> 16); }
+	Report("500 ue(v)", writer.Finish(), [](auto& r) {
+		uint32_t sum = 0;
+		for (int i = 0; i < 500; ++i) { sum += r.ReadUE(); }
+		return sum;
+	});
+
+	// the parser of the tree, with the NAL header
+	auto data = WriteSps(sps);
+	data.insert(data.begin(), 0x67);
+	printf("%-12s %18.1f ns\n", "ParseSps", bench::NsPerCall([&]() {
+		       bench::Use(utils::h264::ParseSps(data)->height);
+	       }));
+	return 0;
+}
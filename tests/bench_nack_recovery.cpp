@@ -0,0 +1,284 @@
+// The share of the lost video packets the retransmission gets back, and how long a
+// receiver waits for them: a stream of 1080p60 at 6 Mbps goes from a server socket to a
+// client socket over the loopback, through a simulated link with loss & delay. The
+// server keeps its packets in the RetransmissionCache of the plugin and resends the
+// ones the generic NACKs(RFC 4585) of the client ask for, parsed by the plugin as well.
+#include "loopback.h"
+#include "loss.h"
+#include "src/server/retransmission_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <poll.h>
+
+using output::RetransmissionCache;
+
+static const unsigned kPacketSize = 1200;
+static const uint32_t kSsrc = 0x4E41434B;
+// like the BatchingGroupsock
+static const unsigned kMaxResends = 2;
+// the history of the server & the time the client waits for a packet
+static const uint64_t kHistoryNs = 500000000;
+// the client asks for a packet at most 3 times
+static const unsigned kMaxNacks = 3;
+
+using loopback::NowNs;
+
+// one direction of the link: drops packets, holds the rest back for the delay, then
+// sends them over the loopback
+class Link {
+public:
+	Link(int fd, const sockaddr_in& to, double loss, double burst, uint64_t delay_ns,
+	     uint32_t seed)
+	  : fd_(fd), to_(to), loss_(loss, burst, seed), delay_ns_(delay_ns) {}
+
+	void Send(const uint8_t* data, size_t size, uint64_t now_ns) {
+		if (loss_.Lost())
+			return;
+		queue_.push_back({now_ns + delay_ns_, std::vector<uint8_t>(data, data + size)});
+	}
+	void Flush(uint64_t now_ns) {
+		while (!queue_.empty() && queue_.front().due_ns <= now_ns) {
+			auto& packet = queue_.front().data;
+			sendto(fd_, packet.data(), packet.size(), 0, (sockaddr*)&to_, sizeof(to_));
+			queue_.pop_front();
+		}
+	}
+	uint64_t NextNs() const { return queue_.empty() ? UINT64_MAX : queue_.front().due_ns; }
+
+private:
+	struct Queued {
+		uint64_t due_ns;
+		std::vector<uint8_t> data;
+	};
+	int fd_;
+	sockaddr_in to_;
+	Loss loss_;
+	uint64_t delay_ns_;
+	std::deque<Queued> queue_;
+};
+
+// the generic NACK of `seqs`, sorted: a PID & BLP pair for every 17 packets
+static std::vector<uint8_t> MakeNack(const std::vector<uint16_t>& seqs) {
+	std::vector<uint8_t> nack = {0x81, 205, 0, 0, 0, 0, 0, 1};
+	for (int i = 0; i < 4; ++i) { nack.push_back((uint8_t)(kSsrc >> (24 - 8 * i))); }
+	for (size_t i = 0; i < seqs.size();) {
+		uint16_t pid = seqs[i++];
+		uint16_t blp = 0;
+		while (i < seqs.size() && (uint16_t)(seqs[i] - pid) <= 16) {
+			blp |= (uint16_t)(1 << ((uint16_t)(seqs[i] - pid) - 1));
+			++i;
+		}
+		nack.insert(nack.end(), {(uint8_t)(pid >> 8), (uint8_t)pid, (uint8_t)(blp >> 8),
+					 (uint8_t)blp});
+	}
+	unsigned words = (unsigned)nack.size() / 4 - 1;
+	nack[2] = (uint8_t)(words >> 8);
+	nack[3] = (uint8_t)words;
+	return nack;
+}
+
+struct Result {
+	size_t sent = 0;
+	size_t lost = 0;
+	size_t recovered = 0;
+	size_t frames = 0;
+	// the frames with a lost packet, and the ones which miss one in the end
+	size_t frames_hit = 0;
+	size_t frames_broken = 0;
+	size_t nacks = 0;
+	size_t resent = 0;
+	std::vector<double> delays_ms;
+};
+
+// `seconds` of the stream, a keyframe of 10 frames every 2 s
+static Result Run(double loss, double burst, uint64_t delay_ns, double seconds) {
+	sockaddr_in server_address, client_address;
+	int server = loopback::Socket(server_address, 4 << 20);
+	int client = loopback::Socket(client_address, 4 << 20);
+	Link down(server, client_address, loss, burst, delay_ns, 46);
+	Link up(client, server_address, loss, burst, delay_ns, 460);
+	RetransmissionCache cache(kHistoryNs, 6000);
+	std::vector<RetransmissionCache::Nack> nacks;
+
+	struct Missing {
+		uint64_t detected_ns;
+		uint64_t nacked_ns;
+		unsigned nacks;
+	};
+	std::map<uint16_t, Missing> missing;
+	// the frame of every packet, by its distance from the first sequence number
+	std::vector<size_t> frame_of;
+	std::vector<bool> arrived;
+	std::vector<bool> recovered;
+	const uint16_t first_seq = 65000;
+	uint16_t seq = first_seq;
+	uint16_t highest = 0;
+	bool started = false;
+
+	Result result;
+	const uint64_t frame_ns = 1000000000 / 60;
+	const size_t frame_count = (size_t)(seconds * 60);
+	const uint64_t start_ns = NowNs();
+	const uint64_t end_ns = start_ns + frame_count * frame_ns + kHistoryNs + 2 * delay_ns;
+	uint8_t buffer[2048];
+	std::vector<uint16_t> nack_seqs;
+	for (;;) {
+		uint64_t now = NowNs();
+		if (now >= end_ns)
+			break;
+
+		// the server sends the frames which are due as a burst
+		while (result.frames < frame_count && start_ns + result.frames * frame_ns <= now) {
+			size_t count = result.frames % 120 == 0 ? 90 : 9;
+			for (size_t i = 0; i < count; ++i) {
+				std::vector<uint8_t> packet(kPacketSize, (uint8_t)i);
+				packet[0] = 0x80;
+				packet[1] = (uint8_t)((i + 1 == count ? 0x80 : 0) | 96);
+				packet[2] = (uint8_t)(seq >> 8);
+				packet[3] = (uint8_t)seq;
+				for (int b = 0; b < 4; ++b) {
+					packet[8 + b] = (uint8_t)(kSsrc >> (24 - 8 * b));
+				}
+				cache.Store((sockaddr_storage&)client_address, 255, packet.data(),
+					    (unsigned)packet.size(), count == 90, now);
+				down.Send(packet.data(), packet.size(), now);
+				frame_of.push_back(result.frames);
+				arrived.push_back(false);
+				recovered.push_back(false);
+				++seq;
+				++result.sent;
+			}
+			++result.frames;
+		}
+
+		// the client asks again for the packets which didn't come, or gives up on them
+		nack_seqs.clear();
+		for (auto it = missing.begin(); it != missing.end();) {
+			if (now - it->second.detected_ns > kHistoryNs) {
+				it = missing.erase(it);
+				continue;
+			}
+			if (it->second.nacks < kMaxNacks &&
+			    now - it->second.nacked_ns > 2 * delay_ns + 10000000) {
+				++it->second.nacks;
+				it->second.nacked_ns = now;
+				nack_seqs.push_back(it->first);
+			}
+			++it;
+		}
+		if (!nack_seqs.empty()) {
+			auto nack = MakeNack(nack_seqs);
+			up.Send(nack.data(), nack.size(), now);
+			++result.nacks;
+		}
+
+		down.Flush(now);
+		up.Flush(now);
+
+		uint64_t next = std::min({down.NextNs(), up.NextNs(), now + 2000000,
+					  start_ns + result.frames * frame_ns});
+		pollfd fds[] = {{server, POLLIN, 0}, {client, POLLIN, 0}};
+		poll(fds, 2, next > now ? (int)((next - now + 999999) / 1000000) : 0);
+		now = NowNs();
+
+		// the server resends what the NACKs ask for
+		ssize_t size;
+		while ((size = recv(server, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+			RetransmissionCache::ParseNacks(buffer, (unsigned)size, nacks);
+			for (auto& nack : nacks) {
+				RetransmissionCache::Entry* entry = cache.Find(nack.ssrc, nack.seq, now);
+				if (entry == nullptr || entry->resends >= kMaxResends)
+					continue;
+				++entry->resends;
+				down.Send(entry->data.data(), entry->data.size(), now);
+				++result.resent;
+			}
+		}
+
+		// the client NACKs a gap as soon as a later packet shows it
+		nack_seqs.clear();
+		while ((size = recv(client, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+			uint16_t s = (uint16_t)(buffer[2] << 8 | buffer[3]);
+			size_t index = (uint16_t)(s - first_seq);
+			if (index >= arrived.size() || arrived[index])
+				continue;
+			arrived[index] = true;
+			auto it = missing.find(s);
+			if (it != missing.end()) {
+				result.delays_ms.push_back((now - it->second.detected_ns) / 1e6);
+				recovered[index] = true;
+				missing.erase(it);
+				continue;
+			}
+			if (started && (int16_t)(s - highest) <= 0)
+				continue;
+			for (uint16_t gap = (uint16_t)(highest + 1); started && gap != s; ++gap) {
+				missing[gap] = {now, now, 1};
+				nack_seqs.push_back(gap);
+			}
+			highest = s;
+			started = true;
+		}
+		if (!nack_seqs.empty()) {
+			auto nack = MakeNack(nack_seqs);
+			up.Send(nack.data(), nack.size(), now);
+			++result.nacks;
+		}
+	}
+	close(server);
+	close(client);
+
+	std::vector<bool> hit(frame_count, false);
+	std::vector<bool> broken(frame_count, false);
+	for (size_t i = 0; i < arrived.size(); ++i) {
+		if (!arrived[i] || recovered[i])
+			hit[frame_of[i]] = true;
+		if (!arrived[i])
+			broken[frame_of[i]] = true;
+	}
+	result.frames_hit = std::count(hit.begin(), hit.end(), true);
+	result.frames_broken = std::count(broken.begin(), broken.end(), true);
+	result.recovered = result.delays_ms.size();
+	result.lost = result.recovered + std::count(arrived.begin(), arrived.end(), false);
+	return result;
+}
+
+static double Percentile(std::vector<double> values, double p) {
+	if (values.empty())
+		return 0;
+	std::sort(values.begin(), values.end());
+	return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+int main() {
+	struct Model {
+		const char* name;
+		double loss;
+		double burst;
+	};
+	const Model models[] = {
+	  {"random 1%", 0.01, 1.0},
+	  {"random 3%", 0.03, 1.0},
+	  {"random 5%", 0.05, 1.0},
+	  {"burst 3% x3", 0.03, 3.0},
+	};
+	printf("3 s of 1080p60 at 6 Mbps per run, the NACKs go through the same link\n");
+	printf("%-12s %6s %6s %9s %18s %16s %8s %7s\n", "loss", "delay", "lost", "recovered",
+	       "frames hit/lost/all", "wait p50/p95", "max", "resent");
+	for (uint64_t delay_ms : {0, 20}) {
+		for (auto& model : models) {
+			Result r = Run(model.loss, model.burst, delay_ms * 1000000, 3.0);
+			printf("%-12s %4llums %6zu %8.1f%% %10zu/%zu/%zu %6.1f/%6.1fms %6.1fms %7zu\n",
+			       model.name, (unsigned long long)delay_ms, r.lost,
+			       r.lost == 0 ? 100.0 : 100.0 * r.recovered / r.lost, r.frames_hit,
+			       r.frames_broken, r.frames, Percentile(r.delays_ms, 0.5),
+			       Percentile(r.delays_ms, 0.95), Percentile(r.delays_ms, 1.0), r.resent);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,79 @@
+// The server's cost to split the OBS access units into NAL units: once with
+// FindNaluIndices for the discrete framer, against the byte by byte parse of
+// H264VideoStreamFramer it replaced
+#include "bench.h"
+#include "reference/stream_parser.h"
+#include "src/utils/h264/h264_common.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+// a 1080p60 x264 GOP of 2 s: SEI, SPS, PPS & the IDR, then single slice P frames
+static std::vector<std::vector<uint8_t>> MakeGop(size_t idr_size, size_t p_size) {
+	std::mt19937 random(31);
+	auto append_nalu = [&random](std::vector<uint8_t>& au, uint8_t header, size_t size) {
+		au.insert(au.end(), {0, 0, 0, 1, header});
+		for (size_t i = 0; i < size; ++i) {
+			uint8_t byte = (uint8_t)random();
+			// emulation prevention, no start code in the payload
+			size_t n = au.size();
+			if (byte <= 3 && au[n - 1] == 0 && au[n - 2] == 0)
+				au.push_back(3);
+			au.push_back(byte);
+		}
+	};
+
+	std::vector<std::vector<uint8_t>> gop(120);
+	for (size_t i = 0; i < gop.size(); ++i) {
+		if (i == 0) {
+			append_nalu(gop[i], 0x06, 600);
+			append_nalu(gop[i], 0x67, 20);
+			append_nalu(gop[i], 0x68, 4);
+			append_nalu(gop[i], 0x65, idr_size);
+		} else {
+			append_nalu(gop[i], 0x41, p_size);
+		}
+	}
+	return gop;
+}
+
+int main() {
+	// the usual 1080p60 bitrates
+	for (unsigned kbps : {6000, 12000, 40000}) {
+		size_t bytes_per_frame = (size_t)kbps * 1000 / 8 / 60;
+		auto gop = MakeGop(bytes_per_frame * 10, bytes_per_frame * 110 / 119);
+		size_t largest = 0;
+		for (auto& au : gop) { largest = std::max(largest, au.size()); }
+
+		// the discrete framer: the indices of every NAL unit, which the sources copy into
+		// the buffers of their sinks
+		std::vector<utils::video::NaluIndex> indices;
+		std::vector<uint8_t> to(largest);
+		double discrete_ns = bench::NsPerCall([&]() {
+			for (auto& au : gop) {
+				utils::h264::FindNaluIndices(au.data(), au.size(), indices);
+				for (auto& nalu : indices) {
+					memcpy(to.data(), au.data() + nalu.payload_start_offset,
+					       nalu.payload_size);
+				}
+				bench::Use(to[0]);
+			}
+		});
+
+		reference::StreamParser parser(largest);
+		double parser_ns = bench::NsPerCall([&]() {
+			for (auto& au : gop) { bench::Use(parser.Parse(au.data(), au.size())); }
+		});
+
+		// the CPU time a second of the stream takes, the GOP is 2 s
+		auto cpu_ms = [](double gop_ns) { return gop_ns / 2 / 1e6; };
+		printf("%5u kbps: discrete framer %7.3f ms/s  %6.2f us/Mbps, "
+		       "stream framer %7.3f ms/s  %6.2f us/Mbps, %.1fx\n",
+		       kbps, cpu_ms(discrete_ns), cpu_ms(discrete_ns) * 1000 / (kbps / 1000.0),
+		       cpu_ms(parser_ns), cpu_ms(parser_ns) * 1000 / (kbps / 1000.0),
+		       parser_ns / discrete_ns);
+	}
+	return 0;
+}
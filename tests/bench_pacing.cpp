@@ -0,0 +1,162 @@
+// What the pacing of the unicast video does to a receiver behind a slower link: a stream
+// of 1080p60 at about 6 Mbps leaves the server at 1 Gbps, as a burst per frame or through
+// the `Pacer` of the BatchingGroupsock on a simulated clock, and passes the drop tail
+// queue of the bottleneck. The receiver counts the lost packets of the keyframes & of the other frames,
+// the interarrival jitter of RFC 3550 as the receiver reports have it, and how late the
+// last packet of a frame arrives. A simulation of the timing, nothing is sent.
+#include "src/server/pacer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <vector>
+
+static const unsigned kPacketSize = 1200;
+static const uint64_t kFrameNs = 1000000000 / 60;
+// the NIC of the server
+static const double kServerBitsPerSecond = 1e9;
+// like the BatchingGroupsock & the encoder setting
+static const unsigned kSlotSize = 2048;
+static const unsigned kBitrate = 6000;
+
+struct Link {
+	const char* name;
+	double bits_per_second;
+	double queue_bytes;
+};
+
+struct Result {
+	size_t keyframe_packets = 0;
+	size_t keyframe_lost = 0;
+	size_t other_packets = 0;
+	size_t other_lost = 0;
+	double jitter_ms = 0;
+	double max_jitter_ms = 0;
+	// from the capture of a frame to its last packet
+	std::vector<double> frame_delays_ms;
+	std::vector<double> keyframe_delays_ms;
+};
+
+// the bottleneck & the receiver, the packets come in the order they were sent
+class Receiver {
+public:
+	explicit Receiver(const Link& link) : link_(link) {}
+
+	void Packet(double sent_s, size_t frame, bool keyframe, bool last) {
+		(keyframe ? result_.keyframe_packets : result_.other_packets)++;
+		double backlog = std::max(0.0, free_s_ - sent_s) * link_.bits_per_second / 8;
+		if (backlog + kPacketSize > link_.queue_bytes) {
+			(keyframe ? result_.keyframe_lost : result_.other_lost)++;
+		} else {
+			free_s_ = std::max(sent_s, free_s_) + kPacketSize * 8 / link_.bits_per_second;
+			double captured_s = frame * kFrameNs / 1e9;
+			// J += (|D| - J) / 16, D the change of the transit time
+			double transit = free_s_ - captured_s;
+			if (received_) {
+				double d = std::fabs(transit - transit_) * 1000;
+				result_.jitter_ms += (d - result_.jitter_ms) / 16;
+				result_.max_jitter_ms = std::max(result_.max_jitter_ms, result_.jitter_ms);
+			}
+			transit_ = transit;
+			received_ = true;
+			frame_delay_ms_ = transit * 1000;
+		}
+		jitter_sum_ += result_.jitter_ms;
+		++packets_;
+		if (last) {
+			(keyframe ? result_.keyframe_delays_ms : result_.frame_delays_ms)
+			  .push_back(frame_delay_ms_);
+		}
+	}
+	// the average jitter over the packets replaces the last one
+	Result& Finish() {
+		result_.jitter_ms = jitter_sum_ / std::max<size_t>(1, packets_);
+		return result_;
+	}
+
+private:
+	Link link_;
+	Result result_;
+	double free_s_ = 0;
+	double transit_ = 0;
+	bool received_ = false;
+	double frame_delay_ms_ = 0;
+	double jitter_sum_ = 0;
+	size_t packets_ = 0;
+};
+
+// `seconds` of frames, a keyframe of 90 packets every 2 s and 9 packets otherwise.
+// `pacing`: percent of the frame interval the packets of a frame are spread over
+static Result Run(const Link& link, unsigned pacing, double seconds) {
+	Receiver receiver(link);
+	const size_t frames = (size_t)(seconds * 60);
+	output::Pacer pacer;
+	pacer.Configure(kBitrate, pacing * kFrameNs / 100, kSlotSize, 0);
+
+	struct Queued {
+		size_t frame;
+		bool keyframe;
+		bool last;
+	};
+	std::deque<Queued> queue;
+	uint64_t now = 0;
+	double nic_free = 0;
+	size_t next_frame = 0;
+	while (next_frame < frames || !queue.empty()) {
+		uint64_t frame_ns = next_frame < frames ? next_frame * kFrameNs : UINT64_MAX;
+		uint64_t send_ns = UINT64_MAX;
+		if (!queue.empty())
+			send_ns = pacer.Enabled() ? pacer.NextSendNs(kPacketSize, now) : now;
+		if (frame_ns <= send_ns) {
+			// the encoder hands over a frame, the groupsock queues its packets
+			now = frame_ns;
+			size_t count = next_frame % 120 == 0 ? 90 : 9;
+			for (size_t i = 0; i < count; ++i) {
+				queue.push_back({next_frame, count == 90, i + 1 == count});
+				pacer.Enqueue(kPacketSize, now);
+			}
+			++next_frame;
+			continue;
+		}
+		now = send_ns;
+		if (pacer.Enabled() && !pacer.Take(kPacketSize, now))
+			continue;
+		nic_free = std::max(nic_free, now / 1e9) + kPacketSize * 8 / kServerBitsPerSecond;
+		Queued packet = queue.front();
+		queue.pop_front();
+		receiver.Packet(nic_free, packet.frame, packet.keyframe, packet.last);
+	}
+	return receiver.Finish();
+}
+
+static double Percentile(std::vector<double> values, double p) {
+	if (values.empty())
+		return 0;
+	std::sort(values.begin(), values.end());
+	return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+int main() {
+	const Link links[] = {
+	  {"100M 64KB", 100e6, 64 << 10},
+	  {"50M 32KB", 50e6, 32 << 10},
+	  {"20M 64KB", 20e6, 64 << 10},
+	  {"20M 128KB", 20e6, 128 << 10},
+	  {"10M 64KB", 10e6, 64 << 10},
+	};
+	printf("60 s of 1080p60 at %u kbps, a keyframe of 108 KB every 2 s\n", kBitrate);
+	printf("%-10s %6s %10s %9s %16s %14s %12s\n", "link", "pacing", "key lost", "p lost",
+	       "jitter avg/max", "key delay max", "p delay p95");
+	for (auto& link : links) {
+		for (unsigned pacing : {0u, 50u, 100u}) {
+			Result r = Run(link, pacing, 60.0);
+			printf("%-10s %5u%% %9.1f%% %8.2f%% %7.2f/%6.2fms %12.1fms %10.1fms\n",
+			       link.name, pacing, 100.0 * r.keyframe_lost / r.keyframe_packets,
+			       100.0 * r.other_lost / r.other_packets, r.jitter_ms, r.max_jitter_ms,
+			       Percentile(r.keyframe_delays_ms, 1.0), Percentile(r.frame_delays_ms, 0.95));
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,192 @@
+// The syscalls & the CPU time of the server thread for a 1 MB IDR at a 1400 byte MTU,
+// about 750 RTP packets, over the loopback: a sendto for every packet as before, the
+// sendmmsg batches & the UDP GSO datagrams of BatchingGroupsock, and for RTP over TCP
+// the two send() per packet of live555 against a writev of the framing header & packet.
+#include "loopback.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <sys/uio.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+static const size_t kPacketSize = 1400;
+static const size_t kIdrSize = 1 << 20;
+// like the BatchingGroupsock
+static const size_t kMaxPackets = 64;
+static const size_t kMaxGsoBytes = 65000;
+static const int kRounds = 200;
+
+// the packets of the IDR, the last one is shorter
+static std::vector<std::vector<uint8_t>> MakeIdr() {
+	std::vector<std::vector<uint8_t>> packets;
+	for (size_t offset = 0; offset < kIdrSize; offset += kPacketSize) {
+		packets.emplace_back(std::min(kPacketSize, kIdrSize - offset), (uint8_t)offset);
+	}
+	return packets;
+}
+
+struct Result {
+	size_t syscalls = 0;
+	uint64_t cpu_ns = 0;
+	bool failed = false;
+};
+
+static void Report(const char* name, const Result& result, size_t packets) {
+	if (result.failed) {
+		printf("%-22s not supported here (%s)\n", name, strerror(errno));
+		return;
+	}
+	printf("%-22s %8.1f syscalls %9.1f us %7.3f us/packet\n", name,
+	       (double)result.syscalls / kRounds, result.cpu_ns / 1e3 / kRounds,
+	       result.cpu_ns / 1e3 / kRounds / packets);
+}
+
+// `gso`: runs of equally sized packets go out as one datagram each
+static Result SendUdp(int fd, sockaddr_in& to, const std::vector<std::vector<uint8_t>>& idr,
+		      bool batch, bool gso) {
+	Result result;
+	uint64_t start = loopback::ThreadCpuNs();
+	for (int round = 0; round < kRounds; ++round) {
+		if (!batch) {
+			for (auto& packet : idr) {
+				sendto(fd, packet.data(), packet.size(), 0, (sockaddr*)&to, sizeof(to));
+				++result.syscalls;
+			}
+			continue;
+		}
+		mmsghdr messages[kMaxPackets];
+		iovec iovs[kMaxPackets];
+		char controls[kMaxPackets][CMSG_SPACE(sizeof(uint16_t))];
+		for (size_t first = 0; first < idr.size(); first += kMaxPackets) {
+			size_t last = std::min(idr.size(), first + kMaxPackets);
+			memset(messages, 0, sizeof(messages));
+			size_t count = 0;
+			for (size_t i = first; i < last; ++i) {
+				iovs[i - first] = {(void*)idr[i].data(), idr[i].size()};
+			}
+			for (size_t i = first; i < last;) {
+				size_t run = 1;
+				size_t bytes = idr[i].size();
+				while (gso && i + run < last && idr[i + run].size() <= idr[i].size() &&
+				       bytes + idr[i + run].size() <= kMaxGsoBytes) {
+					bytes += idr[i + run].size();
+					if (idr[i + run++].size() < idr[i].size())
+						break;
+				}
+				msghdr& header = messages[count].msg_hdr;
+				header.msg_name = &to;
+				header.msg_namelen = sizeof(to);
+				header.msg_iov = &iovs[i - first];
+				header.msg_iovlen = run;
+				if (run > 1) {
+					header.msg_control = controls[count];
+					header.msg_controllen = sizeof(controls[count]);
+					cmsghdr* control = CMSG_FIRSTHDR(&header);
+					control->cmsg_level = SOL_UDP;
+					control->cmsg_type = UDP_SEGMENT;
+					control->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+					uint16_t segment_size = (uint16_t)idr[i].size();
+					memcpy(CMSG_DATA(control), &segment_size, sizeof(segment_size));
+				}
+				++count;
+				i += run;
+			}
+			for (size_t sent = 0; sent < count;) {
+				int sent_now = sendmmsg(fd, messages + sent, (unsigned)(count - sent), 0);
+				++result.syscalls;
+				if (sent_now < 0) {
+					result.failed = true;
+					return result;
+				}
+				sent += sent_now;
+			}
+		}
+	}
+	result.cpu_ns = loopback::ThreadCpuNs() - start;
+	return result;
+}
+
+// the interleaved packets of RFC 2326 10.12 to a reader on another thread
+static Result SendTcp(const std::vector<std::vector<uint8_t>>& idr, bool vectored) {
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t length = sizeof(address);
+	bind(listener, (sockaddr*)&address, sizeof(address));
+	getsockname(listener, (sockaddr*)&address, &length);
+	listen(listener, 1);
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	connect(fd, (sockaddr*)&address, sizeof(address));
+	int peer = accept(listener, nullptr, nullptr);
+	close(listener);
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	std::thread reader([peer]() {
+		std::vector<uint8_t> buffer(1 << 16);
+		while (recv(peer, buffer.data(), buffer.size(), 0) > 0) {}
+	});
+
+	Result result;
+	uint64_t start = loopback::ThreadCpuNs();
+	for (int round = 0; round < kRounds; ++round) {
+		for (auto& packet : idr) {
+			uint8_t header[4] = {'$', 0, (uint8_t)(packet.size() >> 8), (uint8_t)packet.size()};
+			if (vectored) {
+				iovec iovs[2] = {{header, 4}, {(void*)packet.data(), packet.size()}};
+				writev(fd, iovs, 2);
+				++result.syscalls;
+			} else {
+				send(fd, header, 4, 0);
+				send(fd, packet.data(), packet.size(), 0);
+				result.syscalls += 2;
+			}
+		}
+	}
+	result.cpu_ns = loopback::ThreadCpuNs() - start;
+	shutdown(fd, SHUT_WR);
+	reader.join();
+	close(fd);
+	close(peer);
+	return result;
+}
+
+int main() {
+	auto idr = MakeIdr();
+	sockaddr_in receiver;
+	int sink = loopback::Socket(receiver, 4 << 20);
+	// the receiver reads on another thread until the socket is shut down
+	std::atomic<bool> stop{false};
+	timeval timeout = {0, 100000};
+	setsockopt(sink, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	std::thread reader([sink, &stop]() {
+		uint8_t buffer[2048];
+		while (!stop.load()) { recv(sink, buffer, sizeof(buffer), 0); }
+	});
+	sockaddr_in sender_address;
+	int sender = loopback::Socket(sender_address, 4096);
+
+	printf("a %zu byte IDR in %zu packets, the CPU time of the sending thread\n", kIdrSize,
+	       idr.size());
+	Report("udp sendto", SendUdp(sender, receiver, idr, false, false), idr.size());
+	Report("udp sendmmsg", SendUdp(sender, receiver, idr, true, false), idr.size());
+	Report("udp sendmmsg + GSO", SendUdp(sender, receiver, idr, true, true), idr.size());
+	Report("tcp 2x send (live555)", SendTcp(idr, false), idr.size());
+	Report("tcp writev", SendTcp(idr, true), idr.size());
+	stop = true;
+	reader.join();
+	close(sender);
+	close(sink);
+	return 0;
+}
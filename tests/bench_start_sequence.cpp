@@ -0,0 +1,64 @@
+// GB/s of FindNaluIndices with every kernel this CPU can run, and of the byte-wise scanner
+// of the baseline
+#include "bench.h"
+#include "reference/find_nalu_indices.h"
+#include "src/utils/h264/h264_common.h"
+
+#include <cstdio>
+#include <random>
+
+struct Input {
+	const char* name;
+	std::vector<uint8_t> data;
+};
+
+// 8 MiB, the slice payload of a few 4K frames
+static Input MakeInput(const char* name, unsigned ones_in_16, unsigned zeros_in_16) {
+	std::mt19937 random(48);
+	Input input{name, std::vector<uint8_t>(8 << 20)};
+	for (auto& byte : input.data) {
+		unsigned r = random() % 16;
+		byte = r < ones_in_16 ? 1 : r < ones_in_16 + zeros_in_16 ? 0 : (uint8_t)random();
+	}
+	// a NAL unit every 64 KiB
+	for (size_t i = 0; i + 4 < input.data.size(); i += 64 << 10) {
+		input.data[i] = input.data[i + 1] = input.data[i + 2] = 0;
+		input.data[i + 3] = 1;
+	}
+	return input;
+}
+
+static void Report(const char* scanner, const Input& input, double ns) {
+	printf("%-10s %-14s %6.2f GB/s\n", scanner, input.name, (double)input.data.size() / ns);
+}
+
+int main() {
+	const Input inputs[] = {
+	  MakeInput("random", 0, 0),
+	  // memchr() stops at every 1
+	  MakeInput("many 1s", 4, 0),
+	  // the byte-wise scanner steps one byte at a time over the 0s
+	  MakeInput("many 0s", 0, 4),
+	};
+
+	printf("default kernel: %s\n", utils::video::StartSequenceKernel());
+	std::vector<utils::video::NaluIndex> indices;
+	for (const char* kernel : {"avx2", "sse2", "neon", "scalar"}) {
+		if (!utils::video::UseStartSequenceKernel(kernel))
+			continue;
+		for (auto& input : inputs) {
+			Report(kernel, input, bench::NsPerCall([&]() {
+				       utils::h264::FindNaluIndices(input.data.data(), input.data.size(),
+								    indices);
+				       bench::Use(indices.size());
+			       }));
+		}
+	}
+	for (auto& input : inputs) {
+		Report("reference", input, bench::NsPerCall([&]() {
+			       bench::Use(reference::FindNaluIndices(input.data.data(), input.data.size())
+						  .size());
+		       }));
+	}
+	return 0;
+}
@@ -0,0 +1,152 @@
+// How many 1080p viewers the RTP fan-out of one server keeps up with: every shard thread
+// owns a share of the viewers and sends them the frames of one shared buffer over the
+// loopback, like the worker loops of ShardingRtspServer with the frames of the
+// FrameFanout. Per viewer & packet it does the work of the RTP sink & BatchingGroupsock:
+// the RTP header, the copy of the payload into the packet, and a sendmmsg of up to 64
+// packets. The RTSP & RTCP handling and the H264 fragmentation of live555 are left out.
+#include "loopback.h"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+
+static const size_t kPayloadSize = 1388;
+static const size_t kRtpHeaderSize = 12;
+static const size_t kMaxPackets = 64;
+// the viewers share the sockets which receive, none of them reads
+static const size_t kSinks = 64;
+
+struct Viewer {
+	sockaddr_in address;
+	uint16_t seq;
+	uint32_t ssrc;
+};
+
+// a second of 1080p60 at `kbps`: an IDR of 10 frames, then P frames
+static std::vector<std::vector<uint8_t>> MakeSecond(unsigned kbps) {
+	std::mt19937 random(37);
+	size_t p_size = (size_t)kbps * 1000 / 8 / 69;
+	std::vector<std::vector<uint8_t>> frames(60);
+	for (size_t i = 0; i < frames.size(); ++i) {
+		frames[i].resize(i == 0 ? p_size * 10 : p_size);
+		for (auto& byte : frames[i]) { byte = (uint8_t)random(); }
+	}
+	return frames;
+}
+
+// sends `frames` to `viewers`, returns the sendmmsg calls
+static size_t SendAll(int fd, const std::vector<std::vector<uint8_t>>& frames,
+		      std::vector<Viewer>& viewers) {
+	std::vector<uint8_t> buffers(kMaxPackets * (kRtpHeaderSize + kPayloadSize));
+	std::vector<iovec> iovs(kMaxPackets);
+	std::vector<mmsghdr> messages(kMaxPackets);
+	size_t calls = 0;
+	for (uint32_t timestamp = 0; timestamp < frames.size(); ++timestamp) {
+		const std::vector<uint8_t>& frame = frames[timestamp];
+		for (auto& viewer : viewers) {
+			size_t count = 0;
+			for (size_t offset = 0; offset < frame.size(); offset += kPayloadSize) {
+				size_t size = std::min(kPayloadSize, frame.size() - offset);
+				uint8_t* packet = buffers.data() + count * (kRtpHeaderSize + kPayloadSize);
+				bool marker = offset + size == frame.size();
+				packet[0] = 0x80;
+				packet[1] = (uint8_t)((marker ? 0x80 : 0) | 96);
+				packet[2] = (uint8_t)(viewer.seq >> 8);
+				packet[3] = (uint8_t)viewer.seq;
+				++viewer.seq;
+				uint32_t rtp_timestamp = timestamp * 1500;
+				for (int b = 0; b < 4; ++b) {
+					packet[4 + b] = (uint8_t)(rtp_timestamp >> (24 - 8 * b));
+					packet[8 + b] = (uint8_t)(viewer.ssrc >> (24 - 8 * b));
+				}
+				memcpy(packet + kRtpHeaderSize, frame.data() + offset, size);
+
+				iovs[count] = {packet, kRtpHeaderSize + size};
+				messages[count] = {};
+				messages[count].msg_hdr.msg_name = &viewer.address;
+				messages[count].msg_hdr.msg_namelen = sizeof(viewer.address);
+				messages[count].msg_hdr.msg_iov = &iovs[count];
+				messages[count].msg_hdr.msg_iovlen = 1;
+				if (++count == kMaxPackets || marker) {
+					for (size_t sent = 0; sent < count;) {
+						int result = sendmmsg(fd, messages.data() + sent,
+								      (unsigned)(count - sent), 0);
+						++calls;
+						if (result <= 0)
+							break;
+						sent += result;
+					}
+					count = 0;
+				}
+			}
+		}
+	}
+	return calls;
+}
+
+struct Result {
+	double wall_s;
+	double cpu_s;
+	size_t calls;
+};
+
+static Result Run(size_t viewer_count, size_t shard_count,
+		  const std::vector<std::vector<uint8_t>>& frames, const sockaddr_in* sinks) {
+	std::vector<std::vector<Viewer>> shards(shard_count);
+	for (size_t i = 0; i < viewer_count; ++i) {
+		shards[i % shard_count].push_back(
+		  {sinks[i % kSinks], (uint16_t)(i * 7919), (uint32_t)(0x10000 + i)});
+	}
+	std::vector<int> sockets(shard_count);
+	for (auto& fd : sockets) {
+		sockaddr_in address;
+		fd = loopback::Socket(address, 4096);
+	}
+
+	std::vector<size_t> calls(shard_count);
+	double cpu = loopback::CpuSeconds();
+	uint64_t start = loopback::NowNs();
+	std::vector<std::thread> threads;
+	for (size_t s = 0; s < shard_count; ++s) {
+		threads.emplace_back([&, s]() { calls[s] = SendAll(sockets[s], frames, shards[s]); });
+	}
+	for (auto& thread : threads) { thread.join(); }
+	Result result{(loopback::NowNs() - start) / 1e9, loopback::CpuSeconds() - cpu, 0};
+	for (size_t s = 0; s < shard_count; ++s) {
+		result.calls += calls[s];
+		close(sockets[s]);
+	}
+	return result;
+}
+
+int main() {
+	// the sockets of the viewers drop what they get, the loopback costs the sender the
+	// same either way
+	sockaddr_in sinks[kSinks];
+	std::vector<int> sink_sockets;
+	for (auto& sink : sinks) { sink_sockets.push_back(loopback::Socket(sink, 4096)); }
+
+	unsigned cores = std::thread::hardware_concurrency();
+	printf("%u cores, a second of 1080p60 sent to every viewer as fast as it goes\n", cores);
+	printf("%-6s %7s %9s %9s %10s %12s %14s\n", "kbps", "shards", "viewers", "wall", "cpu",
+	       "syscalls", "max viewers");
+	for (unsigned kbps : {6000, 12000}) {
+		auto frames = MakeSecond(kbps);
+		for (size_t shard_count : {1, 2, 4}) {
+			if (shard_count > 1 && shard_count > cores)
+				continue;
+			for (size_t viewers : {10, 50, 200, 1000}) {
+				Result r = Run(viewers, shard_count, frames, sinks);
+				// the viewers the shards keep up with in real time, with 20% to spare
+				printf("%-6u %7zu %9zu %8.3fs %9.3fs %12zu %14.0f\n", kbps, shard_count,
+				       viewers, r.wall_s, r.cpu_s, r.calls, viewers * 0.8 / r.wall_s);
+			}
+		}
+	}
+	for (int fd : sink_sockets) { close(fd); }
+	return 0;
+}
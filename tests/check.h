@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+// the tests are plain programs, a failed check prints where it failed and exits with 1
+#define CHECK(condition)                                                                     \
+	do {                                                                                 \
+		if (!(condition)) {                                                          \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__,     \
+				#condition);                                                 \
+			exit(1);                                                             \
+		}                                                                            \
+	} while (0)
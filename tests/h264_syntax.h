@@ -0,0 +1,240 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Writes & reads the H264 parameter sets & slice headers the way x264 sends them in OBS, so
+// the readers can be compared on real syntax. The parsers take either Exp-Golomb reader.
+namespace h264_syntax {
+class BitWriter {
+public:
+	void Bits(uint32_t value, int count) {
+		for (int i = count - 1; i >= 0; --i) { Bit((value >> i) & 1); }
+	}
+	void Bit(bool bit) {
+		if (bits_ % 8 == 0)
+			data_.push_back(0);
+		if (bit)
+			data_.back() |= 0x80 >> (bits_ % 8);
+		++bits_;
+	}
+	void UE(uint32_t value) {
+		uint64_t code = (uint64_t)value + 1;
+		int length = 0;
+		while ((code >> length) > 1) { ++length; }
+		Bits(0, length);
+		Bits((uint32_t)(code >> 32), length + 1 > 32 ? length + 1 - 32 : 0);
+		Bits((uint32_t)code, length + 1 > 32 ? 32 : length + 1);
+	}
+	void SE(int32_t value) { UE(value > 0 ? 2 * (uint32_t)value - 1 : -2 * (int64_t)value); }
+	// rbsp_trailing_bits
+	std::vector<uint8_t> Finish() {
+		Bit(true);
+		while (bits_ % 8 != 0) { Bit(false); }
+		return data_;
+	}
+
+private:
+	std::vector<uint8_t> data_;
+	size_t bits_ = 0;
+};
+
+struct Sps {
+	uint32_t profile_idc, level_idc, id, chroma_format_idc, bit_depth_luma_minus8,
+		log2_max_frame_num_minus4, pic_order_cnt_type, log2_max_poc_lsb_minus4,
+		max_num_ref_frames, width_in_mbs_minus1, height_in_map_units_minus1,
+		frame_mbs_only_flag, direct_8x8_inference_flag, frame_cropping_flag, crop_bottom,
+		vui_parameters_present_flag;
+};
+
+struct Pps {
+	uint32_t id, sps_id, entropy_coding_mode_flag, num_ref_idx_l0_default_minus1,
+		num_ref_idx_l1_default_minus1, weighted_pred_flag, weighted_bipred_idc;
+	int32_t pic_init_qp_minus26, pic_init_qs_minus26, chroma_qp_index_offset;
+	uint32_t deblocking_filter_control_present_flag, transform_8x8_mode_flag;
+};
+
+struct SliceHeader {
+	uint32_t first_mb_in_slice, slice_type, pps_id, frame_num, idr_pic_id, poc_lsb,
+		num_ref_idx_override_flag, cabac_init_idc;
+	int32_t slice_qp_delta;
+	uint32_t disable_deblocking_filter_idc;
+};
+
+// x264 at 1080p, high profile, CABAC. The SPS has VUI, but the VUI itself isn't written.
+inline Sps MakeSps() {
+	return {100, 42, 0, 1, 0, 0, 0, 2, 4, 119, 67, 1, 1, 1, 4, 1};
+}
+inline Pps MakePps() {
+	return {0, 0, 1, 3, 0, 0, 2, -3, 0, -2, 1, 1};
+}
+inline SliceHeader MakeSliceHeader(bool idr, uint32_t frame) {
+	return {0, idr ? 7u : 5u, 0, idr ? 0 : frame % 16, 0, (frame * 2) % 64, 0, 0, -5, 0};
+}
+
+// the RBSPs, without the NAL header
+inline std::vector<uint8_t> WriteSps(const Sps& sps) {
+	BitWriter w;
+	w.Bits(sps.profile_idc, 8);
+	w.Bits(0, 8); // constraint_set flags
+	w.Bits(sps.level_idc, 8);
+	w.UE(sps.id);
+	w.UE(sps.chroma_format_idc);
+	w.UE(sps.bit_depth_luma_minus8);
+	w.UE(sps.bit_depth_luma_minus8); // chroma
+	w.Bit(false);                    // qpprime_y_zero_transform_bypass_flag
+	w.Bit(false);                    // seq_scaling_matrix_present_flag
+	w.UE(sps.log2_max_frame_num_minus4);
+	w.UE(sps.pic_order_cnt_type);
+	w.UE(sps.log2_max_poc_lsb_minus4);
+	w.UE(sps.max_num_ref_frames);
+	w.Bit(false); // gaps_in_frame_num_value_allowed_flag
+	w.UE(sps.width_in_mbs_minus1);
+	w.UE(sps.height_in_map_units_minus1);
+	w.Bit(sps.frame_mbs_only_flag);
+	w.Bit(sps.direct_8x8_inference_flag);
+	w.Bit(sps.frame_cropping_flag);
+	w.UE(0);
+	w.UE(0);
+	w.UE(0);
+	w.UE(sps.crop_bottom);
+	w.Bit(sps.vui_parameters_present_flag);
+	return w.Finish();
+}
+
+inline std::vector<uint8_t> WritePps(const Pps& pps) {
+	BitWriter w;
+	w.UE(pps.id);
+	w.UE(pps.sps_id);
+	w.Bit(pps.entropy_coding_mode_flag);
+	w.Bit(false); // bottom_field_pic_order_in_frame_present_flag
+	w.UE(0);      // num_slice_groups_minus1
+	w.UE(pps.num_ref_idx_l0_default_minus1);
+	w.UE(pps.num_ref_idx_l1_default_minus1);
+	w.Bit(pps.weighted_pred_flag);
+	w.Bits(pps.weighted_bipred_idc, 2);
+	w.SE(pps.pic_init_qp_minus26);
+	w.SE(pps.pic_init_qs_minus26);
+	w.SE(pps.chroma_qp_index_offset);
+	w.Bit(pps.deblocking_filter_control_present_flag);
+	w.Bit(false); // constrained_intra_pred_flag
+	w.Bit(false); // redundant_pic_cnt_present_flag
+	w.Bit(pps.transform_8x8_mode_flag);
+	w.Bit(false); // pic_scaling_matrix_present_flag
+	w.SE(pps.chroma_qp_index_offset);
+	return w.Finish();
+}
+
+// the start of the slice data follows the header, a few bytes of it are enough
+inline std::vector<uint8_t> WriteSliceHeader(const SliceHeader& header, bool idr,
+					     const Sps& sps, const Pps& pps) {
+	BitWriter w;
+	w.UE(header.first_mb_in_slice);
+	w.UE(header.slice_type);
+	w.UE(header.pps_id);
+	w.Bits(header.frame_num, sps.log2_max_frame_num_minus4 + 4);
+	if (idr)
+		w.UE(header.idr_pic_id);
+	w.Bits(header.poc_lsb, sps.log2_max_poc_lsb_minus4 + 4);
+	bool intra = header.slice_type % 5 == 2;
+	if (!intra)
+		w.Bit(header.num_ref_idx_override_flag);
+	if (!intra)
+		w.Bit(false); // ref_pic_list_modification_flag_l0
+	if (idr) {
+		w.Bit(false); // no_output_of_prior_pics_flag
+		w.Bit(false); // long_term_reference_flag
+	} else {
+		w.Bit(false); // adaptive_ref_pic_marking_mode_flag
+	}
+	if (pps.entropy_coding_mode_flag && !intra)
+		w.UE(header.cabac_init_idc);
+	w.SE(header.slice_qp_delta);
+	if (pps.deblocking_filter_control_present_flag)
+		w.UE(header.disable_deblocking_filter_idc);
+	w.Bits(0x5A5A5A5A, 32);
+	return w.Finish();
+}
+
+template<class Reader> Sps ReadSps(Reader& r) {
+	Sps sps{};
+	sps.profile_idc = r.ReadBits(8);
+	r.ReadBits(8);
+	sps.level_idc = r.ReadBits(8);
+	sps.id = r.ReadUE();
+	sps.chroma_format_idc = r.ReadUE();
+	sps.bit_depth_luma_minus8 = r.ReadUE();
+	r.ReadUE();
+	r.ReadBit();
+	r.ReadBit();
+	sps.log2_max_frame_num_minus4 = r.ReadUE();
+	sps.pic_order_cnt_type = r.ReadUE();
+	sps.log2_max_poc_lsb_minus4 = r.ReadUE();
+	sps.max_num_ref_frames = r.ReadUE();
+	r.ReadBit();
+	sps.width_in_mbs_minus1 = r.ReadUE();
+	sps.height_in_map_units_minus1 = r.ReadUE();
+	sps.frame_mbs_only_flag = r.ReadBit();
+	sps.direct_8x8_inference_flag = r.ReadBit();
+	sps.frame_cropping_flag = r.ReadBit();
+	r.ReadUE();
+	r.ReadUE();
+	r.ReadUE();
+	sps.crop_bottom = r.ReadUE();
+	sps.vui_parameters_present_flag = r.ReadBit();
+	return sps;
+}
+
+template<class Reader> Pps ReadPps(Reader& r) {
+	Pps pps{};
+	pps.id = r.ReadUE();
+	pps.sps_id = r.ReadUE();
+	pps.entropy_coding_mode_flag = r.ReadBit();
+	r.ReadBit();
+	r.ReadUE();
+	pps.num_ref_idx_l0_default_minus1 = r.ReadUE();
+	pps.num_ref_idx_l1_default_minus1 = r.ReadUE();
+	pps.weighted_pred_flag = r.ReadBit();
+	pps.weighted_bipred_idc = r.ReadBits(2);
+	pps.pic_init_qp_minus26 = r.ReadSE();
+	pps.pic_init_qs_minus26 = r.ReadSE();
+	pps.chroma_qp_index_offset = r.ReadSE();
+	pps.deblocking_filter_control_present_flag = r.ReadBit();
+	r.ReadBit();
+	r.ReadBit();
+	pps.transform_8x8_mode_flag = r.ReadBit();
+	r.ReadBit();
+	r.ReadSE();
+	return pps;
+}
+
+template<class Reader>
+SliceHeader ReadSliceHeader(Reader& r, bool idr, const Sps& sps, const Pps& pps) {
+	SliceHeader header{};
+	header.first_mb_in_slice = r.ReadUE();
+	header.slice_type = r.ReadUE();
+	header.pps_id = r.ReadUE();
+	header.frame_num = r.ReadBits(sps.log2_max_frame_num_minus4 + 4);
+	if (idr)
+		header.idr_pic_id = r.ReadUE();
+	header.poc_lsb = r.ReadBits(sps.log2_max_poc_lsb_minus4 + 4);
+	bool intra = header.slice_type % 5 == 2;
+	if (!intra) {
+		header.num_ref_idx_override_flag = r.ReadBit();
+		r.ReadBit();
+	}
+	if (idr) {
+		r.ReadBit();
+		r.ReadBit();
+	} else {
+		r.ReadBit();
+	}
+	if (pps.entropy_coding_mode_flag && !intra)
+		header.cabac_init_idc = r.ReadUE();
+	header.slice_qp_delta = r.ReadSE();
+	if (pps.deblocking_filter_control_present_flag)
+		header.disable_deblocking_filter_idc = r.ReadUE();
+	return header;
+}
+} // namespace h264_syntax
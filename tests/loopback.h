@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// UDP sockets on the loopback & the clocks of the benchmarks which send through them
+namespace loopback {
+inline uint64_t NowNs() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		 std::chrono::steady_clock::now().time_since_epoch())
+	  .count();
+}
+
+// the user & system CPU time of the process
+inline double CpuSeconds() {
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+	       (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// the CPU time of the calling thread, the receiving end runs on another one
+inline uint64_t ThreadCpuNs() {
+	timespec time;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+	return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+// a socket on a free port of 127.0.0.1, `address` is where it's bound
+inline int Socket(sockaddr_in& address, int receive_buffer) {
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof(receive_buffer));
+	address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t length = sizeof(address);
+	if (fd < 0 || bind(fd, (sockaddr*)&address, sizeof(address)) != 0 ||
+	    getsockname(fd, (sockaddr*)&address, &length) != 0) {
+		perror("loopback socket");
+		exit(1);
+	}
+	return fd;
+}
+} // namespace loopback
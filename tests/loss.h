@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+
+// The share of the packets a link drops, Gilbert-Elliott for the bursts of a congested
+// link: `bad` drops everything. A `burst` of 1 is random loss.
+class Loss {
+public:
+	Loss(double loss, double burst, uint32_t seed) : random_(seed), bad_(false) {
+		// the mean burst is `burst` packets long, the loss rate is `loss` on average
+		leave_ = 1.0 / burst;
+		enter_ = loss * leave_ / (1.0 - loss);
+	}
+	bool Lost() {
+		std::uniform_real_distribution<double> uniform;
+		bad_ = bad_ ? uniform(random_) >= leave_ : uniform(random_) < enter_;
+		return bad_;
+	}
+
+private:
+	std::mt19937 random_;
+	bool bad_;
+	double enter_;
+	double leave_;
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+// The bit at a time BitstreamReader & ExponentialGolombReader the tree had before the 64 bit
+// cache, they throw at the end of the data. The tests & benchmarks compare with them.
+namespace reference {
+// A simple bitstream reader
+class BitstreamReader {
+public:
+	BitstreamReader(const uint8_t* data, size_t size)
+	  : data_(data), size_(size), bit_position_(0) {}
+	BitstreamReader(const std::vector<uint8_t>& data)
+	  : BitstreamReader(data.data(), data.size()) {}
+
+	uint32_t ReadBits(int numBits) {
+		uint32_t value = 0;
+		for (int i = 0; i < numBits; i++) {
+			value <<= 1;
+			value |= ReadBit() ? 1 : 0;
+		}
+		return value;
+	}
+
+	bool ReadBit() {
+		if (bit_position_ >= size_ * 8) {
+			throw std::runtime_error("End of stream");
+		}
+		bool bit = data_[bit_position_ / 8] & (0x80 >> (bit_position_ % 8));
+		bit_position_++;
+		return bit;
+	}
+
+private:
+	const uint8_t* data_;
+	size_t size_;
+	size_t bit_position_;
+};
+
+// A simple Exp-Golomb code reader
+class ExponentialGolombReader {
+public:
+	ExponentialGolombReader(BitstreamReader& bitstream) : bitstream_(bitstream) {}
+
+	uint32_t ReadUE() {
+		int leadingZeroBits = -1;
+		for (bool bit = false; !bit; leadingZeroBits++) { bit = bitstream_.ReadBit(); }
+		return ((1 << leadingZeroBits) - 1) + bitstream_.ReadBits(leadingZeroBits);
+	}
+
+	int32_t ReadSE() {
+		uint32_t unsigned_val = ReadUE();
+		if (unsigned_val % 2 == 0) {
+			return -static_cast<int>(unsigned_val / 2);
+		} else {
+			return (unsigned_val + 1) / 2;
+		}
+	}
+
+  uint32_t ReadBits(int numBits) {
+    return bitstream_.ReadBits(numBits);
+  }
+
+  bool ReadBit() {
+    return bitstream_.ReadBit();
+  }
+
+private:
+	BitstreamReader& bitstream_;
+};
+} // namespace reference
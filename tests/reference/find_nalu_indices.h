@@ -0,0 +1,51 @@
+#pragma once
+
+#include "src/utils/video_utils.h"
+
+// The byte-wise scanner FindNaluIndices had before the memchr() filter and the vector
+// kernels, the tests & benchmarks compare with it.
+namespace reference {
+inline std::vector<utils::video::NaluIndex> FindNaluIndices(const uint8_t* buffer,
+							    size_t buffer_size) {
+	// This is sorta like Boyer-Moore, but with only the first optimization step:
+	// given a 3-byte sequence we're looking at, if the 3rd byte isn't 1 or 0,
+	// skip ahead to the next 3-byte sequence. 0s and 1s are relatively rare, so
+	// this will skip the majority of reads/checks.
+	std::vector<utils::video::NaluIndex> sequences;
+	if (buffer_size < 3)
+		return sequences;
+
+	const size_t end = buffer_size - 3;
+	for (size_t i = 0; i < end;) {
+		if (buffer[i + 2] > 1) {
+			i += 3;
+		} else if (buffer[i + 2] == 1) {
+			if (buffer[i + 1] == 0 && buffer[i] == 0) {
+				// We found a start sequence, now check if it was a 3 of 4 byte one.
+				utils::video::NaluIndex index = {i, i + 3, 0};
+				if (index.start_offset > 0 && buffer[index.start_offset - 1] == 0)
+					--index.start_offset;
+
+				// Update length of previous entry.
+				auto it = sequences.rbegin();
+				if (it != sequences.rend())
+					it->payload_size =
+					  index.start_offset - it->payload_start_offset;
+
+				sequences.push_back(index);
+			}
+
+			i += 3;
+		} else {
+			++i;
+		}
+	}
+
+	// Update length of last entry, if any.
+	auto it = sequences.rbegin();
+	if (it != sequences.rend())
+		it->payload_size = buffer_size - it->payload_start_offset;
+
+	return sequences;
+}
+} // namespace reference
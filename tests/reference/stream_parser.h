@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// The work live555's H264VideoStreamFramer does for every byte of an access unit, which the
+// discrete framer skips: the frame is copied into the bank of the parser, the parser walks
+// it 4 bytes at a time(1 at a time near 0s & 1s) looking for the next start code and saves
+// what it walked over into the buffer of the sink. Modelled on
+// H264or5VideoStreamParser::parse, the live555 sources aren't part of this tree. The slice
+// header analysis the parser does on top isn't modelled, the real framer costs more.
+namespace reference {
+class StreamParser {
+public:
+	explicit StreamParser(size_t bank_size) : bank_(bank_size), to_(bank_size) {}
+
+	// the number of NAL units in the access unit, which fits the bank
+	size_t Parse(const uint8_t* data, size_t size) {
+		memcpy(bank_.data(), data, size);
+		const uint8_t* p = bank_.data();
+		const uint8_t* end = p + size;
+		size_t nalus = 0;
+		size_t saved = 0;
+		while (end - p >= 4) {
+			uint32_t next = (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+			if (next == 0x00000001 || (next & 0xFFFFFF00) == 0x00000100) {
+				// the NAL unit so far goes to the sink
+				nalus += saved > 0;
+				saved = 0;
+				p += next == 0x00000001 ? 4 : 3;
+			} else if ((next & 0xFF) > 1) {
+				// no start code begins in these 4 bytes
+				memcpy(&to_[saved], p, 4);
+				saved += 4;
+				p += 4;
+			} else {
+				to_[saved++] = *p++;
+			}
+		}
+		while (p < end) { to_[saved++] = *p++; }
+		return nalus + (saved > 0);
+	}
+
+	const uint8_t* To() const { return to_.data(); }
+
+private:
+	std::vector<uint8_t> bank_;
+	std::vector<uint8_t> to_;
+};
+} // namespace reference
@@ -0,0 +1,126 @@
+// The BitrateController against made up receiver reports: the hold-offs between the
+// changes, the band between the loss thresholds, the limits, the primary client and the
+// increases which wait for every receiver to report
+#include "check.h"
+#include "src/server/bitrate_controller.h"
+
+#include <cstdio>
+#include <vector>
+
+using output::BitrateController;
+using output::ClientStats;
+
+// the clock of the test starts late enough for the hold-offs after the start
+static uint64_t At(unsigned seconds) {
+	return (100 + (uint64_t)seconds) * 1000000000ULL;
+}
+
+static ClientStats Video(const char* address, unsigned session_id, uint32_t report_seq,
+			 double loss) {
+	ClientStats client;
+	client.address = address;
+	client.session_id = session_id;
+	client.report_seq = report_seq;
+	client.loss = loss;
+	client.jitter_ms = 2.0;
+	return client;
+}
+
+// a decrease waits for the previous one to show, an increase for a calm period
+static void TestHoldOff() {
+	BitrateController controller(1000, 100, 5000, "");
+	CHECK(controller.Update({Video("10.0.0.1", 1, 1, 0.2)}, At(1)) == 900);
+	// the same congestion a second later
+	CHECK(controller.Update({Video("10.0.0.1", 1, 2, 0.2)}, At(2)) == 0);
+	CHECK(controller.Update({Video("10.0.0.1", 1, 3, 0.2)}, At(3)) == 810);
+	// no loss, but too soon after the decrease
+	CHECK(controller.Update({Video("10.0.0.1", 1, 4, 0.0)}, At(5)) == 0);
+	CHECK(controller.Update({Video("10.0.0.1", 1, 5, 0.0)}, At(10)) == 0);
+	CHECK(controller.Update({Video("10.0.0.1", 1, 6, 0.0)}, At(11)) == 874);
+	// and the next increase after the interval
+	CHECK(controller.Update({Video("10.0.0.1", 1, 7, 0.0)}, At(12)) == 0);
+	CHECK(controller.Update({Video("10.0.0.1", 1, 8, 0.0)}, At(13)) == 943);
+	// a report which was seen already changes nothing
+	CHECK(controller.Update({Video("10.0.0.1", 1, 8, 0.5)}, At(20)) == 0);
+	CHECK(controller.Target() == 943);
+}
+
+// the loss between the thresholds holds the bitrate in either direction
+static void TestHysteresis() {
+	BitrateController controller(1000, 100, 5000, "");
+	for (uint32_t i = 1; i <= 10; ++i) {
+		CHECK(controller.Update({Video("10.0.0.1", 1, i, 0.05)}, At(10 + 2 * i)) ==
+		      0);
+	}
+	CHECK(controller.Target() == 1000);
+	CHECK(controller.Update({Video("10.0.0.1", 1, 11, 0.11)}, At(40)) == 945);
+	CHECK(controller.Update({Video("10.0.0.1", 1, 12, 0.09)}, At(43)) == 0);
+}
+
+// the limits clamp the target, a small step up to a limit is taken anyway
+static void TestClamps() {
+	BitrateController low(1000, 800, 5000, "");
+	CHECK(low.Update({Video("10.0.0.1", 1, 1, 0.6)}, At(1)) == 800);
+	CHECK(low.Update({Video("10.0.0.1", 1, 2, 0.6)}, At(4)) == 0);
+	CHECK(low.Target() == 800);
+
+	BitrateController high(1000, 100, 1020, "");
+	CHECK(high.Update({Video("10.0.0.1", 1, 1, 0.0)}, At(10)) == 1020);
+	CHECK(high.Update({Video("10.0.0.1", 1, 2, 0.0)}, At(13)) == 0);
+	CHECK(high.Target() == 1020);
+
+	// the start bitrate is clamped as well
+	BitrateController start(9000, 100, 5000, "");
+	CHECK(start.Target() == 5000);
+}
+
+// only the primary client steers, the audio tracks never do
+static void TestPrimary() {
+	BitrateController controller(1000, 100, 5000, "10.0.0.1");
+	ClientStats audio = Video("10.0.0.1", 1, 1, 0.5);
+	audio.audio = true;
+	CHECK(controller.Update({audio, Video("10.0.0.2", 2, 1, 0.5)}, At(1)) == 0);
+	CHECK(controller.Update({Video("10.0.0.1", 1, 1, 0.5), Video("10.0.0.2", 2, 2, 0.5)},
+				At(2)) == 750);
+	// the others' loss doesn't hold the increase back either
+	CHECK(controller.Update({Video("10.0.0.1", 1, 2, 0.0), Video("10.0.0.2", 2, 3, 0.5)},
+				At(11)) == 810);
+}
+
+// a low loss report of one receiver doesn't raise the bitrate while the others are quiet
+static void TestAllReceivers() {
+	BitrateController controller(1000, 100, 5000, "");
+	std::vector<ClientStats> clients = {Video("10.0.0.1", 1, 1, 0.0),
+					    Video("10.0.0.2", 2, 0, 0.0)};
+	// the second one hasn't reported at all
+	CHECK(controller.Update(clients, At(10)) == 0);
+	clients[1].report_seq = 1;
+	CHECK(controller.Update(clients, At(11)) == 1080);
+
+	// only the first one reports after the change
+	clients[0].report_seq = 2;
+	CHECK(controller.Update(clients, At(14)) == 0);
+	clients[0].report_seq = 3;
+	CHECK(controller.Update(clients, At(16)) == 0);
+	// the second one too, but it lost more than a little since
+	clients[1].report_seq = 2;
+	clients[1].loss = 0.05;
+	CHECK(controller.Update(clients, At(17)) == 0);
+	clients[1].report_seq = 3;
+	clients[1].loss = 0.0;
+	CHECK(controller.Update(clients, At(18)) == 1166);
+
+	// a receiver which left doesn't count
+	clients[0].report_seq = 4;
+	CHECK(controller.Update({clients[0]}, At(21)) == 1259);
+}
+
+int main() {
+	TestHoldOff();
+	TestHysteresis();
+	TestClamps();
+	TestPrimary();
+	TestAllReceivers();
+	printf("bitrate controller: all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,161 @@
+// The cached BitstreamReader against the bit at a time reader it replaced: the same values
+// for the same reads, and a failed `Ok` exactly where the old one threw
+#include "check.h"
+#include "h264_syntax.h"
+#include "reference/bitstream_reader.h"
+#include "src/utils/h264/h264_common.h"
+#include "src/utils/h265/h265_common.h"
+
+#include <cstring>
+#include <random>
+
+// random reads of random data, sparse data makes long Exp-Golomb codes
+static uint64_t RandomReads() {
+	std::mt19937 random(50);
+	uint64_t reads = 0;
+	for (int t = 0; t < 200000; ++t) {
+		std::vector<uint8_t> data(random() % 40);
+		int density = random() % 3;
+		for (auto& byte : data) {
+			unsigned r = random();
+			byte = density == 0 ? r : (r % (density == 1 ? 4 : 16) == 0 ? random() : 0);
+		}
+
+		reference::BitstreamReader old_bits(data);
+		reference::ExponentialGolombReader old_reader(old_bits);
+		utils::video::BitstreamReader new_bits(data.data(), data.size());
+		utils::video::ExponentialGolombReader new_reader(new_bits);
+		for (int k = 0; k < 60; ++k, ++reads) {
+			int op = random() % 4;
+			uint32_t expected = 0;
+			uint32_t value = 0;
+			bool threw = false;
+			if (op == 0) {
+				int bits = random() % 44;
+				try {
+					expected = old_reader.ReadBits(bits);
+				} catch (...) {
+					threw = true;
+				}
+				value = new_reader.ReadBits(bits);
+			} else if (op == 1) {
+				try {
+					expected = old_reader.ReadBit();
+				} catch (...) {
+					threw = true;
+				}
+				value = new_reader.ReadBit();
+			} else {
+				// the old reader shifts past 32 bits for a code of 32 leading zeros or
+				// more, the new one fails on it
+				reference::BitstreamReader peek = old_bits;
+				int zeros = 0;
+				try {
+					while (!peek.ReadBit()) { ++zeros; }
+				} catch (...) {
+				}
+				if (zeros >= 32) {
+					new_reader.ReadUE();
+					CHECK(!new_reader.Ok());
+					break;
+				}
+				try {
+					expected = op == 2 ? old_reader.ReadUE() : old_reader.ReadSE();
+				} catch (...) {
+					threw = true;
+				}
+				value = op == 2 ? new_reader.ReadUE() : new_reader.ReadSE();
+			}
+
+			if (threw) {
+				CHECK(!new_reader.Ok());
+				break;
+			}
+			CHECK(new_reader.Ok());
+			CHECK(value == expected);
+		}
+	}
+	return reads;
+}
+
+// the old reader's result, false if it threw
+template<class Parse> static bool ReadOld(const std::vector<uint8_t>& data, Parse parse) {
+	reference::BitstreamReader bits(data);
+	reference::ExponentialGolombReader reader(bits);
+	try {
+		parse(reader);
+	} catch (...) {
+		return false;
+	}
+	return true;
+}
+
+template<class Parse> static bool ReadNew(const std::vector<uint8_t>& data, Parse parse) {
+	utils::video::BitstreamReader bits(data.data(), data.size());
+	utils::video::ExponentialGolombReader reader(bits);
+	parse(reader);
+	return reader.Ok();
+}
+
+// the syntax x264 sends, whole & cut short after every byte
+template<class T, class Parse>
+static void CompareSyntax(const std::vector<uint8_t>& data, const T& written, Parse parse) {
+	for (size_t size = 0; size <= data.size(); ++size) {
+		std::vector<uint8_t> prefix(data.begin(), data.begin() + size);
+		T expected{};
+		T value{};
+		bool old_ok = ReadOld(prefix, [&](auto& reader) { expected = parse(reader); });
+		bool new_ok = ReadNew(prefix, [&](auto& reader) { value = parse(reader); });
+		CHECK(old_ok == new_ok);
+		if (old_ok)
+			CHECK(memcmp(&value, &expected, sizeof(T)) == 0);
+		if (size == data.size())
+			CHECK(new_ok && memcmp(&value, &written, sizeof(T)) == 0);
+	}
+}
+
+static void Syntax() {
+	using namespace h264_syntax;
+	Sps sps = MakeSps();
+	Pps pps = MakePps();
+	auto sps_data = WriteSps(sps);
+	CompareSyntax(sps_data, sps, [](auto& reader) { return ReadSps(reader); });
+	CompareSyntax(WritePps(pps), pps, [](auto& reader) { return ReadPps(reader); });
+	for (bool idr : {true, false}) {
+		SliceHeader header = MakeSliceHeader(idr, 3);
+		CompareSyntax(WriteSliceHeader(header, idr, sps, pps), header, [&](auto& reader) {
+			return ReadSliceHeader(reader, idr, sps, pps);
+		});
+	}
+
+	// the SPS parser of the tree, with the NAL header & cut short
+	sps_data.insert(sps_data.begin(), 0x67);
+	auto parsed = utils::h264::ParseSps(sps_data);
+	CHECK(parsed && parsed->width == 1920 && parsed->height == 1080);
+	for (size_t size = 0; size < sps_data.size(); ++size) {
+		CHECK(!utils::h264::ParseSps(sps_data.data(), size));
+	}
+}
+
+// no parser throws, reads out of bounds or loops on garbage
+static void Garbage() {
+	std::mt19937 random(51);
+	for (int i = 0; i < 100000; ++i) {
+		std::vector<uint8_t> data(random() % 64);
+		bool sparse = random() % 2;
+		for (auto& byte : data) { byte = sparse && random() % 4 ? 0 : random(); }
+		if (!data.empty())
+			data[0] = 0x67;
+		utils::h264::ParseSps(data);
+		utils::h265::ParseSps(data);
+	}
+}
+
+int main() {
+	uint64_t reads = RandomReads();
+	Syntax();
+	Garbage();
+	printf("%llu random reads identical, SPS/PPS/slice headers identical\n",
+	       (unsigned long long)reads);
+	return 0;
+}
@@ -0,0 +1,125 @@
+// FindStartSequence & everything built on it against the byte-wise scanner of the baseline,
+// with every kernel this CPU can run
+#include "check.h"
+#include "reference/find_nalu_indices.h"
+#include "src/utils/h264/h264_common.h"
+#include "src/utils/h265/h265_common.h"
+
+#include <random>
+
+using utils::video::NaluIndex;
+
+static bool Same(const std::vector<NaluIndex>& a, const std::vector<NaluIndex>& b) {
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); ++i) {
+		if (a[i].start_offset != b[i].start_offset ||
+		    a[i].payload_start_offset != b[i].payload_start_offset ||
+		    a[i].payload_size != b[i].payload_size)
+			return false;
+	}
+	return true;
+}
+
+static uint64_t compared = 0;
+
+static void Compare(const std::vector<uint8_t>& buffer) {
+	auto expected = reference::FindNaluIndices(buffer.data(), buffer.size());
+
+	CHECK(Same(utils::h264::FindNaluIndices(buffer.data(), buffer.size()), expected));
+	CHECK(Same(utils::h265::FindNaluIndices(buffer.data(), buffer.size()), expected));
+	// the reused vector holds the indices of the buffer before
+	static std::vector<NaluIndex> indices(3, NaluIndex{1, 2, 3});
+	utils::h264::FindNaluIndices(buffer.data(), buffer.size(), indices);
+	CHECK(Same(indices, expected));
+	utils::h265::FindNaluIndices(buffer.data(), buffer.size(), indices);
+	CHECK(Same(indices, expected));
+
+	utils::video::NaluReader reader(buffer.data(), buffer.size());
+	indices.clear();
+	for (NaluIndex nalu; reader.Next(nalu);) { indices.push_back(nalu); }
+	CHECK(Same(indices, expected));
+	++compared;
+}
+
+// every buffer of up to 11 bytes over {0, 1, 2}, the scalar tail of every kernel
+static void ShortBuffers() {
+	for (size_t size = 0; size <= 11; ++size) {
+		std::vector<uint8_t> buffer(size, 0);
+		while (true) {
+			Compare(buffer);
+			size_t i = 0;
+			for (; i < size && buffer[i] == 2; ++i) { buffer[i] = 0; }
+			if (i == size)
+				break;
+			++buffer[i];
+		}
+	}
+}
+
+// every 6 byte pattern over {0, 1, 2} at every offset of a buffer which spans a few
+// vectors of each kernel, so the pattern lands on every lane & across the vector ends
+static void PatternAtEveryOffset() {
+	const size_t size = 72;
+	for (int pattern = 0; pattern < 729; ++pattern) {
+		for (size_t offset = 0; offset + 6 <= size; ++offset) {
+			std::vector<uint8_t> buffer(size, 0x55);
+			for (int i = 0, p = pattern; i < 6; ++i, p /= 3) { buffer[offset + i] = p % 3; }
+			Compare(buffer);
+		}
+	}
+}
+
+// two start sequences at every pair of offsets, the second one is found from the first
+static void TwoStartSequences() {
+	const size_t size = 80;
+	for (size_t first = 0; first + 3 <= size; ++first) {
+		for (size_t second = 0; second + 3 <= size; ++second) {
+			std::vector<uint8_t> buffer(size, 0x80);
+			buffer[first] = buffer[first + 1] = 0;
+			buffer[first + 2] = 1;
+			buffer[second] = buffer[second + 1] = 0;
+			buffer[second + 2] = 1;
+			Compare(buffer);
+		}
+	}
+}
+
+// random buffers rich in 0s & 1s, and the ones made of a single byte value
+static void RandomBuffers() {
+	std::mt19937 random(48);
+	for (int i = 0; i < 100000; ++i) {
+		std::vector<uint8_t> buffer(random() % 400);
+		unsigned zeros = random() % 8;
+		for (auto& byte : buffer) {
+			unsigned r = random() % 8;
+			byte = r < zeros ? 0 : r == zeros ? 1 : (uint8_t)random();
+		}
+		Compare(buffer);
+	}
+	for (uint8_t value : {0, 1, 0x55}) {
+		for (size_t size : {0, 1, 2, 3, 17, 18, 33, 34, 35, 1000}) {
+			Compare(std::vector<uint8_t>(size, value));
+		}
+	}
+}
+
+int main() {
+	const char* default_kernel = utils::video::StartSequenceKernel();
+	int kernels = 0;
+	for (const char* kernel : {"avx2", "sse2", "neon", "scalar"}) {
+		if (!utils::video::UseStartSequenceKernel(kernel))
+			continue;
+		ShortBuffers();
+		PatternAtEveryOffset();
+		TwoStartSequences();
+		RandomBuffers();
+		printf("%s: identical to the reference\n", kernel);
+		++kernels;
+	}
+	CHECK(kernels >= 2);
+	CHECK(utils::video::UseStartSequenceKernel(default_kernel));
+	CHECK(!utils::video::UseStartSequenceKernel("none"));
+	printf("%llu buffers compared\n", (unsigned long long)compared);
+	return 0;
+}